@@ -0,0 +1,48 @@
+/*******************************************************************************************
+*
+*   Baked mesh format, written by tools/mesh_baker.c and read by AssetsLoadModel()
+*
+*   A .mesh file replaces a Wavefront .obj + .mtl pair. It holds the meshes already split per
+*   material, welded and indexed, in the layout raylib's Mesh uses, so loading is a copy and an upload.
+*
+*   Layout (all offsets from the file start, 4 byte aligned):
+*       BakedMeshFileHeader
+*       BakedMaterial[materialCount]
+*       BakedMeshHeader[meshCount]
+*       per mesh: float vertices[3*vertexCount], float normals[3*vertexCount],
+*                 float texcoords[2*vertexCount], uint16_t indices[indexCount]
+*
+********************************************************************************************/
+
+#ifndef BAKED_MESH_H
+#define BAKED_MESH_H
+
+#include <stdint.h>
+
+#define BAKED_MESH_MAGIC "RMSH"
+#define BAKED_MESH_VERSION 1
+#define BAKED_MESH_TEXTURE_NAME_SIZE 56
+
+typedef struct BakedMeshFileHeader
+{
+	char magic[4];				// BAKED_MESH_MAGIC
+	uint32_t version;			// BAKED_MESH_VERSION
+	int32_t materialCount;
+	int32_t meshCount;
+} BakedMeshFileHeader;
+
+typedef struct BakedMaterial
+{
+	uint8_t diffuseColor[4];	// rgba
+	char diffuseTexture[BAKED_MESH_TEXTURE_NAME_SIZE]; // file next to the .mesh file, empty for none
+} BakedMaterial;
+
+typedef struct BakedMeshHeader
+{
+	int32_t materialIndex;
+	int32_t vertexCount;
+	int32_t indexCount;			// triangles * 3
+	uint32_t dataOffset;		// start of the vertex arrays
+} BakedMeshHeader;
+
+#endif // BAKED_MESH_H
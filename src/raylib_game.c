@@ -13,7 +13,9 @@
 #include "raymath.h"
 #include "rlgl.h"
 
-#define PLATFORM_WEB // for IDE quick hack
+#if !defined(PLATFORM_DESKTOP)
+	#define PLATFORM_WEB // for IDE quick hack
+#endif
 #define RAYGUI_IMPLEMENTATION
 #include "raygui.h"                 // Required for GUI controls
 
@@ -23,11 +25,39 @@
 #endif
 
 #include "iconset.h"
+#include "baked_mesh.h"                     // Required for: .mesh files made by tools/mesh_baker.c
 
 #include <stdio.h>                          // Required for: printf()
 #include <stdlib.h>                         // Required for: 
 #include <string.h>                         // Required for:
 
+#if defined(PLATFORM_DESKTOP) && !defined(_WIN32)
+    #define SUPPORT_SNAPSHOT_MMAP
+    #include <sys/mman.h>                   // Required for: mmap(), snapshot loading
+    #include <sys/stat.h>                   // Required for: fstat()
+    #include <fcntl.h>                      // Required for: open()
+    #include <unistd.h>                     // Required for: close()
+#endif
+
+#if defined(PLATFORM_WEB)
+    #include <malloc.h>                     // Required for: mallinfo(), profiler memory use
+#elif defined(__linux__)
+    #include <unistd.h>                     // Required for: sysconf(), profiler memory use
+#endif
+
+#if defined(SIM_BENCHMARK)
+    #include <time.h>                       // Required for: clock_gettime(), benchmark timing
+#endif
+
+#if defined(SIM_MULTITHREADED)
+    #include <pthread.h>                    // Required for: job system workers and the simulation thread
+    #if defined(PLATFORM_WEB)
+        #include <emscripten/threading.h>   // Required for: emscripten_num_logical_cores()
+    #else
+        #include <unistd.h>                 // Required for: sysconf()
+    #endif
+#endif
+
 //----------------------------------------------------------------------------------------------------------------------
 // Defines and Macros
 //----------------------------------------------------------------------------------------------------------------------
@@ -40,6 +70,30 @@
     #define LOG(...)
 #endif
 
+// Frame profiler: subsystem timings of the main loop, shown in the debug window and dumped as CSV or Chrome trace
+// NOTE: the headless benchmark has no window, so no raylib timer either
+#if !defined(SIM_BENCHMARK)
+    #define SUPPORT_PROFILER
+#endif
+
+// Headless benchmark build, counts every allocation the game makes
+#if defined(SIM_BENCHMARK)
+    typedef struct BenchmarkAllocationCounts
+    {
+        int64_t allocs;
+        int64_t reallocs;
+        int64_t frees;
+    } BenchmarkAllocationCounts;
+    static BenchmarkAllocationCounts g_benchmarkAllocations;
+
+    static void* BenchmarkMemAlloc(unsigned int size) { g_benchmarkAllocations.allocs++; return MemAlloc(size); }
+    static void* BenchmarkMemRealloc(void* ptr, unsigned int size) { g_benchmarkAllocations.reallocs++; return MemRealloc(ptr, size); }
+    static void BenchmarkMemFree(void* ptr) { g_benchmarkAllocations.frees += ptr != NULL ? 1 : 0; MemFree(ptr); }
+    #define MemAlloc BenchmarkMemAlloc
+    #define MemRealloc BenchmarkMemRealloc
+    #define MemFree BenchmarkMemFree
+#endif
+
 //----------------------------------------------------------------------------------------------------------------------
 // Global constants
 //----------------------------------------------------------------------------------------------------------------------
@@ -60,14 +114,96 @@ static const float g_CameraZoomMin = 4;
 static const float g_CameraZoomMax = 30;
 static const float g_CameraZoomSpeedFactor = 0.10f;
 
-static const int g_MapGridSize = 64;
-static const int g_TileCount = g_MapGridSize * g_MapGridSize;
+// the map is stored and rendered in square chunks, the map grid size is always a multiple of the chunk size
+static const int g_MapChunkSize = 16;
+static const int g_MapChunkTileCount = g_MapChunkSize * g_MapChunkSize;
+static const float g_MapChunkHeight = 1.0f; // bounding box height, covers rails and trains
+static const float g_MapChunkCullDistance = 120.0f; // chunks further away from the camera are skipped
+static const float g_MapChunkLodStripsDistance = 25.0f; // beyond, the rails of a chunk are flat strips along the track curves
+static const float g_MapChunkLodImpostorDistance = 40.0f; // beyond, a chunk is one quad with a top-down texture of its rails
+static const int g_MapChunkImpostorSize = 128; // impostor texture size, 8 pixels per tile
+static const int g_MapChunkImpostorUpdatesPerFrame = 4; // rendered impostors per frame, the chunks waiting stay strips
+static const int g_MapChunkImpostorPoolSize = 192; // impostor render targets, about the chunks in the impostor band in view
+static const int g_RailsLodCurveStep = 4; // track curve samples per strip segment
+static const float g_RailsLodStripWidth = 0.3f;
+static const float g_RailsLodHeight = 0.05f; // strips and impostors above the ground, the depth buffer is coarse that far away
+static const int g_MergedMeshVertexMax = 65535; // raylib meshes have 16 bit indices, merged chunk rails get split at that
+static const float g_MapGridLineWidth = 0.03f; // in tiles, only for the line mesh drawn when the grid shader isn't available
+
+static const int g_MapGridSizeDefault = 64;
+static const int g_MapGridSizeMin = 64; // starting tracks are placed around tile 30,30
+static const int g_MapGridSizeMax = 1024;
+
+// map dimensions, chosen at runtime when the map storage gets allocated (see MapAllocate)
+static int g_MapGridSize = 0;
+static int g_TileCount = 0;
+static int g_MapChunksPerSide = 0;
+static int g_MapChunkCount = 0;
+
+static const int g_BrushSectorTrailMax = 1024; // sectors of one brush stroke, a longer stroke gets committed in parts
+static const size_t g_MemoryArenaAlignment = 16; // of every arena allocation
+
+static const int g_TrainPoolInitialCapacity = 64; // grows on demand
+static const int g_RailGraphInitialCapacity = 64; // nodes and segments, grows on demand
+static const int g_RouteCacheSize = 1024; // power of two, direct mapped
+static const int g_RouteRequestMax = 256;
+static const int g_RoutePlansPerFrame = 16; // pending route requests searched per frame, the rest waits
+
+static const uint32_t g_SnapshotVersion = 1; // bump whenever the layout of a stored struct changes
+#if defined(PLATFORM_WEB)
+static const char* g_SnapshotFilePath = "/save/snapshot.bin"; // IDBFS mount, persisted in IndexedDB
+#else
+static const char* g_SnapshotFilePath = "snapshot.bin";
+#endif
+
+static const uint32_t g_ReplayVersion = 5; // bump whenever GameCommand or a stored struct changes
+static const int g_ReplayInitialCapacity = 1024; // records and frames, grows on demand
+#if defined(PLATFORM_WEB)
+static const char* g_ReplayFilePath = "/save/replay.bin"; // the map it starts from is stored next to it, see ReplayGetSnapshotFilePath
+#else
+static const char* g_ReplayFilePath = "replay.bin";
+#endif
+
+static const int g_TrackCurveSampleCount = 16; // segments per precomputed tile curve
+static const int g_TrackCurveBuildSteps = 64; // bezier steps to measure the arc length when building the curves
+
+static const float g_SimTickRateDefault = 60.0f; // simulation ticks per second
+static const float g_SimTickRateMin = 5.0f;
+static const float g_SimTickRateMax = 240.0f;
+static const int g_SimMaxTicksPerFrame = 10; // after a long frame the simulation slows down rather than stalling the app
+
+#if defined(SIM_MULTITHREADED)
+static const int g_JobWorkerCountMax = 15; // main thread works along
+static const int g_JobTrainBatchSize = 256; // trains per grabbed work item, below that the tick stays on the main thread
+#endif
+
+static const int g_ProfilerHistoryLength = 240; // frames kept for the averages, percentiles and the CSV dump
+static const int g_ProfilerTraceFrameCount = 300; // frames recorded into one Chrome trace
+#if defined(PLATFORM_WEB)
+static const char* g_ProfilerCsvFilePath = "/save/profile.csv";
+static const char* g_ProfilerTraceFilePath = "/save/profile_trace.json";
+#else
+static const char* g_ProfilerCsvFilePath = "profile.csv";
+static const char* g_ProfilerTraceFilePath = "profile_trace.json"; // open in chrome://tracing or ui.perfetto.dev
+#endif
 
-static const int g_MaxTrains = 64;
+static const int g_DebugPanelLineMax = 16; // per text block of the debug panel
+static const int g_DebugPanelLineSize = 64;
 
 static const KeyboardKey g_debugWindowKey = KEY_TAB;
 static bool g_debugWindowOn = false; // todo turn off
 static bool g_debugSimPauseOn = false;
+static bool g_renderInstancingOn = true; // batch static models into one instanced draw call per mesh, falls back to DrawModelEx
+static bool g_renderMergedRailsOn = true; // rails of a chunk baked into static meshes, one draw call per mesh. Before instancing
+static bool g_renderGridShaderOn = true; // grid drawn by the ground shader, else by a static line mesh
+static bool g_renderLodOn = true; // far chunks draw their rails as strips or impostors, else always full meshes
+static bool g_renderTrainInstancingOn = true; // trains in one instanced draw call per model mesh, else one DrawModelEx each
+static bool g_simEventSteppingOn = false; // only trains reaching their next tile get stepped, same result as stepping all
+#if defined(SIM_MULTITHREADED) && defined(PLATFORM_WEB)
+static bool g_simPipelineOn = false; // a frame's ticks run on the simulation thread while the frame is drawn
+#elif defined(SIM_MULTITHREADED)
+static bool g_simPipelineOn = true;
+#endif
 
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -166,7 +302,178 @@ const char* ModelIdToString(ModelID modelID)
 	}
 }
 
-static int MAX_MODELS_TO_LOAD_COUNT = MODEL_COUNT;
+// models not needed right away are loaded on first use by AssetsGetModel, the others during the title screen
+static const bool g_modelIsLoadedOnDemand[MODEL_COUNT] =
+{
+	[MODEL_FACTORY_A] = true,
+};
+static const int g_RailsModelCount = MODEL_RAILS_CROSS + 1; // rails models are the first entries of ModelID
+static const int g_AssetMaterialTextureMax = 4; // distinct textures used by baked models
+
+// Instancing shader: same as the default raylib shader, but the model matrix comes per instance as vertex attribute
+#if defined(PLATFORM_WEB)
+const char* g_instancingShaderVertexCode =
+	"#version 100\n"
+	"attribute vec3 vertexPosition;\n"
+	"attribute vec2 vertexTexCoord;\n"
+	"attribute vec4 vertexColor;\n"
+	"attribute mat4 instanceTransform;\n"
+	"uniform mat4 mvp;\n"
+	"varying vec2 fragTexCoord;\n"
+	"void main()\n"
+	"{\n"
+	"    fragTexCoord = vertexTexCoord;\n"
+	"    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);\n"
+	"}\n";
+const char* g_instancingShaderFragmentCode =
+	"#version 100\n"
+	"precision mediump float;\n"
+	"varying vec2 fragTexCoord;\n"
+	"uniform sampler2D texture0;\n"
+	"uniform vec4 colDiffuse;\n"
+	"void main()\n"
+	"{\n"
+	"    gl_FragColor = texture2D(texture0, fragTexCoord)*colDiffuse;\n"
+	"}\n";
+#else
+const char* g_instancingShaderVertexCode =
+	"#version 330\n"
+	"in vec3 vertexPosition;\n"
+	"in vec2 vertexTexCoord;\n"
+	"in vec4 vertexColor;\n"
+	"in mat4 instanceTransform;\n"
+	"uniform mat4 mvp;\n"
+	"out vec2 fragTexCoord;\n"
+	"void main()\n"
+	"{\n"
+	"    fragTexCoord = vertexTexCoord;\n"
+	"    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);\n"
+	"}\n";
+const char* g_instancingShaderFragmentCode =
+	"#version 330\n"
+	"in vec2 fragTexCoord;\n"
+	"uniform sampler2D texture0;\n"
+	"uniform vec4 colDiffuse;\n"
+	"out vec4 finalColor;\n"
+	"void main()\n"
+	"{\n"
+	"    finalColor = texture(texture0, fragTexCoord)*colDiffuse;\n"
+	"}\n";
+#endif
+
+// Train instancing shader: both simulation tick transforms come per instance, the interpolation between them runs here.
+// Rotation around the up axis as in DrawModelEx, taking the shorter way around like TrainGetInterpolatedTransform
+#if defined(PLATFORM_WEB)
+const char* g_trainShaderVertexCode =
+	"#version 100\n"
+	"attribute vec3 vertexPosition;\n"
+	"attribute vec2 vertexTexCoord;\n"
+	"attribute vec4 instancePrevious;\n" // xyz position, w rotation in degree
+	"attribute vec4 instanceCurrent;\n"
+	"uniform mat4 mvp;\n"
+	"uniform mat4 matModel;\n"
+	"uniform float interpolationAlpha;\n"
+	"varying vec2 fragTexCoord;\n"
+	"void main()\n"
+	"{\n"
+	"    float rotationDelta = mod(instanceCurrent.w - instancePrevious.w + 540.0, 360.0) - 180.0;\n"
+	"    float rotation = radians(instancePrevious.w + rotationDelta*interpolationAlpha);\n"
+	"    vec3 position = mix(instancePrevious.xyz, instanceCurrent.xyz, interpolationAlpha);\n"
+	"    vec4 local = matModel*vec4(vertexPosition, 1.0);\n"
+	"    vec3 world = vec3(cos(rotation)*local.x + sin(rotation)*local.z, local.y, cos(rotation)*local.z - sin(rotation)*local.x) + position;\n"
+	"    fragTexCoord = vertexTexCoord;\n"
+	"    gl_Position = mvp*vec4(world, 1.0);\n"
+	"}\n";
+#else
+const char* g_trainShaderVertexCode =
+	"#version 330\n"
+	"in vec3 vertexPosition;\n"
+	"in vec2 vertexTexCoord;\n"
+	"in vec4 instancePrevious;\n" // xyz position, w rotation in degree
+	"in vec4 instanceCurrent;\n"
+	"uniform mat4 mvp;\n"
+	"uniform mat4 matModel;\n"
+	"uniform float interpolationAlpha;\n"
+	"out vec2 fragTexCoord;\n"
+	"void main()\n"
+	"{\n"
+	"    float rotationDelta = mod(instanceCurrent.w - instancePrevious.w + 540.0, 360.0) - 180.0;\n"
+	"    float rotation = radians(instancePrevious.w + rotationDelta*interpolationAlpha);\n"
+	"    vec3 position = mix(instancePrevious.xyz, instanceCurrent.xyz, interpolationAlpha);\n"
+	"    vec4 local = matModel*vec4(vertexPosition, 1.0);\n"
+	"    vec3 world = vec3(cos(rotation)*local.x + sin(rotation)*local.z, local.y, cos(rotation)*local.z - sin(rotation)*local.x) + position;\n"
+	"    fragTexCoord = vertexTexCoord;\n"
+	"    gl_Position = mvp*vec4(world, 1.0);\n"
+	"}\n";
+#endif
+// the fragment shader is the one of the instancing shader
+
+// Ground grid shader: tile borders drawn per pixel on the ground quad, so the cost doesn't depend on the map size.
+// Lines are a pixel wide at any distance, like the GL lines they replace, and the center lines get the axis color
+#if defined(PLATFORM_WEB)
+const char* g_gridShaderVertexCode =
+	"#version 100\n"
+	"attribute vec3 vertexPosition;\n"
+	"uniform mat4 mvp;\n"
+	"uniform mat4 matModel;\n"
+	"varying vec2 fragGridPosition;\n"
+	"void main()\n"
+	"{\n"
+	"    fragGridPosition = (matModel*vec4(vertexPosition, 1.0)).xz;\n"
+	"    gl_Position = mvp*vec4(vertexPosition, 1.0);\n"
+	"}\n";
+const char* g_gridShaderFragmentCode =
+	"#version 100\n"
+	"#extension GL_OES_standard_derivatives : enable\n"
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n" // tile coordinates of big maps don't fit mediump
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"varying vec2 fragGridPosition;\n"
+	"uniform vec4 colDiffuse;\n"
+	"uniform vec4 gridColor;\n"
+	"uniform vec4 axisColor;\n"
+	"uniform vec2 axisPosition;\n"
+	"void main()\n"
+	"{\n"
+	"    vec2 pixelSize = fwidth(fragGridPosition);\n"
+	"    vec2 lineDistance = abs(fract(fragGridPosition + 0.5) - 0.5)/pixelSize;\n"
+	"    vec2 axisDistance = abs(fragGridPosition - axisPosition)/pixelSize;\n"
+	"    float line = 1.0 - min(min(lineDistance.x, lineDistance.y), 1.0);\n"
+	"    float axis = 1.0 - min(min(axisDistance.x, axisDistance.y), 1.0);\n"
+	"    gl_FragColor = mix(mix(colDiffuse, gridColor, line), axisColor, axis);\n"
+	"}\n";
+#else
+const char* g_gridShaderVertexCode =
+	"#version 330\n"
+	"in vec3 vertexPosition;\n"
+	"uniform mat4 mvp;\n"
+	"uniform mat4 matModel;\n"
+	"out vec2 fragGridPosition;\n"
+	"void main()\n"
+	"{\n"
+	"    fragGridPosition = (matModel*vec4(vertexPosition, 1.0)).xz;\n"
+	"    gl_Position = mvp*vec4(vertexPosition, 1.0);\n"
+	"}\n";
+const char* g_gridShaderFragmentCode =
+	"#version 330\n"
+	"in vec2 fragGridPosition;\n"
+	"uniform vec4 colDiffuse;\n"
+	"uniform vec4 gridColor;\n"
+	"uniform vec4 axisColor;\n"
+	"uniform vec2 axisPosition;\n"
+	"out vec4 finalColor;\n"
+	"void main()\n"
+	"{\n"
+	"    vec2 pixelSize = fwidth(fragGridPosition);\n"
+	"    vec2 lineDistance = abs(fract(fragGridPosition + 0.5) - 0.5)/pixelSize;\n"
+	"    vec2 axisDistance = abs(fragGridPosition - axisPosition)/pixelSize;\n"
+	"    float line = 1.0 - min(min(lineDistance.x, lineDistance.y), 1.0);\n"
+	"    float axis = 1.0 - min(min(axisDistance.x, axisDistance.y), 1.0);\n"
+	"    finalColor = mix(mix(colDiffuse, gridColor, line), axisColor, axis);\n"
+	"}\n";
+#endif
 
 // Map & tiles
 //--------------------------------------------------------------------------------------
@@ -213,17 +520,40 @@ const char* ConnectionDirectionToString(ConnectionDirection direction)
 }
 
 typedef uint8_t ConnectionsConfig;
+static const ConnectionsConfig g_ConnectionsConfigAll = 0x3F; // every ConnectionDirection, the top 2 bits are unused
 
+// simulation part of a tile, the render part is kept in a separate array (TileModelInfo)
 typedef struct TileInfo
 {
 	TileType type;	// uint8_t enum 1 byte
-	ModelID modelID; // uint8_t enum 1 byte
 	ConnectionsConfig connectionOptions; // uint8 1 byte
 	ConnectionsConfig connectionsActive; // uint8 1 byte
-	float modelRotationInDegree; // 4 bytes, could be reduced to 2 bytes or even 1 byte if needed
-	// todo vehicle IDs and transition progress info etc
+	// trains on a tile are indexed in g_game.mapTileOccupants
 } TileInfo;
 
+// render part of a tile packed into 1 byte: bits 0-3 ModelID, bits 4-5 rotation in quarter turns around the up axis
+typedef uint8_t TileModelInfo;
+
+static inline TileModelInfo TileModelInfoPack(ModelID modelID, int quarterTurns)
+{
+	return (TileModelInfo) ((modelID & 0x0F) | ((quarterTurns & 0x03) << 4));
+}
+
+static inline ModelID TileModelInfoGetModelID(TileModelInfo modelInfo)
+{
+	return (ModelID) (modelInfo & 0x0F);
+}
+
+static inline int TileModelInfoGetQuarterTurns(TileModelInfo modelInfo)
+{
+	return (modelInfo >> 4) & 0x03;
+}
+
+static inline float TileModelInfoGetRotationInDegree(TileModelInfo modelInfo)
+{
+	return (float) TileModelInfoGetQuarterTurns(modelInfo) * 90.0f;
+}
+
 typedef struct
 {
 	int x;
@@ -260,12 +590,79 @@ const char* TileSectorToString(TileSector sector)
 	}
 }
 
+// compact index of the edge sectors where rails enter or leave a tile, used to index the lookup tables
+typedef enum : uint8_t // c99
+{
+	TILE_EDGE_NONE = 0, // any non edge sector
+	TILE_EDGE_S,
+	TILE_EDGE_E,
+	TILE_EDGE_W,
+	TILE_EDGE_N,
+	TILE_EDGE_COUNT
+} TileEdge;
+
 typedef struct
 {
 	TileCoords coords;
 	TileSector sector;
 } TileSectorTrail;
 
+// what the mouse points at on the map, raycast once per frame and shared by the brushes and the debug views
+typedef struct HoveredTile
+{
+	bool isHit;
+	Vector3 point;
+	TileCoords coords;
+	int tileIndex;
+	TileSector sector;
+} HoveredTile;
+
+// how a chunk's rails get drawn, picked by distance to the camera
+typedef enum : uint8_t // c99
+{
+	MAP_CHUNK_LOD_FULL,			// rails models, see RenderRailTiles for the three ways
+	MAP_CHUNK_LOD_STRIPS,		// flat strip per connection, one mesh per chunk
+	MAP_CHUNK_LOD_IMPOSTOR,		// one textured quad, the texture is the chunk rendered from above
+} MapChunkLod;
+
+// A chunk of g_MapChunkSize x g_MapChunkSize tiles. Its tiles are stored consecutively in mapTiles
+// (see TileIndexByTileCoords) and it keeps the occupied rails tiles grouped by model, maintained incrementally
+// by the tile mutation functions, so the renderer only walks visible chunks and tiles that actually have rails
+typedef struct MapChunk
+{
+	BoundingBox bounds;
+	int tileIndices[g_MapChunkTileCount];			// rails tiles grouped by model, unordered within the group
+	int modelOffsets[g_RailsModelCount + 1];		// group of model m is [modelOffsets[m], modelOffsets[m + 1])
+	Matrix* transforms;								// instancing transforms in tileIndices order, allocated on first use
+	bool transformsDirty;
+	Mesh* mergedMeshes;								// all rails of the chunk in world space, rebuilt when a tile changed
+	int mergedMeshCount;
+	int mergedMeshCapacity;
+	bool mergedMeshesDirty;
+	Mesh lodStripsMesh;								// MAP_CHUNK_LOD_STRIPS, rebuilt when a tile changed
+	bool lodStripsMeshDirty;
+	int impostorTarget;								// MAP_CHUNK_LOD_IMPOSTOR, in g_game.mapChunkImpostors, -1 if none
+	bool impostorDirty;
+	bool isVisible;												// result of the culling pass this frame
+	MapChunkLod lod;											// picked by the culling pass as well
+} MapChunk;
+
+// render targets of the chunk impostors, shared by all chunks. A chunk needing one takes over the least recently
+// drawn target, so panning over a large map doesn't keep one per chunk it ever saw
+typedef struct MapChunkImpostorPool
+{
+	RenderTexture2D targets[g_MapChunkImpostorPoolSize];	// created on first use
+	int chunkByTarget[g_MapChunkImpostorPoolSize];			// -1 if free
+	unsigned int drawnFrameByTarget[g_MapChunkImpostorPoolSize];
+	unsigned int frame;
+} MapChunkImpostorPool;
+
+// view frustum as 6 planes (a,b,c,d) with normals pointing inwards
+typedef struct CameraFrustum
+{
+	Vector4 planes[6];
+} CameraFrustum;
+
 // train stuff
 //--------------------------------------------------------------------------------------
 
@@ -273,11 +670,12 @@ typedef enum : uint8_t // c99
 {
 	TRAIN_STATE_DISABLED = 0, // don't render, don't process
 	TRAIN_STATE_HIDDEN, 	 // render differently, don't process
-	TRAIN_STATE_BLOCKED, 	// reach a track end or red signal
+	TRAIN_STATE_BLOCKED, 	// reach a track end or red signal, becomes WAITING or DRIVING right after the tick
 	TRAIN_STATE_DRIVING,
 	TRAIN_STATE_UNLOAD, 	// first unload then load
 	TRAIN_STATE_LOAD,
 	TRAIN_STATE_DERAILED, 	// non-operational and non-recoverable
+	TRAIN_STATE_WAITING,	// sleeps until its block is released or the rails change, not ticked
 } TrainState;
 
 typedef struct TrainInfo
@@ -295,56 +693,797 @@ typedef struct TrainInfo
 	float speedDrive;
 	float speedUnload;
 	float speedLoad;
-	Vector2 pathCurvePoints[4];
+	Vector2 pathCurvePoints[4]; // derived from the route on spawn
+	Vector3 modelPosition;
+} TrainInfo; // all data of a train in one place, used to spawn trains and for debugging. Stored split up in TrainPool
+
+typedef int TrainID; // stable handle, a train's slot in the pool changes when other trains despawn
+static const TrainID g_TrainIDNone = -1;
+static const int g_BlockWaitingForRails = -2; // waitingBlockById of a train at a track end, wakes when the rails change
+static const uint64_t g_TrainEventNone = UINT64_MAX; // eventTickById of a train without a scheduled step
+
+// one point of a precomputed curve through a tile, relative to the tile center
+typedef struct TrackCurveSample
+{
+	Vector3 position;
+	float headingInDegree; // unwrapped along the curve, so neighbouring samples interpolate directly
+} TrackCurveSample;
+
+// where the train is on the rail network, read every tick for positioning and updated on tile transitions
+typedef struct TrainRoute
+{
+	TileCoords tileCurrent;
+	TileCoords tilePrevious;
+	TileCoords tileNext;
+	ConnectionDirection tileConnectionUsed;
+	TileSector driveFromSector;
+	TileSector driveToSector;
+	const TrackCurveSample* curve;	// driveFromSector -> driveToSector, samples evenly spaced by arc length
+	Vector3 curveOrigin;			// center of tileCurrent
+	Vector2 pathCurvePoints[4];		// world xz bezier control points of the current tile path: start, 2 tangents, end
+} TrainRoute;
+
+// current and previous simulation tick transform, rendering interpolates between them
+typedef struct TrainRenderInfo
+{
+	ModelID modelID;
+	float modelRotationInDegree;
+	Vector3 modelPosition;
+	float previousModelRotationInDegree;
+	Vector3 previousModelPosition;
+} TrainRenderInfo;
+
+// where a driving train was when its progress last started over, progress at a later tick follows from it and the speed
+typedef struct TrainProgressStart
+{
+	uint64_t tick;
+	float progress;
+	float modelRotationInDegree;
 	Vector3 modelPosition;
-} TrainInfo;
+} TrainProgressStart;
+
+// the next tile change of a train, event stepping keeps them in a min heap by tick
+typedef struct TrainEvent
+{
+	uint64_t tick;
+	TrainID trainID;
+} TrainEvent;
+
+// rarely touched data
+typedef struct TrainCargoInfo
+{
+	float speedUnload;
+	float speedLoad;
+} TrainCargoInfo;
+
+// Structure of arrays of all spawned trains. Spawned trains are the dense range [0, count), despawning moves the
+// last train into the gap, so systems iterate over active trains only and over contiguous memory
+typedef struct TrainPool
+{
+	int count;
+	int capacity;
+	// hot, every tick
+	TrainState* states;
+	float* pathProgressNormalized;
+	float* speedDrive;
+	// warm
+	TrainRoute* routes;
+	TrainRenderInfo* renderInfos;	// with event stepping only current for trains not driving or started this tick
+	TrainProgressStart* progressStarts;
+	// cold
+	TrainCargoInfo* cargoInfos;
+	// id <-> slot mapping
+	TrainID* idBySlot;
+	int* slotById;
+	TrainID* freeIds;
+	int freeIdCount;
+	int idCount;		// ids handed out so far, never more than capacity
+	// tile occupancy by id: tile a train is registered on and its neighbours in that tile's occupant list
+	int* occupiedTileById;
+	TrainID* nextOccupantById;
+	TrainID* previousOccupantById;
+	// block reservations: the segment a blocked train asks for by slot, written by the tick. Held block, wait queue
+	// and the next train in that queue by id
+	int* requestedBlocks;
+	int* reservedBlockById;
+	int* waitingBlockById;
+	TrainID* nextWaitingById;
+	int waitingCount;
+	unsigned int reservationsGraphVersion;	// reservations are rebuilt when the rail graph changed since
+	bool reservationsAreDirty;				// or the trains got reset
+	// train clock, progress is start + speedDrive * tickDuration * ticks since the start
+	uint64_t tickCount;
+	float tickDuration;
+	// event stepping: heap entries of despawned or rescheduled trains stay until they come up, only the one matching
+	// eventTickById counts
+	TrainEvent* events;
+	int eventCount;
+	int eventCapacity;
+	uint64_t* eventTickById;
+	int* dueSlots;			// trains stepped this tick
+} TrainPool;
+
+// per instance data of the train instancing shader, the two tick transforms of TrainRenderInfo as two vec4 attributes
+typedef struct TrainInstance
+{
+	Vector3 previousPosition;
+	float previousRotationInDegree;
+	Vector3 position;
+	float rotationInDegree;
+} TrainInstance;
+
+// Instance data of all drawn trains, grouped by model so each model is one instanced draw call per mesh. Rewritten only
+// after a simulation tick, frames in between just pass a new interpolation alpha. Two GPU buffers take turns, so the
+// upload never writes into the buffer the GPU may still be drawing the previous frame from
+typedef struct TrainInstanceBuffer
+{
+	TrainInstance* instances;				// staging copy, capacity entries
+	int capacity;
+	int instanceCount;
+	int modelFirst[MODEL_COUNT];			// instance range of each model
+	int modelInstanceCount[MODEL_COUNT];
+	unsigned int vboIds[2];
+	int vboCapacity;						// in instances, same for both buffers
+	int vboCurrent;							// buffer with the latest upload, that's the one drawn
+	unsigned int uploadedSnapshotVersion;	// of the trains snapshot the instances are from
+	bool isDirty;							// trains spawned or despawned since the last snapshot, e.g. while the sim is paused
+} TrainInstanceBuffer;
+
+// a block as the signals view shows it
+typedef enum : uint8_t // c99
+{
+	BLOCK_VIEW_FREE,
+	BLOCK_VIEW_RESERVED,
+	BLOCK_VIEW_WAITED_FOR,		// trains wait for it
+} BlockViewState;
+
+// what drawing reads of the trains, written after the ticks of a frame. Pipelined frames draw the front snapshot
+// while the simulation thread writes the back one
+typedef struct TrainRenderSnapshot
+{
+	TrainRenderInfo* trains;	// drawn trains only
+	int count;
+	int capacity;
+	uint64_t tickCount;			// train clock at the write
+	unsigned int version;		// bumped per write
+	// for the debug panel
+	int trainCount;				// in the pool, drawn or not
+	int waitingCount;
+	TrainInfo firstTrain;		// slot 0, if there are trains
+	// for the signals view, by rail segment
+	BlockViewState* blocks;
+	int blockCount;
+	int blockCapacity;
+	bool areBlocksCurrent;		// false while the reservations wait for a rebuild
+	unsigned int railGraphVersion;	// the segments the blocks are from
+} TrainRenderSnapshot;
+
+typedef struct TrainRenderSnapshots
+{
+	TrainRenderSnapshot buffers[2];
+	int front;
+	float interpolationAlpha;	// of the frame whose ticks the front snapshot is from
+} TrainRenderSnapshots;
+
+// Rail network graph
+//--------------------------------------------------------------------------------------
+// junction tiles (2+ connections) are nodes, the runs of single connection tiles between them are collapsed into segments
+typedef struct RailSegmentEnd
+{
+	int nodeIndex;	// -1 for a dead end or a loop without junction
+	int tileIndex;	// node tile, otherwise the outermost tile of the segment
+	TileEdge edge;	// node edge towards the segment, otherwise the open edge of the outermost tile
+} RailSegmentEnd;
+
+typedef struct RailSegment
+{
+	RailSegmentEnd ends[2];
+	float length;		// arc length of the rails on the segment's tiles, junction tiles not included
+	int* tileIndices;	// in driving order from ends[0] to ends[1], buffer is kept when the slot gets reused
+	int tileCount;
+	int tileCapacity;
+	bool isUsed;
+	bool isLoop;		// closed circle without any junction
+	TrainID reservedBy;		// the segment is a block only one train may enter, see BlockReserve
+	TrainID firstWaiting;	// wait queue of the block, linked by TrainPool.nextWaitingById
+	TrainID lastWaiting;
+} RailSegment;
+
+typedef struct RailNode
+{
+	int tileIndex;
+	int segments[TILE_EDGE_COUNT];	// segment leaving through each edge, -1 if none
+	bool isUsed;
+} RailNode;
+
+// nodes and segments live in growable arrays with free lists, indices stay valid until the element gets removed
+typedef struct RailGraph
+{
+	RailNode* nodes;
+	int nodeCount;			// slots handed out, including free ones
+	int nodeCapacity;
+	int* freeNodes;
+	int freeNodeCount;
+	RailSegment* segments;
+	int segmentCount;
+	int segmentCapacity;
+	int* freeSegments;
+	int freeSegmentCount;
+	int* pendingTiles;		// tiles to retrace during an update
+	int pendingTileCount;
+	int pendingTileCapacity;
+	unsigned int version;	// bumped on every change, invalidates cached routes
+} RailGraph;
+
+// Routing
+//--------------------------------------------------------------------------------------
+// a route is a list of steps, each a directed segment: segmentIndex * 2 + direction, direction 1 drives from ends[1] to ends[0]
+typedef struct RoutePath
+{
+	bool isFound;
+	float cost;			// rail length until entering the last step
+	int* steps;			// from the start step to the first step on the target segment
+	int stepCount;
+	int stepCapacity;
+} RoutePath;
+
+typedef struct RouteCacheEntry
+{
+	unsigned int graphVersion;	// stale once the graph changed
+	int fromStep;
+	int toSegment;
+	RoutePath path;
+} RouteCacheEntry;
+
+typedef enum : uint8_t // c99
+{
+	ROUTE_REQUEST_FREE = 0,
+	ROUTE_REQUEST_PENDING,
+	ROUTE_REQUEST_DONE,
+} RouteRequestState;
+
+typedef int RouteRequestID;
+
+typedef struct RouteRequest
+{
+	RouteRequestState state;
+	int fromStep;
+	int toSegment;
+	RoutePath path;
+} RouteRequest;
+
+// Snapshots
+//--------------------------------------------------------------------------------------
+// binary save of map and trains. Chunks with rails are stored as the raw chunk-major tile and model arrays,
+// trains as TrainInfo. All blocks are 8 byte aligned, so a mapped file is copied into place without parsing
+typedef struct SnapshotHeader
+{
+	char magic[4];				// "RAYL"
+	uint32_t version;			// g_SnapshotVersion
+	uint32_t tileInfoSize;		// sizeof(TileInfo), guards against a different struct layout
+	uint32_t trainInfoSize;		// sizeof(TrainInfo)
+	int32_t mapGridSize;
+	int32_t chunkSize;
+	int32_t storedChunkCount;
+	int32_t trainCount;
+	uint32_t chunkTableOffset;	// SnapshotChunkEntry[storedChunkCount]
+	uint32_t trainsOffset;		// TrainInfo[trainCount]
+} SnapshotHeader;
+
+typedef struct SnapshotChunkEntry
+{
+	int32_t chunkIndex;
+	uint32_t tilesOffset;		// TileInfo[g_MapChunkTileCount]
+	uint32_t modelsOffset;		// TileModelInfo[g_MapChunkTileCount]
+	uint32_t padding;
+} SnapshotChunkEntry;
+
+typedef struct RouteHeapEntry
+{
+	float priority;
+	int step;
+} RouteHeapEntry;
+
+// A* over the directed segments of the rail graph, with a route cache and a request queue worked off a few per frame
+typedef struct RoutePlanner
+{
+	// search scratch, sized by the rail graph's segment capacity
+	int stepCapacity;
+	float* costs;
+	int* cameFrom;
+	unsigned int* seenStamps;	// step has a cost in the current search
+	unsigned int* closedStamps;	// step got expanded in the current search
+	unsigned int searchStamp;
+	RouteHeapEntry* heap;
+	int heapCount;
+	int heapCapacity;
+
+	RouteCacheEntry cache[g_RouteCacheSize];
+	int cacheHits;
+	int cacheMisses;
+
+	RouteRequest requests[g_RouteRequestMax];
+	int nextRequest;			// round robin start for working off pending requests
+} RoutePlanner;
+
+// Simulation clock
+//--------------------------------------------------------------------------------------
+// the simulation advances in fixed steps, rendering interpolates between the last two steps
+typedef struct SimClock
+{
+	float tickRate;				// ticks per second
+	float accumulator;			// frame time not simulated yet, in seconds
+	float interpolationAlpha;	// how far rendering is between the previous and the current tick, [0, 1]
+	int ticksLastFrame;
+	uint64_t tickCount;
+} SimClock;
+
+// startup options, e.g. from the command line
+typedef struct GameSettings
+{
+	int mapGridSize;
+	float simTickRate;
+	int simWorkerCount; // worker threads next to the main thread, -1 picks by core count. Ignored without SIM_MULTITHREADED
+} GameSettings;
+
+// Memory arenas
+//--------------------------------------------------------------------------------------
+// Linear allocator, its allocations only go away all at once with MemoryArenaReset. It runs out of a chain of heap
+// blocks, a reset merges them into one big enough for all, so an arena used the same way again allocates nothing
+typedef struct MemoryArenaBlock
+{
+	struct MemoryArenaBlock* previous;
+	size_t capacity;
+	size_t used;
+} MemoryArenaBlock; // the data follows the header
+
+typedef struct MemoryArena
+{
+	const char* name;
+	MemoryArenaBlock* block;		// newest block, the older ones are chained behind it
+	size_t blockSize;				// of the first block
+	size_t retainMax;				// a reset doesn't keep more than this, spikes go back to the heap
+	size_t used;					// since the last reset, over all blocks
+	size_t lastUsed;				// used at the last reset
+	size_t peak;
+	size_t reserved;				// capacity of all blocks
+	int heapAllocationCount;		// blocks allocated since startup, stays flat once the arena found its size
+} MemoryArena;
+
+typedef struct MemoryArenaMark
+{
+	MemoryArenaBlock* block;
+	size_t blockUsed;
+	size_t used;
+} MemoryArenaMark; // arena state to rewind to
+
+typedef struct Memory
+{
+	MemoryArena frameArena;			// reset at the start of each frame, for data that doesn't outlive the frame
+	MemoryArena sessionArena;		// reset with the gameplay state, holds the map storage
+} Memory;
+
+static Memory g_memory =
+{
+	.frameArena = {.name = "Frame", .blockSize = 256 * 1024, .retainMax = 4 * 1024 * 1024},
+	.sessionArena = {.name = "Session", .blockSize = 1024 * 1024, .retainMax = 64 * 1024 * 1024},
+};
+
+#if defined(SIM_MULTITHREADED)
+// Job system
+//--------------------------------------------------------------------------------------
+// runs items [begin, end) of a parallel for
+typedef void (*JobRangeFunction)(int begin, int end, void* userData);
+
+// fixed set of workers sleeping between jobs. Workers and the main thread grab batches of a job from a shared counter
+// until it is drained, so uneven batches balance out by themselves
+typedef struct JobSystem
+{
+	pthread_t workers[g_JobWorkerCountMax];
+	int workerCount;
+	pthread_mutex_t mutex;
+	pthread_cond_t jobStarted;
+	pthread_cond_t jobFinished;
+	unsigned int jobGeneration;	// bumped per job, wakes the workers
+	int workersBusy;
+	bool isShuttingDown;
+
+	// current job
+	JobRangeFunction function;
+	void* userData;
+	int itemCount;
+	int batchSize;
+	int nextItem;				// atomic
+} JobSystem;
+
+static JobSystem g_jobSystem;
+
+// Simulation pipeline
+//--------------------------------------------------------------------------------------
+// one thread running the ticks of a frame while the main thread draws it from the trains snapshot of the frame before
+typedef struct SimPipeline
+{
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t ticksStarted;
+	pthread_cond_t ticksFinished;
+	bool isStarted;
+	bool isShuttingDown;
+	bool isTicking;				// the main thread must not touch the trains meanwhile, see SimPipelineWait
+	bool isPending;				// ticks started this frame, handed over in SimPipelineFrameEnd. Main thread only
+
+	// current ticks
+	int tickCount;
+	float tickDuration;
+	double tickStartTime;		// for the profiler, written by the simulation thread
+	double tickTime;
+	bool isSnapshotWritten;
+} SimPipeline;
+
+static SimPipeline g_simPipeline;
+#endif
+
+// Profiler
+//--------------------------------------------------------------------------------------
+typedef enum : uint8_t // c99
+{
+	PROFILE_ZONE_FRAME = 0,		// all of TickMainLoop
+	PROFILE_ZONE_CAMERA,
+	PROFILE_ZONE_TRAINS,		// all simulation ticks of the frame
+	PROFILE_ZONE_ROUTING,
+	PROFILE_ZONE_BRUSH,			// rail painting or bulldozer
+	PROFILE_ZONE_DRAW_TILES,
+	PROFILE_ZONE_DRAW_TRAINS,
+	PROFILE_ZONE_UI,
+	PROFILE_ZONE_END_DRAWING,	// batch flush, buffer swap and frame pacing
+	PROFILE_ZONE_SIM_WAIT,		// pipelined frames: ticks still running after the frame got drawn
+	PROFILE_ZONE_COUNT
+} ProfileZone;
+
+const char* ProfileZoneToString(ProfileZone zone)
+{
+	switch (zone)
+	{
+		case PROFILE_ZONE_FRAME:     	return "Frame";
+		case PROFILE_ZONE_CAMERA:     	return "Camera";
+		case PROFILE_ZONE_TRAINS:     	return "Trains";
+		case PROFILE_ZONE_ROUTING:     	return "Routing";
+		case PROFILE_ZONE_BRUSH:     	return "Brush";
+		case PROFILE_ZONE_DRAW_TILES:  	return "Draw Tiles";
+		case PROFILE_ZONE_DRAW_TRAINS: 	return "Draw Trains";
+		case PROFILE_ZONE_UI:     		return "UI";
+		case PROFILE_ZONE_END_DRAWING: 	return "EndDrawing";
+		case PROFILE_ZONE_SIM_WAIT: 	return "Sim Wait";
+		default:                 		return "Unknown";
+	}
+}
+
+typedef struct ProfileTraceEvent
+{
+	double startTime;
+	float duration;
+	ProfileZone zone;
+} ProfileTraceEvent;
+
+typedef struct Profiler
+{
+	double zoneStartTimes[PROFILE_ZONE_COUNT];
+	float zoneFrameTimes[PROFILE_ZONE_COUNT];					// seconds, summed up over the current frame
+	float history[PROFILE_ZONE_COUNT][g_ProfilerHistoryLength];	// ms per frame, ring buffer
+	int historyIndex;											// next frame to write
+	int historyCount;
+	int drawCalls;												// model draw calls of the current frame
+	int triangles;
+	int drawCallsLastFrame;
+	int trianglesLastFrame;
+
+	// Chrome trace capture, running while traceFramesLeft > 0
+	ProfileTraceEvent* traceEvents;
+	int traceEventCount;
+	int traceEventCapacity;
+	int traceFramesLeft;
+	double traceStartTime;
+} Profiler;
+
+static Profiler g_profiler;
+
+// Replay
+//--------------------------------------------------------------------------------------
+// player actions, submitted by the input code and executed in one place so a recording can feed them back
+typedef enum : uint8_t // c99
+{
+	GAME_COMMAND_BRUSH_PAINT = 0,	// rail brush over a tile sector, the trail adds the connections when it leaves a tile
+	GAME_COMMAND_BRUSH_RELEASE,		// bakes the last tile of the trail
+	GAME_COMMAND_TILE_CLEAR,		// bulldozer
+	GAME_COMMAND_TRAIN_SPAWN,
+	GAME_COMMAND_TRAIN_DESPAWN,		// by slot, train IDs aren't the same between runs
+	GAME_COMMAND_CAMERA_SET,
+	GAME_COMMAND_COUNT
+} GameCommandType;
+
+typedef struct GameCommand
+{
+	GameCommandType type;
+	union
+	{
+		TileSectorTrail brush;		// GAME_COMMAND_BRUSH_PAINT
+		TileCoords tile;			// GAME_COMMAND_TILE_CLEAR
+		TrainInfo train;			// GAME_COMMAND_TRAIN_SPAWN
+		int trainSlot;				// GAME_COMMAND_TRAIN_DESPAWN
+		CameraControlValues camera;	// GAME_COMMAND_CAMERA_SET
+	} params;
+} GameCommand;
+
+typedef struct ReplayRecord
+{
+	int32_t frame;				// recorded frame the command was submitted in
+	GameCommand command;
+} ReplayRecord;
+
+// replay file: header, the records and the simulation ticks of every frame. Plus a snapshot of the starting map
+typedef struct ReplayHeader
+{
+	char magic[4];				// "RPLY"
+	uint32_t version;			// g_ReplayVersion
+	uint32_t recordSize;		// sizeof(ReplayRecord), guards against a different struct layout
+	float simTickRate;
+	int32_t frameCount;
+	int32_t recordCount;
+	uint32_t recordsOffset;		// ReplayRecord[recordCount]
+	uint32_t frameTicksOffset;	// uint8_t[frameCount]
+	uint32_t stateChecksum;		// of the trains after the last frame, see ReplayGetStateChecksum
+} ReplayHeader;
+
+typedef enum : uint8_t // c99
+{
+	REPLAY_STATE_OFF = 0,
+	REPLAY_STATE_RECORDING,
+	REPLAY_STATE_PLAYING
+} ReplayState;
+
+// starting and stopping is deferred to the start of the next frame, so every recorded frame is complete
+typedef struct Replay
+{
+	ReplayState state;
+	ReplayState pendingState;
+	bool hasPendingState;
+	const char* pendingFilePath;
+	const char* filePath;		// of the running replay
+	ReplayRecord* records;
+	int recordCount;
+	int recordCapacity;
+	uint8_t* frameTicks;		// simulation ticks run in each frame
+	int frameCount;
+	int frameCapacity;
+	int frame;					// current frame
+	int nextRecord;				// playing: first record not executed yet
+	bool hasDiverged;			// playing: a command didn't fit the game anymore and got skipped
+	uint32_t recordedStateChecksum;
+	bool isQuitWhenDone;		// playing: close the app after the last frame, for scripted runs
+	bool isQuitRequested;
+	double startTime;			// playing: wall clock time of the first frame
+} Replay;
+
+static Replay g_replay;
+
+// Debug panel
+//--------------------------------------------------------------------------------------
+// the panel text is formatted again only when one of the values it shows changed. A key holds all of them,
+// keys are cleared with memset first so they compare with memcmp
+typedef struct DebugTileTextKey
+{
+	bool isHit;
+	TileCoords coords;
+	TileSector sector;
+	TileInfo tile;
+	TileModelInfo tileModel;
+} DebugTileTextKey;
+
+typedef struct DebugStatusTextKey
+{
+	int chunksVisibleCount;
+	float tickRate;
+	int ticksLastFrame;
+	int railNodeCount;
+	int railSegmentCount;
+	int routeCacheHits;
+	int routeCacheMisses;
+	int trainCount;
+	TileCoords trainTile;		// first train from here on
+	TileSector trainDriveToSector;
+	TileSector trainDriveFromSector;
+	ConnectionDirection trainConnection;
+	TileCoords trainNextTile;
+	float trainRotationInDegree;
+} DebugStatusTextKey;
+
+typedef struct DebugPanelText
+{
+	bool isValid;
+	DebugTileTextKey tileKey;
+	DebugStatusTextKey statusKey;
+	char tileLines[g_DebugPanelLineMax][g_DebugPanelLineSize];
+	int tileLineCount;
+	char statusLines[g_DebugPanelLineMax][g_DebugPanelLineSize];
+	int statusLineCount;
+} DebugPanelText;
+
+// Asset loading
+//--------------------------------------------------------------------------------------
+// the title screen runs one load step per frame and shows the progress, see AssetsLoadStep
+typedef struct AssetLoadState
+{
+	int nextStep;				// 0 are the shaders and the ground, then one per model not loaded on demand
+	int stepCount;
+	const char* currentName;	// of the step running next, for the progress screen
+	double startTime;
+} AssetLoadState;
 
 // Game App State
 //--------------------------------------------------------------------------------------
 static struct
 {
 	AppState state;
+	GameSettings settings;
+	SimClock simClock;
 	CameraControlValues cameraControlValues;
 	CameraPanState cameraPanState;
 	Camera3D camera;
+	CameraFrustum cameraFrustum;
 	InteractionMode actionMode;
-	Texture assetTexture;
-	Model assetModels[MODEL_COUNT];
-	TileInfo mapTiles[g_TileCount];
-	TileSectorTrail brushSectorTrail[g_MapGridSize * g_MapGridSize];
+	Model assetModels[MODEL_COUNT];					// direct access only for models loaded at startup, else AssetsGetModel
+	bool assetModelIsLoaded[MODEL_COUNT];
+	AssetLoadState assetLoad;
+	Shader assetInstancingShader;
+	Shader assetTrainShader;						// instancing with the tick interpolation on the GPU
+	int assetTrainShaderAlphaLoc;
+	int assetTrainShaderPreviousLoc;				// instance attributes
+	int assetTrainShaderCurrentLoc;
+	Shader assetGridShader;
+	int assetGridShaderAxisLoc;
+	Mesh assetGroundMesh;							// unit quad, scaled to the map
+	Material assetGroundMaterial;
+	Mesh mapGridLinesMesh;							// without grid shader: the grid as thin quads, built for mapGridLinesMeshSize
+	int mapGridLinesMeshSize;
+	Texture assetMaterialTextures[g_AssetMaterialTextureMax];	// shared by the baked models, unloaded with the assets
+	char assetMaterialTextureNames[g_AssetMaterialTextureMax][BAKED_MESH_TEXTURE_NAME_SIZE];
+	int assetMaterialTextureCount;
+	TileInfo* mapTiles;								// g_TileCount entries, see MapAllocate
+	TileModelInfo* mapTileModels;					// g_TileCount entries, same indexing as mapTiles
+	TrainID* mapTileOccupants;						// first train on each tile or g_TrainIDNone, the rest are linked in the train pool
+	RailGraph railGraph;
+	int* mapTileRailNodes;							// rail graph node of a junction tile, -1 if none
+	int* mapTileRailSegments;						// rail graph segment running through the tile, -1 if none
+	RoutePlanner routePlanner;
+	RouteRequestID debugRouteRequest;				// route preview of the first train to the hovered rails
+	int debugRouteFromStep;
+	int debugRouteTargetSegment;
+	HoveredTile hoveredTile;						// see MapUpdateHoveredTile
+	DebugPanelText debugPanelText;
+	TileSectorTrail brushSectorTrail[g_BrushSectorTrailMax];
 	int brushSectorTrailLength;
-	TrainInfo trains[g_MaxTrains];
+	TrainPool trains;
+	TrainInstanceBuffer trainInstances;
+	TrainRenderSnapshots trainSnapshots;
+	MapChunk* mapChunks;							// g_MapChunkCount entries
+	int* mapChunkSlotByTile;						// position of the tile inside its chunk tileIndices
+	ModelID* mapChunkModelByTile;					// chunk model group the tile is in, MODEL_COUNT if none
+	int mapChunksVisibleCount;
+	MapChunkImpostorPool mapChunkImpostors;			// outlives the map like the other GPU resources
 } g_game;
 
 //----------------------------------------------------------------------------------------------------------------------
 // Functions Forward Declaration [as needed]
 //----------------------------------------------------------------------------------------------------------------------
-static void AssetsLoad(void);
-static void GameAppInitializeState(void);				// prepare all static / global data before starting running the main loop
-static void GameplayResetState(void);
+static bool AssetsLoadStep(void);
+static Model AssetsGetModel(ModelID modelID);
+static void TickLoadingScreen(void);
+static void GameAppInitializeState(GameSettings settings);	// prepare all static / global data before starting running the main loop
+static void GameplayResetState(int mapGridSize);
 static void TickMainLoop(void);							// Update and Draw one frame
 static void TickCamera(void);
-static void TickTrains(void);
+static void TickSimulation(void);
+static void TickTrains(float deltaTime);
+static void TrainsRebase(float tickDuration);
+static void TickTrainsEvents(void);
+static void TickTrainsRange(int begin, int end, void* userData);
+static void TickTrainsDueRange(int begin, int end, void* userData);
+static void TrainStep(int slot);
+static void TrackCurvesBuild(void);
+static void TrainRouteUpdateCurve(TrainRoute* route);
+static inline void TrainRouteSampleCurve(const TrainRoute* route, float progressNormalized, Vector3* position, float* headingInDegree);
+static void RailGraphReset(void);
+static void RailGraphFree(void);
+static void RailGraphUpdateTile(int x, int z);
+static void RailGraphUpdateTiles(const int* tileIndices, int tileCount);
+static void BlockSeatTrain(TrainID trainID);
+static void BlockRemoveTrain(TrainID trainID);
+static void BlockReservationsResolve(void);
+static void TrainSetProgressStart(int slot, uint64_t tick);
+static void TrainEventSchedule(int slot);
+static void TrainResume(int slot);
+static void RoutePlannerReset(void);
+static void RoutePlannerFree(void);
+static void TickRouting(void);
+static void RenderDebugRoute(void);
+static void RailGraphRebuild(void);
+static void MapChunkSyncTile(int tileIndex);
+static bool SnapshotSave(const char* filePath);
+static bool SnapshotLoad(const char* filePath);
+static void ProfilerFree(void);
+static void GameCommandSubmit(GameCommand command);
+static void ReplayRequest(ReplayState state, const char* filePath);
+static void ReplayFree(void);
+#if defined(SIM_MULTITHREADED)
+static void JobSystemStart(int workerCount);
+static void JobSystemStop(void);
+static void JobParallelFor(JobRangeFunction function, int itemCount, int batchSize, void* userData);
+static void SimPipelineStart(void);
+static void SimPipelineStop(void);
+static bool SimPipelineIsActive(void);
+#endif
 static void CameraUpdateFromControlValues(void);
+static void CameraFrustumUpdate(void);
 static void AssetsUnload(void);
 static void TileUpdateRailsModel(int x, int z);
 static inline void TileAddRailConnection(int x, int y, ConnectionDirection connection);
 inline static void TileAddConnectionAndUpdateRailsModel(int x, int z, ConnectionDirection direction);
 static inline Vector3 TileGetCenterPosition(TileCoords tileCoords);
+static bool RenderInstancingIsSupported(void);
+static void MapChunksReset(void);
+static void MapAllocate(int mapGridSize);
+static void MapFree(void);
+static void TrainPoolReset(void);
+static void TrainPoolFree(void);
+static TrainID TrainSpawn(TrainInfo info);
+static void RenderRailTiles(void);
+static void RenderGround(void);
+static void TrainInstancesFree(void);
+static void MapChunkImpostorsFree(void);
+static bool TrainRenderSnapshotWrite(void);
+static void TrainRenderSnapshotSwap(void);
+static void TrainRenderSnapshotsRewrite(void);
+static void TrainRenderSnapshotsFree(void);
+static void SimRunTicks(int tickCount, float tickDuration);
+static bool SimPipelineIsPending(void);
+static void SimPipelineWait(void);
+static void SimPipelineFrameEnd(void);
+static void* MemoryArenaAlloc(MemoryArena* arena, size_t size);
+static void MemoryArenaReset(MemoryArena* arena);
+static MemoryArenaMark MemoryArenaGetMark(const MemoryArena* arena);
+static void MemoryArenaRewind(MemoryArena* arena, MemoryArenaMark mark);
+static void MemoryFree(void);
 
 //----------------------------------------------------------------------------------------------------------------------
 // App Reset management
 //----------------------------------------------------------------------------------------------------------------------
 // set the initial conditions and resets the game state
-void GameAppInitializeState(void)
+void GameAppInitializeState(GameSettings settings)
 {
 	g_game.state = APP_STATE_TITLE;
-	GameplayResetState();
+	g_game.settings = settings;
+	TrackCurvesBuild();
+	GameplayResetState(settings.mapGridSize);
 }
 
-// resets gameplay params
-void GameplayResetState(void)
+// empty map of the given size, no trains
+static void GameplayClearState(int mapGridSize)
 {
+	// everything of the previous session goes at once, the pools (trains, rail graph) keep their memory
+	MapFree();
+	MemoryArenaReset(&g_memory.sessionArena);
+	MapAllocate(mapGridSize);
+
+	// restart simulation clock
+	g_game.simClock = (SimClock)
+	{
+		.tickRate = Clamp(g_game.settings.simTickRate, g_SimTickRateMin, g_SimTickRateMax),
+		.accumulator = 0,
+		.interpolationAlpha = 1.0f,
+		.ticksLastFrame = 0,
+		.tickCount = 0
+	};
+
 	// setup camera
 	float halfGridSize = (float) g_MapGridSize * 0.5f;
 	g_game.cameraControlValues = (CameraControlValues)
@@ -364,16 +1503,35 @@ void GameplayResetState(void)
 	g_game.actionMode = ACTION_MODE_BUILD_RAILS;
 
 	// clear map
-	for (int tileIndex = 0; tileIndex < g_MapGridSize * g_MapGridSize; tileIndex++)
+	for (int tileIndex = 0; tileIndex < g_TileCount; tileIndex++)
 	{
 		g_game.mapTiles[tileIndex].type = TILE_TYPE_EMPTY;
 		g_game.mapTiles[tileIndex].connectionOptions = 0; // none
 		g_game.mapTiles[tileIndex].connectionsActive = 0;
+		g_game.mapTileOccupants[tileIndex] = g_TrainIDNone;
+		g_game.mapTileRailNodes[tileIndex] = -1;
+		g_game.mapTileRailSegments[tileIndex] = -1;
 	}
+	MapChunksReset();
+	RailGraphReset();
+	RoutePlannerReset();
 
 	// clear rail paint brush
 	g_game.brushSectorTrailLength = 0;
 
+	// the hovered tile indexes the old map until the next MapUpdateHoveredTile
+	g_game.hoveredTile = (HoveredTile) {0};
+
+	// reset all trains
+	TrainPoolReset();
+	TrainRenderSnapshotsRewrite();
+}
+
+// resets gameplay params, the map gets (re)allocated with the given size in tiles per side
+void GameplayResetState(int mapGridSize)
+{
+	GameplayClearState(mapGridSize);
+
 	//////////////////////////////////////////////////////////////////////////////////
 	// set starting rail tracks
 	// loop track
@@ -394,51 +1552,68 @@ void GameplayResetState(void)
 	// turn back towards loop
 	TileAddConnectionAndUpdateRailsModel(33, 31, CONNECTION_ES_SE);
 
-	// reset all trains
-	for(int i = 0; i < g_MaxTrains; ++i)
-	{
-		g_game.trains[i].state = TRAIN_STATE_DISABLED;
-		g_game.trains[i].modelRotationInDegree = 0;
-		g_game.trains[0].modelPosition = (Vector3) {0,0,0};
-		g_game.trains[i].modelID = MODEL_TRAIN_LOCOMOTIVE_A;
-		g_game.trains[i].tileCurrent = (TileCoords) {0,0};
-
-		g_game.trains[i].speedDrive = 0.5f;
-		g_game.trains[i].speedLoad = 3;
-		g_game.trains[i].speedUnload = 3;
-		g_game.trains[i].pathProgressNormalized = 0;
-		g_game.trains[i].pathCurvePoints[0] = Vector2Zero();
-		g_game.trains[i].pathCurvePoints[1] = Vector2Zero();
-		g_game.trains[i].pathCurvePoints[2] = Vector2Zero();
-		g_game.trains[i].pathCurvePoints[3] = Vector2Zero();
-		g_game.trains[i].tileConnectionUsed = 0;
-		g_game.trains[i].driveFromSector = TILE_SECTOR_CENTER;
-		g_game.trains[i].driveToSector = TILE_SECTOR_CENTER;
-	}
-
 	// set up starting train
 	TileCoords tileCoord = (TileCoords) {30,30};
-	g_game.trains[0].state = TRAIN_STATE_DRIVING;
-	g_game.trains[0].tilePrevious = (TileCoords) {30,29};
-	g_game.trains[0].tileNext = (TileCoords) {30,31};
-	g_game.trains[0].tileCurrent = tileCoord;
-	g_game.trains[0].modelPosition = TileGetCenterPosition(tileCoord);
-	g_game.trains[0].modelRotationInDegree = 0;
-	g_game.trains[0].modelID = MODEL_TRAIN_LOCOMOTIVE_A;
-	g_game.trains[0].speedDrive = 0.5f;
-	g_game.trains[0].speedLoad = 3;
-	g_game.trains[0].speedUnload = 3;
-	g_game.trains[0].pathProgressNormalized = 0.5f; // start in the middle of the tile track
-	g_game.trains[0].tileConnectionUsed = CONNECTION_NS_SN;
-	g_game.trains[0].driveFromSector = TILE_SECTOR_S;
-	g_game.trains[0].driveToSector = TILE_SECTOR_N;
+	TrainSpawn((TrainInfo)
+	{
+		.state = TRAIN_STATE_DRIVING,
+		.modelID = MODEL_TRAIN_LOCOMOTIVE_A,
+		.tilePrevious = (TileCoords) {30,29},
+		.tileNext = (TileCoords) {30,31},
+		.tileCurrent = tileCoord,
+		.modelPosition = TileGetCenterPosition(tileCoord),
+		.modelRotationInDegree = 0,
+		.speedDrive = 0.5f,
+		.speedLoad = 3,
+		.speedUnload = 3,
+		.pathProgressNormalized = 0.5f, // start in the middle of the tile track
+		.tileConnectionUsed = CONNECTION_NS_SN,
+		.driveFromSector = TILE_SECTOR_S,
+		.driveToSector = TILE_SECTOR_N,
+	});
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 // Program main entry point
 //----------------------------------------------------------------------------------------------------------------------
-int main(void)
+#if !defined(SIM_BENCHMARK) // the benchmark has its own, see the end of the file
+int main(int argc, char* argv[])
 {
+	// optional map size "-map <tiles per side>", simulation rate "-simrate <ticks per second>"
+	// simulation worker threads "-simthreads <count>" and a snapshot to start with "-load <file>"
+	// "-replay <file>" plays a recording at full speed, then logs the timing and quits
+	GameSettings settings = (GameSettings)
+	{
+		.mapGridSize = g_MapGridSizeDefault,
+		.simTickRate = g_SimTickRateDefault,
+		.simWorkerCount = -1
+	};
+	const char* snapshotFilePath = NULL;
+	const char* replayFilePath = NULL;
+	for (int argIndex = 1; argIndex < argc - 1; argIndex++)
+	{
+		if (strcmp(argv[argIndex], "-map") == 0)
+		{
+			settings.mapGridSize = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-simrate") == 0)
+		{
+			settings.simTickRate = (float) atof(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-simthreads") == 0)
+		{
+			settings.simWorkerCount = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-load") == 0)
+		{
+			snapshotFilePath = argv[argIndex + 1];
+		}
+		else if (strcmp(argv[argIndex], "-replay") == 0)
+		{
+			replayFilePath = argv[argIndex + 1];
+		}
+	}
+
 	#if !defined(_DEBUG)
 		SetTraceLogLevel(LOG_NONE);         // Disable raylib trace log messages
 	#endif
@@ -449,8 +1624,30 @@ int main(void)
     //--------------------------------------------------------------------------------------
     InitWindow(g_ScreenWidth, g_ScreenHeight, "raylib gamejam game test");
 
-	GameAppInitializeState();
-	AssetsLoad();
+	#if defined(PLATFORM_WEB)
+		// snapshots live in IndexedDB, mounted and pulled in once at startup
+		EM_ASM(
+			FS.mkdir('/save');
+			FS.mount(IDBFS, {}, '/save');
+			FS.syncfs(true, function(error) { if(error) console.log(error); });
+		);
+	#endif
+
+	GameAppInitializeState(settings);
+	if(snapshotFilePath != NULL)
+	{
+		SnapshotLoad(snapshotFilePath);
+	}
+	// assets load one step per frame during the title screen, see TickLoadingScreen
+	#if defined(SIM_MULTITHREADED)
+		JobSystemStart(settings.simWorkerCount);
+		SimPipelineStart();
+	#endif
+	if(replayFilePath != NULL)
+	{
+		ReplayRequest(REPLAY_STATE_PLAYING, replayFilePath);
+		g_replay.isQuitWhenDone = true;
+	}
 
 	#if defined(PLATFORM_WEB)
 	emscripten_set_main_loop(TickMainLoop, 0, 1); // 0 FPS to use animation-request hook as recommended by the warning in the console
@@ -459,73 +1656,673 @@ int main(void)
 		//--------------------------------------------------------------------------------------
 
 		// Main game loop
-		while (!WindowShouldClose())    // Detect window close button
+		while (!WindowShouldClose() && !g_replay.isQuitRequested)    // Detect window close button
 		{
-			LoopTick();
+			TickMainLoop();
 		}
 	#endif
 
     // De-Initialization
     //--------------------------------------------------------------------------------------
     // TODO: Unload all loaded resources at this point
+	#if defined(SIM_MULTITHREADED)
+		SimPipelineStop();
+		JobSystemStop();
+	#endif
 	AssetsUnload();
+	ReplayFree();
+	MapFree();
+	RailGraphFree();
+	TrainPoolFree();
+	TrainRenderSnapshotsFree();
+	RoutePlannerFree();
+	ProfilerFree();
+	MemoryFree();
     CloseWindow();        // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
     return 0;
 }
+#endif
 
 //----------------------------------------------------------------------------------------------------------------------
-// Asset / Resource Management
+// Memory
 //----------------------------------------------------------------------------------------------------------------------
-void AssetsLoad(void)
+static inline size_t MemoryAlignUp(size_t size)
 {
-	TraceLog(LOG_INFO,"===> starting asset loading ....");
-	g_game.assetTexture = LoadTexture("resources/colormap.png");
-	for (int i = 0; i < MAX_MODELS_TO_LOAD_COUNT; i++)
-	{
-		g_game.assetModels[i] = LoadModel(g_modelFilePaths[i]);
-		//g_game.assetModels[i].materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = g_game.assetTexture; // not needed. Texture coming through the obj material library
-		TraceLog(LOG_INFO,"===> one step");
-	}
-	//GuiLoadStyle("resources/ui_style.rgs"); // disabled b/c: font spacing or kerning not working properly when font is not embedded. With font embedded we get an exception and app doesn't work
-	//LoadFont("resources/Pixel Intv.otf");
-	TraceLog(LOG_INFO,"===> asset loading completed.");
+	return (size + g_MemoryArenaAlignment - 1) & ~(g_MemoryArenaAlignment - 1);
 }
 
-void AssetsUnload(void)
+static MemoryArenaBlock* MemoryArenaAddBlock(MemoryArena* arena, size_t capacity)
 {
-	for (int i = 0; i < MAX_MODELS_TO_LOAD_COUNT; i++)
+	MemoryArenaBlock* block = MemAlloc((unsigned int) (MemoryAlignUp(sizeof(MemoryArenaBlock)) + capacity));
+	block->previous = arena->block;
+	block->capacity = capacity;
+	block->used = 0;
+	arena->block = block;
+	arena->reserved += capacity;
+	arena->heapAllocationCount++;
+	return block;
+}
+
+static void MemoryArenaFreeBlocks(MemoryArena* arena)
+{
+	while(arena->block != NULL)
 	{
-		UnloadModel(g_game.assetModels[i]);
+		MemoryArenaBlock* previous = arena->block->previous;
+		MemFree(arena->block);
+		arena->block = previous;
 	}
-	UnloadTexture(g_game.assetTexture);
-	TraceLog(LOG_INFO,"===> asset unloading completed.");
+	arena->reserved = 0;
 }
 
-//----------------------------------------------------------------------------------------------------------------------
-// Camera topics
-//----------------------------------------------------------------------------------------------------------------------
-void inline CameraUpdateFromControlValues(void)
+// zeroed like MemAlloc
+static void* MemoryArenaAlloc(MemoryArena* arena, size_t size)
 {
-	// Extract control values for easier access
-	Vector3 pivot = g_game.cameraControlValues.pivot;
-	float zoomDistance = g_game.cameraControlValues.zoomDistance;
-	float rotation = g_game.cameraControlValues.rotation;
-	rotation -= PI * 0.5f; // equivalent to 180 degrees
+	size = MemoryAlignUp(size);
+	MemoryArenaBlock* block = arena->block;
+	if(block == NULL || block->used + size > block->capacity)
+	{
+		// doubling keeps the chain short until the next reset merges it
+		size_t capacity = block == NULL ? arena->blockSize : block->capacity * 2;
+		block = MemoryArenaAddBlock(arena, capacity > size ? capacity : size);
+	}
 
-	// Calculate the new camera position based on rotation around the pivot
-	float cameraX = pivot.x + zoomDistance * cosf(rotation);
-	float cameraZ = pivot.z + zoomDistance * sinf(rotation);
-	float cameraY = pivot.y + zoomDistance * 0.75f; // Adjust this value if you want to modify the height of the camera
+	unsigned char* memory = (unsigned char*) block + MemoryAlignUp(sizeof(MemoryArenaBlock)) + block->used;
+	block->used += size;
+	arena->used += size;
+	arena->peak = arena->used > arena->peak ? arena->used : arena->peak;
+	memset(memory, 0, size);
+	return memory;
+}
 
-	g_game.camera = (Camera3D)
+// all allocations become invalid. A chain of blocks is replaced by one block that holds all of them, or by nothing
+// if that's above retainMax, the next allocation starts over with blockSize then
+static void MemoryArenaReset(MemoryArena* arena)
+{
+	bool isSingleBlock = arena->block == NULL || arena->block->previous == NULL;
+	if(isSingleBlock && arena->reserved <= arena->retainMax)
 	{
-		.position = (Vector3) (Vector3){ cameraX, cameraY, cameraZ },
-		.target = g_game.cameraControlValues.pivot,
+		if(arena->block != NULL)
+		{
+			arena->block->used = 0;
+		}
+	}
+	else
+	{
+		size_t capacity = arena->used > arena->blockSize ? arena->used : arena->blockSize;
+		MemoryArenaFreeBlocks(arena);
+		if(capacity <= arena->retainMax)
+		{
+			MemoryArenaAddBlock(arena, capacity);
+		}
+	}
+	arena->lastUsed = arena->used;
+	arena->used = 0;
+}
+
+static MemoryArenaMark MemoryArenaGetMark(const MemoryArena* arena)
+{
+	return (MemoryArenaMark) {arena->block, arena->block != NULL ? arena->block->used : 0, arena->used};
+}
+
+// gives back everything allocated since the mark. The newest block stays for the next allocations, blocks added
+// between it and the mark go back to the heap
+static void MemoryArenaRewind(MemoryArena* arena, MemoryArenaMark mark)
+{
+	MemoryArenaBlock* newest = arena->block;
+	if(newest != mark.block)
+	{
+		MemoryArenaBlock* block = newest->previous;
+		while(block != mark.block)
+		{
+			MemoryArenaBlock* previous = block->previous;
+			arena->reserved -= block->capacity;
+			MemFree(block);
+			block = previous;
+		}
+		newest->previous = mark.block;
+		newest->used = 0;
+	}
+	if(mark.block != NULL)
+	{
+		mark.block->used = mark.blockUsed;
+	}
+	arena->used = mark.used;
+}
+
+static void MemoryFree(void)
+{
+	MemoryArenaFreeBlocks(&g_memory.frameArena);
+	MemoryArenaFreeBlocks(&g_memory.sessionArena);
+	g_memory.frameArena.used = 0;
+	g_memory.sessionArena.used = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Profiler
+//----------------------------------------------------------------------------------------------------------------------
+#if defined(SUPPORT_PROFILER)
+static void ProfileTracePush(ProfileZone zone, double startTime, double duration)
+{
+	if(g_profiler.traceEventCount == g_profiler.traceEventCapacity)
+	{
+		g_profiler.traceEventCapacity = g_profiler.traceEventCapacity == 0 ? 4096 : g_profiler.traceEventCapacity * 2;
+		g_profiler.traceEvents = MemRealloc(g_profiler.traceEvents, g_profiler.traceEventCapacity * sizeof(ProfileTraceEvent));
+	}
+	g_profiler.traceEvents[g_profiler.traceEventCount++] = (ProfileTraceEvent) {startTime, (float) duration, zone};
+}
+#endif
+
+// for zones measured elsewhere, e.g. on the simulation thread
+static inline void ProfileAddZoneTime(ProfileZone zone, double startTime, double duration)
+{
+	#if defined(SUPPORT_PROFILER)
+		g_profiler.zoneFrameTimes[zone] += (float) duration;
+		if(g_profiler.traceFramesLeft > 0)
+		{
+			ProfileTracePush(zone, startTime, duration);
+		}
+	#else
+		(void) zone;
+		(void) startTime;
+		(void) duration;
+	#endif
+}
+
+static inline void ProfileBegin(ProfileZone zone)
+{
+	#if defined(SUPPORT_PROFILER)
+		g_profiler.zoneStartTimes[zone] = GetTime();
+	#else
+		(void) zone;
+	#endif
+}
+
+// zones entered several times per frame add up
+static inline void ProfileEnd(ProfileZone zone)
+{
+	#if defined(SUPPORT_PROFILER)
+		double startTime = g_profiler.zoneStartTimes[zone];
+		ProfileAddZoneTime(zone, startTime, GetTime() - startTime);
+	#else
+		(void) zone;
+	#endif
+}
+
+static inline void ProfileCountDraws(int drawCalls, int triangles)
+{
+	g_profiler.drawCalls += drawCalls;
+	g_profiler.triangles += triangles;
+}
+
+// one draw call per mesh
+static inline void ProfileCountModelDraws(Model model, int instanceCount)
+{
+	for(int meshIndex = 0; meshIndex < model.meshCount; ++meshIndex)
+	{
+		ProfileCountDraws(1, model.meshes[meshIndex].triangleCount * instanceCount);
+	}
+}
+
+// rolling average over the history in ms
+static float ProfileGetAverage(ProfileZone zone)
+{
+	float sum = 0;
+	for(int i = 0; i < g_profiler.historyCount; ++i)
+	{
+		sum += g_profiler.history[zone][i];
+	}
+	return g_profiler.historyCount > 0 ? sum / (float) g_profiler.historyCount : 0.0f;
+}
+
+static int ProfileCompareFloats(const void* a, const void* b)
+{
+	float x = *(const float*) a;
+	float y = *(const float*) b;
+	return (x > y) - (x < y);
+}
+
+// percentile in [0, 1] over the history in ms
+static float ProfileGetPercentile(ProfileZone zone, float percentile)
+{
+	if(g_profiler.historyCount == 0)
+	{
+		return 0.0f;
+	}
+	float sorted[g_ProfilerHistoryLength];
+	memcpy(sorted, g_profiler.history[zone], g_profiler.historyCount * sizeof(float));
+	qsort(sorted, g_profiler.historyCount, sizeof(float), ProfileCompareFloats);
+	int index = (int) (percentile * (float) (g_profiler.historyCount - 1) + 0.5f);
+	return sorted[index];
+}
+
+// bytes, -1 where the platform doesn't tell
+static int64_t ProfileGetMemoryUsage(void)
+{
+	#if defined(PLATFORM_WEB)
+		struct mallinfo info = mallinfo();
+		return (int64_t) info.uordblks; // heap in use
+	#elif defined(__linux__)
+		long residentPages = 0;
+		FILE* statm = fopen("/proc/self/statm", "r");
+		if(statm == NULL || fscanf(statm, "%*s %ld", &residentPages) != 1)
+		{
+			residentPages = -1;
+		}
+		if(statm != NULL)
+		{
+			fclose(statm);
+		}
+		return residentPages < 0 ? -1 : (int64_t) residentPages * sysconf(_SC_PAGESIZE);
+	#else
+		return -1;
+	#endif
+}
+
+// writes the frame history oldest first, one row per frame in ms
+static bool ProfileWriteCsv(const char* filePath)
+{
+	int lineLength = 16 * PROFILE_ZONE_COUNT;
+	int textSize = (g_profiler.historyCount + 1) * lineLength + 1;
+	char* text = MemAlloc(textSize);
+	int length = 0;
+	for(int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone)
+	{
+		length += snprintf(text + length, textSize - length, zone == 0 ? "%s" : ",%s", ProfileZoneToString(zone));
+	}
+	length += snprintf(text + length, textSize - length, "\n");
+
+	int firstIndex = (g_profiler.historyIndex - g_profiler.historyCount + g_ProfilerHistoryLength) % g_ProfilerHistoryLength;
+	for(int i = 0; i < g_profiler.historyCount; ++i)
+	{
+		int index = (firstIndex + i) % g_ProfilerHistoryLength;
+		for(int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone)
+		{
+			length += snprintf(text + length, textSize - length, zone == 0 ? "%.3f" : ",%.3f", g_profiler.history[zone][index]);
+		}
+		length += snprintf(text + length, textSize - length, "\n");
+	}
+
+	bool isSaved = SaveFileText(filePath, text);
+	MemFree(text);
+	TraceLog(LOG_INFO, "===> profiler: %d frames written to %s", g_profiler.historyCount, filePath);
+	return isSaved;
+}
+
+// Chrome trace event format, complete events in microseconds. The trains get their own track, pipelined frames run
+// them next to the drawing
+static bool ProfileWriteTrace(const char* filePath)
+{
+	int lineLength = 128;
+	int textSize = (g_profiler.traceEventCount + 2) * lineLength;
+	char* text = MemAlloc(textSize);
+	int length = snprintf(text, textSize, "{\"traceEvents\":[\n");
+	for(int i = 0; i < g_profiler.traceEventCount; ++i)
+	{
+		const ProfileTraceEvent* event = &g_profiler.traceEvents[i];
+		length += snprintf(text + length, textSize - length, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,\"pid\":1,\"tid\":%d}%s\n",
+			ProfileZoneToString(event->zone), (event->startTime - g_profiler.traceStartTime) * 1000000.0, event->duration * 1000000.0f,
+			event->zone == PROFILE_ZONE_TRAINS ? 2 : 1,
+			i + 1 < g_profiler.traceEventCount ? "," : "");
+	}
+	snprintf(text + length, textSize - length, "]}\n");
+
+	bool isSaved = SaveFileText(filePath, text);
+	MemFree(text);
+	TraceLog(LOG_INFO, "===> profiler: %d trace events written to %s", g_profiler.traceEventCount, filePath);
+	return isSaved;
+}
+
+static void ProfileTraceStart(void)
+{
+	g_profiler.traceEventCount = 0;
+	g_profiler.traceFramesLeft = g_ProfilerTraceFrameCount;
+	g_profiler.traceStartTime = GetTime();
+}
+
+// moves the frame's zone times into the history, call once per frame after the last zone ended
+static void ProfileFrameEnd(void)
+{
+	for(int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone)
+	{
+		g_profiler.history[zone][g_profiler.historyIndex] = g_profiler.zoneFrameTimes[zone] * 1000.0f;
+		g_profiler.zoneFrameTimes[zone] = 0;
+	}
+	g_profiler.historyIndex = (g_profiler.historyIndex + 1) % g_ProfilerHistoryLength;
+	g_profiler.historyCount += g_profiler.historyCount < g_ProfilerHistoryLength ? 1 : 0;
+
+	g_profiler.drawCallsLastFrame = g_profiler.drawCalls;
+	g_profiler.trianglesLastFrame = g_profiler.triangles;
+	g_profiler.drawCalls = 0;
+	g_profiler.triangles = 0;
+
+	if(g_profiler.traceFramesLeft > 0 && --g_profiler.traceFramesLeft == 0)
+	{
+		ProfileWriteTrace(g_ProfilerTraceFilePath);
+	}
+}
+
+static void ProfilerFree(void)
+{
+	MemFree(g_profiler.traceEvents);
+	g_profiler.traceEvents = NULL;
+	g_profiler.traceEventCount = 0;
+	g_profiler.traceEventCapacity = 0;
+	g_profiler.traceFramesLeft = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Asset / Resource Management
+//----------------------------------------------------------------------------------------------------------------------
+// baked model textures are loaded once per file name
+static Texture AssetsGetMaterialTexture(const char* directory, const char* fileName)
+{
+	for(int i = 0; i < g_game.assetMaterialTextureCount; ++i)
+	{
+		if(strcmp(g_game.assetMaterialTextureNames[i], fileName) == 0)
+		{
+			return g_game.assetMaterialTextures[i];
+		}
+	}
+	if(g_game.assetMaterialTextureCount == g_AssetMaterialTextureMax)
+	{
+		// untracked it would never be unloaded and get loaded again by every model using it
+		TraceLog(LOG_WARNING, "===> more than %d material textures, %s is drawn untextured", g_AssetMaterialTextureMax, fileName);
+		return (Texture) {rlGetTextureIdDefault(), 1, 1, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+	}
+	int index = g_game.assetMaterialTextureCount++;
+	g_game.assetMaterialTextures[index] = LoadTexture(TextFormat("%s/%s", directory, fileName));
+	strcpy(g_game.assetMaterialTextureNames[index], fileName);
+	return g_game.assetMaterialTextures[index];
+}
+
+static void* AssetsCopyBakedArray(const unsigned char* data, uint32_t offset, size_t size)
+{
+	void* array = MemAlloc((unsigned int) size);
+	memcpy(array, data + offset, size);
+	return array;
+}
+
+// loads a .mesh made by tools/mesh_baker.c, the arrays only get copied into the mesh and uploaded
+static bool AssetsLoadBakedModel(const char* filePath, Model* model)
+{
+	int dataSize = 0;
+	unsigned char* data = FileExists(filePath) ? LoadFileData(filePath, &dataSize) : NULL;
+	if(data == NULL)
+	{
+		return false;
+	}
+
+	const BakedMeshFileHeader* header = (const BakedMeshFileHeader*) data;
+	const BakedMaterial* materials = (const BakedMaterial*) (data + sizeof(BakedMeshFileHeader));
+	const BakedMeshHeader* meshHeaders = (const BakedMeshHeader*) (materials + (dataSize >= (int) sizeof(BakedMeshFileHeader) ? header->materialCount : 0));
+	bool isValid = dataSize >= (int) sizeof(BakedMeshFileHeader) && memcmp(header->magic, BAKED_MESH_MAGIC, 4) == 0 && header->version == BAKED_MESH_VERSION &&
+		header->materialCount > 0 && header->meshCount > 0 &&
+		sizeof(BakedMeshFileHeader) + (uint64_t) header->materialCount * sizeof(BakedMaterial) + (uint64_t) header->meshCount * sizeof(BakedMeshHeader) <= (uint64_t) dataSize;
+	for(int i = 0; isValid && i < header->meshCount; ++i)
+	{
+		const BakedMeshHeader* mesh = &meshHeaders[i];
+		isValid = mesh->materialIndex >= 0 && mesh->materialIndex < header->materialCount && mesh->vertexCount > 0 && mesh->indexCount > 0 &&
+			mesh->dataOffset + (uint64_t) mesh->vertexCount * 8 * sizeof(float) + (uint64_t) mesh->indexCount * sizeof(uint16_t) <= (uint64_t) dataSize;
+		// an index past the vertices would make the GPU read out of the vertex buffer
+		uint64_t indicesOffset = isValid ? mesh->dataOffset + (uint64_t) mesh->vertexCount * 8 * sizeof(float) : 0;
+		for(int index = 0; isValid && index < mesh->indexCount; ++index)
+		{
+			uint16_t vertexIndex;
+			memcpy(&vertexIndex, data + indicesOffset + index * sizeof(uint16_t), sizeof(uint16_t)); // the file keeps no alignment
+			isValid = vertexIndex < mesh->vertexCount;
+		}
+	}
+	if(!isValid)
+	{
+		TraceLog(LOG_WARNING, "===> %s is not a baked mesh of version %d, rebake it", filePath, BAKED_MESH_VERSION);
+		UnloadFileData(data);
+		return false;
+	}
+
+	*model = (Model)
+	{
+		.transform = MatrixIdentity(),
+		.meshCount = header->meshCount,
+		.materialCount = header->materialCount,
+		.meshes = MemAlloc(header->meshCount * sizeof(Mesh)),
+		.materials = MemAlloc(header->materialCount * sizeof(Material)),
+		.meshMaterial = MemAlloc(header->meshCount * sizeof(int))
+	};
+	const char* directory = GetDirectoryPath(filePath);
+	for(int i = 0; i < header->materialCount; ++i)
+	{
+		const BakedMaterial* baked = &materials[i];
+		model->materials[i] = LoadMaterialDefault();
+		model->materials[i].maps[MATERIAL_MAP_DIFFUSE].color = (Color) {baked->diffuseColor[0], baked->diffuseColor[1], baked->diffuseColor[2], baked->diffuseColor[3]};
+		if(baked->diffuseTexture[0] != '\0' && memchr(baked->diffuseTexture, '\0', BAKED_MESH_TEXTURE_NAME_SIZE) != NULL)
+		{
+			model->materials[i].maps[MATERIAL_MAP_DIFFUSE].texture = AssetsGetMaterialTexture(directory, baked->diffuseTexture);
+		}
+	}
+	for(int i = 0; i < header->meshCount; ++i)
+	{
+		const BakedMeshHeader* baked = &meshHeaders[i];
+		uint32_t normalsOffset = baked->dataOffset + baked->vertexCount * 3 * sizeof(float);
+		uint32_t texcoordsOffset = normalsOffset + baked->vertexCount * 3 * sizeof(float);
+		uint32_t indicesOffset = texcoordsOffset + baked->vertexCount * 2 * sizeof(float);
+		Mesh* mesh = &model->meshes[i];
+		mesh->vertexCount = baked->vertexCount;
+		mesh->triangleCount = baked->indexCount / 3;
+		mesh->vertices = AssetsCopyBakedArray(data, baked->dataOffset, baked->vertexCount * 3 * sizeof(float));
+		mesh->normals = AssetsCopyBakedArray(data, normalsOffset, baked->vertexCount * 3 * sizeof(float));
+		mesh->texcoords = AssetsCopyBakedArray(data, texcoordsOffset, baked->vertexCount * 2 * sizeof(float));
+		mesh->indices = AssetsCopyBakedArray(data, indicesOffset, baked->indexCount * sizeof(uint16_t));
+		UploadMesh(mesh, false);
+		model->meshMaterial[i] = baked->materialIndex;
+	}
+	UnloadFileData(data);
+	return true;
+}
+
+// baked next to the obj by the bake_meshes build target, the obj only is the fallback while developing
+static void AssetsLoadModel(ModelID modelID)
+{
+	double startTime = GetTime();
+	const char* objFilePath = g_modelFilePaths[modelID];
+	const char* bakedFilePath = TextFormat("%s/%s.mesh", GetDirectoryPath(objFilePath), GetFileNameWithoutExt(objFilePath));
+	if(!AssetsLoadBakedModel(bakedFilePath, &g_game.assetModels[modelID]))
+	{
+		TraceLog(LOG_WARNING, "===> no baked mesh for %s, parsing the obj", objFilePath);
+		g_game.assetModels[modelID] = LoadModel(objFilePath);
+	}
+	g_game.assetModelIsLoaded[modelID] = true;
+	TraceLog(LOG_INFO, "===> model %s loaded in %.2f ms", ModelIdToString(modelID), (GetTime() - startTime) * 1000.0);
+}
+
+// models loaded on demand block the frame of their first use
+static Model AssetsGetModel(ModelID modelID)
+{
+	if(!g_game.assetModelIsLoaded[modelID])
+	{
+		AssetsLoadModel(modelID);
+	}
+	return g_game.assetModels[modelID];
+}
+
+static void AssetsLoadShaders(void)
+{
+	// instancing shader, mvp and instanceTransform need to be known to DrawMeshInstanced
+	g_game.assetInstancingShader = LoadShaderFromMemory(g_instancingShaderVertexCode, g_instancingShaderFragmentCode);
+	g_game.assetInstancingShader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(g_game.assetInstancingShader, "mvp");
+	g_game.assetInstancingShader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(g_game.assetInstancingShader, "instanceTransform");
+	// mvp, matModel, colDiffuse and texture0 are found by raylib, the rest is set by RenderTrainsInstanced
+	g_game.assetTrainShader = LoadShaderFromMemory(g_trainShaderVertexCode, g_instancingShaderFragmentCode);
+	g_game.assetTrainShaderAlphaLoc = GetShaderLocation(g_game.assetTrainShader, "interpolationAlpha");
+	g_game.assetTrainShaderPreviousLoc = GetShaderLocationAttrib(g_game.assetTrainShader, "instancePrevious");
+	g_game.assetTrainShaderCurrentLoc = GetShaderLocationAttrib(g_game.assetTrainShader, "instanceCurrent");
+	// ground quad and grid shader, the colors stay, the axis position follows the map size
+	g_game.assetGroundMesh = GenMeshPlane(1.0f, 1.0f, 1, 1);
+	g_game.assetGroundMaterial = LoadMaterialDefault();
+	g_game.assetGridShader = LoadShaderFromMemory(g_gridShaderVertexCode, g_gridShaderFragmentCode);
+	g_game.assetGridShaderAxisLoc = GetShaderLocation(g_game.assetGridShader, "axisPosition");
+	Vector4 gridColor = ColorNormalize(COLOR_BLACK);
+	Vector4 axisColor = ColorNormalize(COLOR_RED);
+	SetShaderValue(g_game.assetGridShader, GetShaderLocation(g_game.assetGridShader, "gridColor"), &gridColor, SHADER_UNIFORM_VEC4);
+	SetShaderValue(g_game.assetGridShader, GetShaderLocation(g_game.assetGridShader, "axisColor"), &axisColor, SHADER_UNIFORM_VEC4);
+	//GuiLoadStyle("resources/ui_style.rgs"); // disabled b/c: font spacing or kerning not working properly when font is not embedded. With font embedded we get an exception and app doesn't work
+	//LoadFont("resources/Pixel Intv.otf");
+}
+
+// the model of a load step, MODEL_COUNT for the shader step
+static ModelID AssetsGetStepModel(int step)
+{
+	int modelStep = 0;
+	for(int modelID = 0; modelID < MODEL_COUNT; ++modelID)
+	{
+		if(!g_modelIsLoadedOnDemand[modelID] && ++modelStep == step)
+		{
+			return (ModelID) modelID;
+		}
+	}
+	return MODEL_COUNT;
+}
+
+// runs the next load step, true once everything needed at startup is loaded. Steps are small enough for one frame,
+// so the browser keeps getting frames while loading
+static bool AssetsLoadStep(void)
+{
+	AssetLoadState* load = &g_game.assetLoad;
+	if(load->stepCount == 0)
+	{
+		TraceLog(LOG_INFO,"===> starting asset loading ....");
+		load->startTime = GetTime();
+		load->stepCount = 1;
+		for(int modelID = 0; modelID < MODEL_COUNT; ++modelID)
+		{
+			load->stepCount += g_modelIsLoadedOnDemand[modelID] ? 0 : 1;
+		}
+	}
+	if(load->nextStep >= load->stepCount)
+	{
+		return true;
+	}
+
+	ModelID modelID = AssetsGetStepModel(load->nextStep);
+	if(modelID == MODEL_COUNT)
+	{
+		AssetsLoadShaders();
+	}
+	else
+	{
+		AssetsLoadModel(modelID);
+	}
+	load->nextStep++;
+
+	ModelID nextModelID = AssetsGetStepModel(load->nextStep);
+	load->currentName = nextModelID == MODEL_COUNT ? "Shaders" : ModelIdToString(nextModelID);
+	if(load->nextStep < load->stepCount)
+	{
+		return false;
+	}
+	TraceLog(LOG_INFO, "===> asset loading completed in %.2f ms over %d frames", (GetTime() - load->startTime) * 1000.0, load->stepCount);
+	return true;
+}
+
+void AssetsUnload(void)
+{
+	for (int i = 0; i < MODEL_COUNT; i++)
+	{
+		if(g_game.assetModelIsLoaded[i])
+		{
+			UnloadModel(g_game.assetModels[i]);
+			g_game.assetModelIsLoaded[i] = false;
+		}
+	}
+	UnloadShader(g_game.assetInstancingShader);
+	UnloadShader(g_game.assetTrainShader);
+	TrainInstancesFree();
+	MapChunkImpostorsFree();
+	UnloadShader(g_game.assetGridShader);
+	UnloadMesh(g_game.assetGroundMesh);
+	UnloadMaterial(g_game.assetGroundMaterial);
+	if(g_game.mapGridLinesMeshSize > 0)
+	{
+		UnloadMesh(g_game.mapGridLinesMesh);
+		g_game.mapGridLinesMeshSize = 0;
+	}
+	for (int i = 0; i < g_game.assetMaterialTextureCount; i++)
+	{
+		UnloadTexture(g_game.assetMaterialTextures[i]);
+	}
+	g_game.assetMaterialTextureCount = 0;
+	TraceLog(LOG_INFO,"===> asset unloading completed.");
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Camera topics
+//----------------------------------------------------------------------------------------------------------------------
+// extracts the frustum planes from view projection matrix, same matrices as BeginMode3D sets up
+static void CameraFrustumUpdate(void)
+{
+	Camera3D camera = g_game.camera;
+	int screenHeight = GetScreenHeight();
+	float aspect = screenHeight > 0 ? (float) GetScreenWidth() / (float) screenHeight : (float) g_ScreenWidth / (float) g_ScreenHeight;
+	Matrix matView = MatrixLookAt(camera.position, camera.target, camera.up);
+	Matrix matProjection = MatrixPerspective(camera.fovy * DEG2RAD, aspect, rlGetCullDistanceNear(), rlGetCullDistanceFar());
+	Matrix m = MatrixMultiply(matView, matProjection);
+
+	// rows of the combined matrix (raylib matrices are column major)
+	Vector4 row0 = (Vector4) {m.m0, m.m4, m.m8, m.m12};
+	Vector4 row1 = (Vector4) {m.m1, m.m5, m.m9, m.m13};
+	Vector4 row2 = (Vector4) {m.m2, m.m6, m.m10, m.m14};
+	Vector4 row3 = (Vector4) {m.m3, m.m7, m.m11, m.m15};
+
+	Vector4* planes = g_game.cameraFrustum.planes;
+	planes[0] = (Vector4) {row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w}; // left
+	planes[1] = (Vector4) {row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w}; // right
+	planes[2] = (Vector4) {row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w}; // bottom
+	planes[3] = (Vector4) {row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w}; // top
+	planes[4] = (Vector4) {row3.x + row2.x, row3.y + row2.y, row3.z + row2.z, row3.w + row2.w}; // near
+	planes[5] = (Vector4) {row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w}; // far
+}
+
+// conservative test, a box is only rejected if it's completely behind one of the planes
+static bool CameraFrustumContainsBox(BoundingBox box)
+{
+	for(int planeIndex = 0; planeIndex < 6; ++planeIndex)
+	{
+		Vector4 plane = g_game.cameraFrustum.planes[planeIndex];
+		// corner of the box furthest along the plane normal
+		float x = plane.x >= 0 ? box.max.x : box.min.x;
+		float y = plane.y >= 0 ? box.max.y : box.min.y;
+		float z = plane.z >= 0 ? box.max.z : box.min.z;
+		if(plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void inline CameraUpdateFromControlValues(void)
+{
+	// Extract control values for easier access
+	Vector3 pivot = g_game.cameraControlValues.pivot;
+	float zoomDistance = g_game.cameraControlValues.zoomDistance;
+	float rotation = g_game.cameraControlValues.rotation;
+	rotation -= PI * 0.5f; // equivalent to 180 degrees
+
+	// Calculate the new camera position based on rotation around the pivot
+	float cameraX = pivot.x + zoomDistance * cosf(rotation);
+	float cameraZ = pivot.z + zoomDistance * sinf(rotation);
+	float cameraY = pivot.y + zoomDistance * 0.75f; // Adjust this value if you want to modify the height of the camera
+
+	g_game.camera = (Camera3D)
+	{
+		.position = (Vector3) (Vector3){ cameraX, cameraY, cameraZ },
+		.target = g_game.cameraControlValues.pivot,
 		.up = (Vector3) {0.0f, 1.0f, 0.0f},
 		.fovy = 60.0f,
 		.projection = CAMERA_PERSPECTIVE
 	};
+
+	CameraFrustumUpdate();
 }
 
 static void TickCamera(void)
@@ -645,48 +2442,29 @@ static void TickCamera(void)
 	//----------------------------------------------------------------------------------
 	if(cameraNeedsUpdating)
 	{
-		CameraUpdateFromControlValues();
+		GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_CAMERA_SET, .params.camera = g_game.cameraControlValues});
 	}
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 // Map topics
 //----------------------------------------------------------------------------------------------------------------------
-void DrawGridAt(int slices, float spacing, float x, float y, float z, Color mainColor, Color axisColor)
-{
-	int halfSlices = slices/2;
-	rlBegin(RL_LINES);
-	for (int i = -halfSlices; i <= halfSlices; i++)
-	{
-		if (i == 0)
-		{
-			rlColor4ub(axisColor.r, axisColor.g, axisColor.b, axisColor.a);
-		}
-		else
-		{
-			rlColor4ub(mainColor.r, mainColor.g, mainColor.b, mainColor.a);
-		}
-
-		rlVertex3f((float)i*spacing + x, y, (float)-halfSlices*spacing + z);
-		rlVertex3f((float)i*spacing + x, y, (float)halfSlices*spacing + z);
-
-		rlVertex3f((float)-halfSlices*spacing + x, y, (float)i*spacing + z);
-		rlVertex3f((float)halfSlices*spacing + x, y, (float)i*spacing + z);
-	}
-	rlEnd();
-}
-
+// tiles are stored chunk by chunk, each chunk row by row
 static inline int TileIndexByTileCoords(int x, int y)
 {
-	return y * g_MapGridSize + x;
+	int chunkIndex = (y / g_MapChunkSize) * g_MapChunksPerSide + (x / g_MapChunkSize);
+	int localIndex = (y % g_MapChunkSize) * g_MapChunkSize + (x % g_MapChunkSize);
+	return chunkIndex * g_MapChunkTileCount + localIndex;
 }
 
 static inline TileCoords TileCoordsByIndex(int arrayIndex)
 {
 	TileCoords coords;
 
-	coords.z = arrayIndex / g_MapGridSize;
-	coords.x = arrayIndex % g_MapGridSize;
+	int chunkIndex = arrayIndex / g_MapChunkTileCount;
+	int localIndex = arrayIndex % g_MapChunkTileCount;
+	coords.z = (chunkIndex / g_MapChunksPerSide) * g_MapChunkSize + localIndex / g_MapChunkSize;
+	coords.x = (chunkIndex % g_MapChunksPerSide) * g_MapChunkSize + localIndex % g_MapChunkSize;
 
 	return coords;
 }
@@ -706,20 +2484,280 @@ static inline bool TileHasConnectionFlag(ConnectionsConfig flags, ConnectionDire
 	return (flags & flag) != 0;
 }
 
-static inline int TileHConnectionsCount(ConnectionsConfig flags)
+//----------------------------------------------------------------------------------------------------------------------
+// Tile lookup tables, replace the branchy per tile transition logic with array reads
+// TileSector and ConnectionDirection are bit flags, tables are indexed by the flag value (designated initializers)
+
+// number of set bits for all 6 bit connection configs
+static const uint8_t g_connectionsCountTable[64] =
 {
-	int count = 0;
-	while (flags)
-	{
-		flags &= (flags - 1); // Clear the least significant set bit
-		count++;
-	}
-	return count;
-}
+	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6
+};
 
-static inline void TileAddRailConnection(int x, int y, ConnectionDirection connection)
+static const TileEdge g_tileSectorToEdge[TILE_SECTOR_NE + 1] =
+{
+	[TILE_SECTOR_S] = TILE_EDGE_S,
+	[TILE_SECTOR_E] = TILE_EDGE_E,
+	[TILE_SECTOR_W] = TILE_EDGE_W,
+	[TILE_SECTOR_N] = TILE_EDGE_N,
+};
+
+// exit sector for a single connection and the edge the train entered from
+static const TileSector g_connectionExitByEntry[CONNECTION_SW_WS + 1][TILE_EDGE_COUNT] =
+{
+	//                   NONE             S                E                W                N
+	[CONNECTION_NS_SN] = {TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_S},
+	[CONNECTION_NE_EN] = {TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_E},
+	[CONNECTION_NW_WN] = {TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_N, TILE_SECTOR_W},
+	[CONNECTION_ES_SE] = {TILE_SECTOR_S, TILE_SECTOR_E, TILE_SECTOR_S, TILE_SECTOR_S, TILE_SECTOR_S},
+	[CONNECTION_EW_WE] = {TILE_SECTOR_E, TILE_SECTOR_E, TILE_SECTOR_W, TILE_SECTOR_E, TILE_SECTOR_E},
+	[CONNECTION_SW_WS] = {TILE_SECTOR_S, TILE_SECTOR_W, TILE_SECTOR_S, TILE_SECTOR_S, TILE_SECTOR_S},
+};
+
+// the entry sector on the neighbour tile is the opposite edge of the exit
+static const TileSector g_tileEdgeOppositeSector[TILE_EDGE_COUNT] =
+{
+	[TILE_EDGE_NONE] = TILE_SECTOR_CENTER,
+	[TILE_EDGE_S] = TILE_SECTOR_N,
+	[TILE_EDGE_E] = TILE_SECTOR_W,
+	[TILE_EDGE_W] = TILE_SECTOR_E,
+	[TILE_EDGE_N] = TILE_SECTOR_S,
+};
+
+// neighbour tile offset when leaving through an edge
+static const TileCoords g_tileEdgeNeighbourOffset[TILE_EDGE_COUNT] =
+{
+	[TILE_EDGE_NONE] = {0, 0},
+	[TILE_EDGE_S] = {0, -1},
+	[TILE_EDGE_E] = {-1, 0},
+	[TILE_EDGE_W] = {1, 0},
+	[TILE_EDGE_N] = {0, 1},
+};
+
+// all connections that start or end at an edge
+static const ConnectionsConfig g_tileEdgeConnections[TILE_EDGE_COUNT] =
+{
+	[TILE_EDGE_NONE] = 0,
+	[TILE_EDGE_S] = CONNECTION_SW_WS | CONNECTION_NS_SN | CONNECTION_ES_SE,
+	[TILE_EDGE_E] = CONNECTION_ES_SE | CONNECTION_EW_WE | CONNECTION_NE_EN,
+	[TILE_EDGE_W] = CONNECTION_EW_WE | CONNECTION_SW_WS | CONNECTION_NW_WN,
+	[TILE_EDGE_N] = CONNECTION_NS_SN | CONNECTION_NW_WN | CONNECTION_NE_EN,
+};
+
+typedef struct TileRailsModelEntry
+{
+	bool hasModel;
+	ModelID modelID;
+	uint8_t quarterTurns;
+} TileRailsModelEntry;
+
+// rails model for every connection config, configs without a model keep whatever the tile had before
+static const TileRailsModelEntry g_connectionsRailsModelTable[64] =
+{
+	[CONNECTION_NS_SN] = {true, MODEL_RAILS_STRAIGHT, 0},
+	[CONNECTION_EW_WE] = {true, MODEL_RAILS_STRAIGHT, 1},
+	[CONNECTION_ES_SE] = {true, MODEL_RAILS_CURVE, 0},
+	[CONNECTION_NE_EN] = {true, MODEL_RAILS_CURVE, 1},
+	[CONNECTION_NW_WN] = {true, MODEL_RAILS_CURVE, 2},
+	[CONNECTION_SW_WS] = {true, MODEL_RAILS_CURVE, 3},
+	[CONNECTION_NS_SN | CONNECTION_EW_WE] = {true, MODEL_RAILS_CROSS, 0},
+	[CONNECTION_NS_SN | CONNECTION_ES_SE] = {true, MODEL_RAILS_MERGE, 0},
+	[CONNECTION_NS_SN | CONNECTION_NE_EN] = {true, MODEL_RAILS_MERGE_MIRROR, 0},
+	[CONNECTION_NS_SN | CONNECTION_NW_WN] = {true, MODEL_RAILS_MERGE, 2},
+	[CONNECTION_NS_SN | CONNECTION_SW_WS] = {true, MODEL_RAILS_MERGE_MIRROR, 2},
+	[CONNECTION_EW_WE | CONNECTION_SW_WS] = {true, MODEL_RAILS_MERGE, 3},
+	[CONNECTION_EW_WE | CONNECTION_NW_WN] = {true, MODEL_RAILS_MERGE_MIRROR, 1},
+	[CONNECTION_EW_WE | CONNECTION_NE_EN] = {true, MODEL_RAILS_MERGE, 1},
+	[CONNECTION_EW_WE | CONNECTION_ES_SE] = {true, MODEL_RAILS_MERGE_MIRROR, 3},
+};
+
+static inline int TileHConnectionsCount(ConnectionsConfig flags)
+{
+	return g_connectionsCountTable[flags & 0x3F];
+}
+
+// drops the map storage and frees the lazily allocated chunk data, reset the session arena afterwards
+static void MapFree(void)
+{
+	if(g_game.mapChunks != NULL)
+	{
+		for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+		{
+			MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+			MemFree(chunk->transforms);
+			for(int meshIndex = 0; meshIndex < chunk->mergedMeshCount; ++meshIndex)
+			{
+				UnloadMesh(chunk->mergedMeshes[meshIndex]);
+			}
+			MemFree(chunk->mergedMeshes);
+			if(chunk->lodStripsMesh.vertexCount > 0)
+			{
+				UnloadMesh(chunk->lodStripsMesh);
+			}
+		}
+	}
+	// the arrays are in the session arena
+	g_game.mapTiles = NULL;
+	g_game.mapTileModels = NULL;
+	g_game.mapTileOccupants = NULL;
+	g_game.mapTileRailNodes = NULL;
+	g_game.mapTileRailSegments = NULL;
+	g_game.mapChunks = NULL;
+	g_game.mapChunkSlotByTile = NULL;
+	g_game.mapChunkModelByTile = NULL;
+	g_MapGridSize = 0;
+	g_TileCount = 0;
+	g_MapChunksPerSide = 0;
+	g_MapChunkCount = 0;
+}
+
+// allocates the map storage in the session arena, the size gets clamped and rounded up to full chunks
+static void MapAllocate(int mapGridSize)
+{
+	mapGridSize = mapGridSize < g_MapGridSizeMin ? g_MapGridSizeMin : mapGridSize > g_MapGridSizeMax ? g_MapGridSizeMax : mapGridSize;
+	mapGridSize = ((mapGridSize + g_MapChunkSize - 1) / g_MapChunkSize) * g_MapChunkSize;
+
+	g_MapGridSize = mapGridSize;
+	g_TileCount = mapGridSize * mapGridSize;
+	g_MapChunksPerSide = mapGridSize / g_MapChunkSize;
+	g_MapChunkCount = g_MapChunksPerSide * g_MapChunksPerSide;
+
+	// arena memory is zeroed like MemAlloc's
+	MemoryArena* arena = &g_memory.sessionArena;
+	g_game.mapTiles = MemoryArenaAlloc(arena, g_TileCount * sizeof(TileInfo));
+	g_game.mapTileModels = MemoryArenaAlloc(arena, g_TileCount * sizeof(TileModelInfo));
+	g_game.mapTileOccupants = MemoryArenaAlloc(arena, g_TileCount * sizeof(TrainID));
+	g_game.mapTileRailNodes = MemoryArenaAlloc(arena, g_TileCount * sizeof(int));
+	g_game.mapTileRailSegments = MemoryArenaAlloc(arena, g_TileCount * sizeof(int));
+	g_game.mapChunks = MemoryArenaAlloc(arena, g_MapChunkCount * sizeof(MapChunk));
+	g_game.mapChunkSlotByTile = MemoryArenaAlloc(arena, g_TileCount * sizeof(int));
+	g_game.mapChunkModelByTile = MemoryArenaAlloc(arena, g_TileCount * sizeof(ModelID));
+	TraceLog(LOG_INFO, "===> map allocated: %d x %d tiles, %d chunks", g_MapGridSize, g_MapGridSize, g_MapChunkCount);
+}
+
+static void MapChunksReset(void)
+{
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		float minX = (float) ((chunkIndex % g_MapChunksPerSide) * g_MapChunkSize);
+		float minZ = (float) ((chunkIndex / g_MapChunksPerSide) * g_MapChunkSize);
+		chunk->bounds = (BoundingBox)
+		{
+			.min = (Vector3) {minX, 0, minZ},
+			.max = (Vector3) {minX + (float) g_MapChunkSize, g_MapChunkHeight, minZ + (float) g_MapChunkSize}
+		};
+		for(int modelIndex = 0; modelIndex <= g_RailsModelCount; ++modelIndex)
+		{
+			chunk->modelOffsets[modelIndex] = 0;
+		}
+		chunk->transformsDirty = true;
+		chunk->mergedMeshesDirty = true;
+		chunk->lodStripsMeshDirty = true;
+		chunk->impostorTarget = -1;
+		chunk->impostorDirty = true;
+		chunk->isVisible = true;
+		chunk->lod = MAP_CHUNK_LOD_FULL;
+	}
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		g_game.mapChunkModelByTile[tileIndex] = MODEL_COUNT;
+		g_game.mapChunkSlotByTile[tileIndex] = -1;
+	}
+	// the chunks of the old map owned them
+	for(int target = 0; target < g_MapChunkImpostorPoolSize; ++target)
+	{
+		g_game.mapChunkImpostors.chunkByTarget[target] = -1;
+	}
+}
+
+static inline int MapChunkRailsTileCount(const MapChunk* chunk)
+{
+	return chunk->modelOffsets[g_RailsModelCount];
+}
+
+// fills the tile's slot with the last entry of its group, then moves the hole to the end
+// by shifting each following group one slot to the left (moving its last entry to its front)
+static void MapChunkRemoveTile(MapChunk* chunk, ModelID modelID, int tileIndex)
+{
+	int* offsets = chunk->modelOffsets;
+	int slot = g_game.mapChunkSlotByTile[tileIndex];
+	int lastSlot = offsets[modelID + 1] - 1;
+	chunk->tileIndices[slot] = chunk->tileIndices[lastSlot];
+	g_game.mapChunkSlotByTile[chunk->tileIndices[slot]] = slot;
+
+	for(int group = modelID + 1; group < g_RailsModelCount; ++group)
+	{
+		int first = offsets[group];
+		int last = offsets[group + 1] - 1;
+		if(last >= first)
+		{
+			chunk->tileIndices[first - 1] = chunk->tileIndices[last];
+			g_game.mapChunkSlotByTile[chunk->tileIndices[first - 1]] = first - 1;
+		}
+		offsets[group] = first - 1;
+	}
+	offsets[g_RailsModelCount]--;
+	g_game.mapChunkSlotByTile[tileIndex] = -1;
+}
+
+// opens a slot at the end of the model's group by shifting each following group one slot
+// to the right (moving its first entry behind its last one)
+static void MapChunkInsertTile(MapChunk* chunk, ModelID modelID, int tileIndex)
+{
+	int* offsets = chunk->modelOffsets;
+	for(int group = g_RailsModelCount - 1; group > modelID; --group)
+	{
+		int first = offsets[group];
+		int end = offsets[group + 1];
+		if(end > first)
+		{
+			chunk->tileIndices[end] = chunk->tileIndices[first];
+			g_game.mapChunkSlotByTile[chunk->tileIndices[end]] = end;
+		}
+		offsets[group + 1] = end + 1;
+	}
+	int slot = offsets[modelID + 1];
+	chunk->tileIndices[slot] = tileIndex;
+	g_game.mapChunkSlotByTile[tileIndex] = slot;
+	offsets[modelID + 1]++;
+}
+
+// call after every change of a tile's type, model or rotation
+static void MapChunkSyncTile(int tileIndex)
+{
+	MapChunk* chunk = &g_game.mapChunks[tileIndex / g_MapChunkTileCount];
+	TileInfo tile = g_game.mapTiles[tileIndex];
+	ModelID modelID = TileModelInfoGetModelID(g_game.mapTileModels[tileIndex]);
+	ModelID listedModel = g_game.mapChunkModelByTile[tileIndex];
+	ModelID wantedModel = (tile.type == TILE_TYPE_RAILS && modelID < g_RailsModelCount) ? modelID : MODEL_COUNT;
+
+	// model or rotation changed, either way the transforms, the merged meshes and the LODs are outdated
+	chunk->transformsDirty = true;
+	chunk->mergedMeshesDirty = true;
+	chunk->lodStripsMeshDirty = true;
+	chunk->impostorDirty = true;
+
+	if(listedModel == wantedModel)
+	{
+		return;
+	}
+
+	if(listedModel != MODEL_COUNT)
+	{
+		MapChunkRemoveTile(chunk, listedModel, tileIndex);
+	}
+	if(wantedModel != MODEL_COUNT)
+	{
+		MapChunkInsertTile(chunk, wantedModel, tileIndex);
+	}
+	g_game.mapChunkModelByTile[tileIndex] = wantedModel;
+}
+
+// only the tile itself, the rail graph and the chunk still need an update
+static void TileAddConnectionFlags(int index, ConnectionDirection connection)
 {
-	int index = TileIndexByTileCoords(x, y);
 	g_game.mapTiles[index].type = TILE_TYPE_RAILS;
 
 	int count = TileHConnectionsCount(g_game.mapTiles[index].connectionOptions);
@@ -746,6 +2784,14 @@ static inline void TileAddRailConnection(int x, int y, ConnectionDirection conne
 	}
 }
 
+static inline void TileAddRailConnection(int x, int y, ConnectionDirection connection)
+{
+	int index = TileIndexByTileCoords(x, y);
+	TileAddConnectionFlags(index, connection);
+	RailGraphUpdateTile(x, y);
+	MapChunkSyncTile(index);
+}
+
 // Get the grid tile  coordinates
 static inline TileCoords TileGetCoordsFromWorldPoint(Vector3 position)
 {
@@ -896,193 +2942,65 @@ static inline float DegreesToRadians(float degrees)
 	return degrees * (PI / 180.0f);
 }
 
-static TileSector TileSectorGetExitFromEntryAndConnectionDirection(ConnectionDirection connection, TileSector entry)
+// connection needs to be a single connection flag
+static inline TileSector TileSectorGetExitFromEntryAndConnectionDirection(ConnectionDirection connection, TileSector entry)
 {
-	if(connection == CONNECTION_NS_SN)
-	{
-		return entry == TILE_SECTOR_N ? TILE_SECTOR_S : TILE_SECTOR_N;
-	}
-	else if(connection == CONNECTION_NE_EN)
-	{
-		return entry == TILE_SECTOR_N ? TILE_SECTOR_E : TILE_SECTOR_N;
-	}
-	else if(connection == CONNECTION_NW_WN)
-	{
-		return entry == TILE_SECTOR_N ? TILE_SECTOR_W : TILE_SECTOR_N;
-	}
-	else if(connection == CONNECTION_SW_WS)
-	{
-		return entry == TILE_SECTOR_S ? TILE_SECTOR_W : TILE_SECTOR_S;
-	}
-	else if(connection == CONNECTION_ES_SE)
-	{
-		return entry == TILE_SECTOR_S ? TILE_SECTOR_E : TILE_SECTOR_S;
-	}
-	else if(connection == CONNECTION_EW_WE)
-	{
-		return entry == TILE_SECTOR_E ? TILE_SECTOR_W : TILE_SECTOR_E;
-	}
-
-	// shouldn't happen
-	return TILE_SECTOR_S;
+	return g_connectionExitByEntry[connection][g_tileSectorToEdge[entry]];
 }
 
-static TileSector TileSectorGetNextEntryByExit(TileSector exitSector)
+static inline TileSector TileSectorGetNextEntryByExit(TileSector exitSector)
 {
-	switch (exitSector)
-	{
-		case TILE_SECTOR_S:
-			return TILE_SECTOR_N;
-		case TILE_SECTOR_E:
-			return TILE_SECTOR_W;
-		case TILE_SECTOR_W:
-			return TILE_SECTOR_E;
-		case TILE_SECTOR_N:
-			return TILE_SECTOR_S;
-		default:
-			return TILE_SECTOR_CENTER;
-	}
+	return g_tileEdgeOppositeSector[g_tileSectorToEdge[exitSector]];
 }
 
-static TileCoords TileGetNextFromExitSector(TileCoords tileCoords, TileSector exitSector)
+// stays on the same tile when leaving the map
+static inline TileCoords TileGetNextFromExitSector(TileCoords tileCoords, TileSector exitSector)
 {
-	// todo check bounds
-	TileCoords newCoords = tileCoords;
-	switch (exitSector)
-	{
-		case TILE_SECTOR_S:
-			newCoords.z -= newCoords.z > 0 ? 1 : 0;
-			break;
-		case TILE_SECTOR_E:
-			newCoords.x -= newCoords.z > 0 ? 1 : 0;
-			break;
-		case TILE_SECTOR_W:
-			newCoords.x += newCoords.z < g_MapGridSize ? 1 : 0;
-			break;
-		case TILE_SECTOR_N:
-			newCoords.z += newCoords.z < g_MapGridSize ? 1 : 0;
-			break;
-		default: ; // pass
-	}
-
+	TileCoords offset = g_tileEdgeNeighbourOffset[g_tileSectorToEdge[exitSector]];
+	TileCoords newCoords = (TileCoords) {tileCoords.x + offset.x, tileCoords.z + offset.z};
+	newCoords.x = (newCoords.x < 0) ? 0 : (newCoords.x >= g_MapGridSize) ? g_MapGridSize - 1 : newCoords.x;
+	newCoords.z = (newCoords.z < 0) ? 0 : (newCoords.z >= g_MapGridSize) ? g_MapGridSize - 1 : newCoords.z;
 	return newCoords;
 }
 
-static bool TileHasConnectionForEntry(TileCoords tileCoords, TileSector entrySector)
+static inline bool TileHasConnectionForEntry(TileCoords tileCoords, TileSector entrySector)
 {
 	int index = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
-	TileInfo tile = g_game.mapTiles[index];
-	switch (entrySector)
-	{
-		case TILE_SECTOR_S:
-			return	TileHasConnectionFlag(tile.connectionOptions, CONNECTION_SW_WS) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_ES_SE);
-		case TILE_SECTOR_E:
-			return	TileHasConnectionFlag(tile.connectionOptions, CONNECTION_ES_SE) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NE_EN);
-			break;
-		case TILE_SECTOR_W:
-			return	TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_SW_WS) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NW_WN);
-			break;
-		case TILE_SECTOR_N:
-			return	TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NW_WN) ||
-					TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NE_EN);
-		default:
-			return false;
-	}
+	return (g_game.mapTiles[index].connectionOptions & g_tileEdgeConnections[g_tileSectorToEdge[entrySector]]) != 0;
 }
 
-static void TileUpdateRailsModel(int x, int z)
+// picks the model for the tile's connections, MapChunkSyncTile still needs to follow
+static void TileSetRailsModel(int tileIndex)
 {
-	int tileIndex = TileIndexByTileCoords(x, z);
-	TileInfo tile = g_game.mapTiles[tileIndex];
-	int connectionCount = TileHConnectionsCount(tile.connectionOptions);
-	if(connectionCount == 1)
-	{
-		tile.type = TILE_TYPE_RAILS;
-		if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN))
-		{
-			tile.modelID = MODEL_RAILS_STRAIGHT;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE))
-		{
-			tile.modelID = MODEL_RAILS_STRAIGHT;
-			tile.modelRotationInDegree = 90;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_ES_SE))
-		{
-			tile.modelID = MODEL_RAILS_CURVE;
-			tile.modelRotationInDegree = 0;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NE_EN))
-		{
-			tile.modelID = MODEL_RAILS_CURVE;
-			tile.modelRotationInDegree = 90;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NW_WN))
-		{
-			tile.modelID = MODEL_RAILS_CURVE;
-			tile.modelRotationInDegree = 180;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_SW_WS))
-		{
-			tile.modelID = MODEL_RAILS_CURVE;
-			tile.modelRotationInDegree = 270;
-		}
-		// todo
-	}
-	else if(connectionCount == 2)
+	ConnectionsConfig connections = g_game.mapTiles[tileIndex].connectionOptions;
+	int connectionCount = TileHConnectionsCount(connections);
+	if(connectionCount == 1 || connectionCount == 2)
 	{
-		tile.type = TILE_TYPE_RAILS;
-		if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE))
-		{
-			tile.modelID = MODEL_RAILS_CROSS;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_ES_SE))
-		{
-			tile.modelID = MODEL_RAILS_MERGE;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NE_EN))
-		{
-			tile.modelID = MODEL_RAILS_MERGE_MIRROR;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NW_WN))
-		{
-			tile.modelID = MODEL_RAILS_MERGE;
-			tile.modelRotationInDegree = 180;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_SW_WS))
-		{
-			tile.modelID = MODEL_RAILS_MERGE_MIRROR;
-			tile.modelRotationInDegree = 180;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_SW_WS))
-		{
-			tile.modelID = MODEL_RAILS_MERGE;
-			tile.modelRotationInDegree = 270;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NW_WN))
-		{
-			tile.modelID = MODEL_RAILS_MERGE_MIRROR;
-			tile.modelRotationInDegree = 90;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NE_EN))
+		g_game.mapTiles[tileIndex].type = TILE_TYPE_RAILS;
+		TileRailsModelEntry entry = g_connectionsRailsModelTable[connections & 0x3F];
+		if(entry.hasModel)
 		{
-			tile.modelID = MODEL_RAILS_MERGE;
-			tile.modelRotationInDegree = 90;
-		}
-		else if(TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE) && TileHasConnectionFlag(tile.connectionOptions, CONNECTION_ES_SE))
-		{
-			tile.modelID = MODEL_RAILS_MERGE_MIRROR;
-			tile.modelRotationInDegree = 270;
+			g_game.mapTileModels[tileIndex] = TileModelInfoPack(entry.modelID, entry.quarterTurns);
 		}
 	}
-	g_game.mapTiles[tileIndex] = tile;
+}
+
+static void TileUpdateRailsModel(int x, int z)
+{
+	int tileIndex = TileIndexByTileCoords(x, z);
+	TileSetRailsModel(tileIndex);
+	MapChunkSyncTile(tileIndex);
+}
+
+static void TileClearRails(int x, int z)
+{
+	int tileIndex = TileIndexByTileCoords(x, z);
+	g_game.mapTiles[tileIndex].type = TILE_TYPE_EMPTY;
+	g_game.mapTiles[tileIndex].connectionOptions = 0; // none
+	g_game.mapTiles[tileIndex].connectionsActive = 0;
+	g_game.mapTileModels[tileIndex] = TileModelInfoPack(MODEL_RAILS_STRAIGHT, 0);
+	MapChunkSyncTile(tileIndex);
+	RailGraphUpdateTile(x, z);
 }
 
 inline static void TileAddConnectionAndUpdateRailsModel(int x, int z, ConnectionDirection direction)
@@ -1091,116 +3009,156 @@ inline static void TileAddConnectionAndUpdateRailsModel(int x, int z, Connection
 	TileUpdateRailsModel(x, z);
 }
 
-void SectorTrailBakeConnection()
+// the connection painted by the sectors a stroke crossed within one tile, 0 for none
+static ConnectionDirection SectorTrailGetConnection(const TileSectorTrail* trail, int length)
 {
-	if(g_game.brushSectorTrailLength < 2)
+	// todo get tile info, is there already something build?
+	if(length != 3)
 	{
-		return;
+		return 0; // todo
 	}
 
-	TileCoords tileCoord = g_game.brushSectorTrail[0].coords;
-	// todo get tile info, is there already something build?
+	TileSector first = trail[0].sector;
+	TileSector last = trail[length - 1].sector;
 
-	if(g_game.brushSectorTrailLength == 2)
+	if
+	(
+		// Straight NS / SN
+		(first == TILE_SECTOR_N && last == TILE_SECTOR_S) ||
+		(first == TILE_SECTOR_S && last == TILE_SECTOR_N) ||
+		(first == TILE_SECTOR_SW && last == TILE_SECTOR_NW) ||
+		(first == TILE_SECTOR_NE && last == TILE_SECTOR_SE)
+	)
+	{
+		return CONNECTION_NS_SN;
+	}
+	else if
+	(
+		// Straight EW / WE
+		(first == TILE_SECTOR_W && last == TILE_SECTOR_E) ||
+		(first == TILE_SECTOR_E && last == TILE_SECTOR_W) ||
+		(first == TILE_SECTOR_SE && last == TILE_SECTOR_SW) ||
+		(first == TILE_SECTOR_NE && last == TILE_SECTOR_NW)
+	)
+	{
+		return CONNECTION_EW_WE;
+	}
+	else if
+	(
+		// Curve SE / ES
+		(first == TILE_SECTOR_S && last == TILE_SECTOR_E) ||
+		(first == TILE_SECTOR_E && last == TILE_SECTOR_S)
+	)
+	{
+		return CONNECTION_ES_SE;
+	}
+	else if
+	(
+		// Curve SW / WS
+		(first == TILE_SECTOR_S && last == TILE_SECTOR_W) ||
+		(first == TILE_SECTOR_W && last == TILE_SECTOR_S)
+	)
 	{
-		// todo
+		return CONNECTION_SW_WS;
 	}
-	else if(g_game.brushSectorTrailLength == 3)
+	else if
+	(
+		// Curve NW / WN
+		(first == TILE_SECTOR_N && last == TILE_SECTOR_W) ||
+		(first == TILE_SECTOR_W && last == TILE_SECTOR_N)
+	)
+	{
+		return CONNECTION_NW_WN;
+	}
+	else if
+	(
+		// Curve NE / EN
+		(first == TILE_SECTOR_N && last == TILE_SECTOR_E) ||
+		(first == TILE_SECTOR_E && last == TILE_SECTOR_N)
+	)
 	{
-		TileSector first = g_game.brushSectorTrail[0].sector;
-		TileSector last = g_game.brushSectorTrail[g_game.brushSectorTrailLength -1].sector;
+		return CONNECTION_NE_EN;
+	}
+	// todo ----------------- ----------------- ----------------- ----------------- ----------------- -----------------
+	return 0;
+}
 
-		if
-		(
-			// Straight NS / SN
-			(first == TILE_SECTOR_N && last == TILE_SECTOR_S) ||
-			(first == TILE_SECTOR_S && last == TILE_SECTOR_N) ||
-			(first == TILE_SECTOR_SW && last == TILE_SECTOR_NW) ||
-			(first == TILE_SECTOR_NE && last == TILE_SECTOR_SE)
-		)
-		{
-			TileAddRailConnection(tileCoord.x, tileCoord.z, CONNECTION_NS_SN);
-		}
-		else if
-		(
-			// Straight EW / WE
-			(first == TILE_SECTOR_W && last == TILE_SECTOR_E) ||
-			(first == TILE_SECTOR_E && last == TILE_SECTOR_W) ||
-			(first == TILE_SECTOR_SE && last == TILE_SECTOR_SW) ||
-			(first == TILE_SECTOR_NE && last == TILE_SECTOR_NW)
-		)
-		{
-			TileAddRailConnection(tileCoord.x, tileCoord.z, CONNECTION_EW_WE);
-		}
-		else if
-		(
-			// Curve SE / ES
-			(first == TILE_SECTOR_S && last == TILE_SECTOR_E) ||
-			(first == TILE_SECTOR_E && last == TILE_SECTOR_S)
-		)
-		{
-			TileAddRailConnection(tileCoord.x, tileCoord.z, CONNECTION_ES_SE);
-		}
-		else if
-		(
-			// Curve SW / WS
-			(first == TILE_SECTOR_S && last == TILE_SECTOR_W) ||
-			(first == TILE_SECTOR_W && last == TILE_SECTOR_S)
-		)
+// turns the trail into one connection edit per tile run and applies them together, the rail graph and the
+// chunks are updated once for all tiles instead of once per tile. keepLastTile leaves the run of the tile
+// being painted in the trail, for strokes committed in parts
+static void BrushStrokeCommit(bool keepLastTile)
+{
+	TileSectorTrail* trail = g_game.brushSectorTrail;
+	int length = g_game.brushSectorTrailLength;
+	int commitLength = length;
+	while(keepLastTile && commitLength > 0 && TileCoordsAreEqual(trail[commitLength - 1].coords, trail[length - 1].coords))
+	{
+		commitLength--;
+	}
+
+	int* tileIndices = MemoryArenaAlloc(&g_memory.frameArena, (commitLength + 1) * sizeof(int));
+	int tileCount = 0;
+	for(int runStart = 0; runStart < commitLength;)
+	{
+		int runEnd = runStart + 1;
+		while(runEnd < commitLength && TileCoordsAreEqual(trail[runEnd].coords, trail[runStart].coords))
 		{
-			TileAddRailConnection(tileCoord.x, tileCoord.z, CONNECTION_SW_WS);
+			runEnd++;
 		}
-		else if
-		(
-			// Curve NW / WN
-			(first == TILE_SECTOR_N && last == TILE_SECTOR_W) ||
-			(first == TILE_SECTOR_W && last == TILE_SECTOR_N)
-		)
+		ConnectionDirection connection = SectorTrailGetConnection(&trail[runStart], runEnd - runStart);
+		if(connection != 0)
 		{
-			TileAddRailConnection(tileCoord.x, tileCoord.z, CONNECTION_NW_WN);
+			int tileIndex = TileIndexByTileCoords(trail[runStart].coords.x, trail[runStart].coords.z);
+			TileAddConnectionFlags(tileIndex, connection);
+			TileSetRailsModel(tileIndex);
+			bool isListed = false;
+			for(int i = 0; i < tileCount && !isListed; ++i)
+			{
+				isListed = tileIndices[i] == tileIndex;
+			}
+			if(!isListed)
+			{
+				tileIndices[tileCount++] = tileIndex;
+			}
 		}
-		else if
-		(
-			// Curve NE / EN
-			(first == TILE_SECTOR_N && last == TILE_SECTOR_E) ||
-			(first == TILE_SECTOR_E && last == TILE_SECTOR_N)
-		)
+		runStart = runEnd;
+	}
+
+	if(tileCount > 0)
+	{
+		RailGraphUpdateTiles(tileIndices, tileCount);
+		for(int i = 0; i < tileCount; ++i)
 		{
-			TileAddRailConnection(tileCoord.x, tileCoord.z, CONNECTION_NE_EN);
+			MapChunkSyncTile(tileIndices[i]);
 		}
-		// todo ----------------- ----------------- ----------------- ----------------- ----------------- -----------------
 	}
-	TileUpdateRailsModel(tileCoord.x, tileCoord.z);
+	memmove(trail, trail + commitLength, (length - commitLength) * sizeof(TileSectorTrail));
+	g_game.brushSectorTrailLength = length - commitLength;
 }
 
 void SectorTrailPaintAt(TileCoords coords, TileSector sector)
 {
 	// ignore if it's the same as we registered last time
-	if(g_game.brushSectorTrailLength > 0 )
+	if(g_game.brushSectorTrailLength > 0)
 	{
-		int previousIndex = g_game.brushSectorTrailLength - 1;
-		TileCoords previousCoords = g_game.brushSectorTrail[previousIndex].coords;
-		bool tileIsTheSame = TileCoordsAreEqual(previousCoords, coords);
-		if(tileIsTheSame)
+		const TileSectorTrail* previous = &g_game.brushSectorTrail[g_game.brushSectorTrailLength - 1];
+		if(TileCoordsAreEqual(previous->coords, coords) && previous->sector == sector)
 		{
-			if(g_game.brushSectorTrail[previousIndex].sector == sector)
-			{
-				// ignore if it's the same sector
-				return;
-			}
+			return;
 		}
-		else
-		{
-			// we moved into the next tile
-			// create trail todo
-			SectorTrailBakeConnection();
+	}
 
-			// reset sector trail
-			g_game.brushSectorTrailLength = 0;
+	// the stroke so far gets committed when the trail is full, a trail going back and forth inside one tile
+	// could still run out of space
+	if(g_game.brushSectorTrailLength >= g_BrushSectorTrailMax)
+	{
+		SimPipelineWait(); // the commit changes the rails, see GameCommandSubmit
+		BrushStrokeCommit(true);
+		if(g_game.brushSectorTrailLength >= g_BrushSectorTrailMax)
+		{
+			return;
 		}
 	}
-
-	// add sector to trail
 	int index = g_game.brushSectorTrailLength;
 	g_game.brushSectorTrail[index].coords = coords;
 	g_game.brushSectorTrail[index].sector = sector;
@@ -1224,307 +3182,4252 @@ static inline RayCollision MapMouseRaycast()
 	return rayCollision;
 }
 
+// once per frame after the camera moved, everything else reads g_game.hoveredTile
+static void MapUpdateHoveredTile(void)
+{
+	RayCollision rayCollision = MapMouseRaycast();
+	HoveredTile* hovered = &g_game.hoveredTile;
+	hovered->isHit = rayCollision.hit;
+	if(rayCollision.hit)
+	{
+		hovered->point = rayCollision.point;
+		hovered->coords = TileGetCoordsFromWorldPoint(rayCollision.point);
+		hovered->tileIndex = TileIndexByTileCoords(hovered->coords.x, hovered->coords.z);
+		hovered->sector = TileSectorGetFromWorldPoint(rayCollision.point);
+	}
+}
+
+#if defined(SIM_MULTITHREADED)
 //----------------------------------------------------------------------------------------------------------------------
-// Debug
+// Job system
 //----------------------------------------------------------------------------------------------------------------------
-
-void RenderDebugWindow()
+static void JobRunBatches(JobSystem* jobs)
 {
-	if(IsKeyPressed(g_debugWindowKey))
+	for(;;)
 	{
-		g_debugWindowOn = !g_debugWindowOn;
+		int begin = __atomic_fetch_add(&jobs->nextItem, jobs->batchSize, __ATOMIC_RELAXED);
+		if(begin >= jobs->itemCount)
+		{
+			return;
+		}
+		int end = (begin + jobs->batchSize < jobs->itemCount) ? begin + jobs->batchSize : jobs->itemCount;
+		jobs->function(begin, end, jobs->userData);
 	}
+}
 
-	if(g_debugWindowOn)
+static void* JobWorkerMain(void* argument)
+{
+	JobSystem* jobs = (JobSystem*) argument;
+	unsigned int seenGeneration = 0;
+
+	pthread_mutex_lock(&jobs->mutex);
+	for(;;)
 	{
-		// sim pause button
-		if(GuiButton((Rectangle) {15, (float) g_ScreenHeight - 65, 80, 50}, "Pause Sim"))
+		while(jobs->jobGeneration == seenGeneration && !jobs->isShuttingDown)
 		{
-			g_debugSimPauseOn = !g_debugSimPauseOn;
+			pthread_cond_wait(&jobs->jobStarted, &jobs->mutex);
+		}
+		if(jobs->isShuttingDown)
+		{
+			break;
 		}
+		seenGeneration = jobs->jobGeneration;
+		pthread_mutex_unlock(&jobs->mutex);
 
-		// debug panel
-		float lineHeight = 20;
-		Rectangle rect = (Rectangle) {16, 80, 180, 500};
+		JobRunBatches(jobs);
+
+		pthread_mutex_lock(&jobs->mutex);
+		jobs->workersBusy--;
+		if(jobs->workersBusy == 0)
+		{
+			pthread_cond_signal(&jobs->jobFinished);
+		}
+	}
+	pthread_mutex_unlock(&jobs->mutex);
+	return NULL;
+}
+
+// workerCount < 0 picks one worker per additional core
+void JobSystemStart(int workerCount)
+{
+	JobSystem* jobs = &g_jobSystem;
+	if(workerCount < 0)
+	{
+		#if defined(PLATFORM_WEB)
+			workerCount = emscripten_num_logical_cores() - 1;
+		#else
+			workerCount = (int) sysconf(_SC_NPROCESSORS_ONLN) - 1;
+		#endif
+	}
+	workerCount = (workerCount < 0) ? 0 : (workerCount > g_JobWorkerCountMax) ? g_JobWorkerCountMax : workerCount;
+
+	pthread_mutex_init(&jobs->mutex, NULL);
+	pthread_cond_init(&jobs->jobStarted, NULL);
+	pthread_cond_init(&jobs->jobFinished, NULL);
+	jobs->jobGeneration = 0;
+	jobs->workersBusy = 0;
+	jobs->isShuttingDown = false;
+	jobs->workerCount = 0;
+	for(int i = 0; i < workerCount; i++)
+	{
+		if(pthread_create(&jobs->workers[i], NULL, JobWorkerMain, jobs) != 0)
+		{
+			TraceLog(LOG_WARNING, "===> job system: could only start %d of %d workers", i, workerCount);
+			break;
+		}
+		jobs->workerCount++;
+	}
+	TraceLog(LOG_INFO, "===> job system: %d workers", jobs->workerCount);
+}
+
+void JobSystemStop(void)
+{
+	JobSystem* jobs = &g_jobSystem;
+	pthread_mutex_lock(&jobs->mutex);
+	jobs->isShuttingDown = true;
+	pthread_cond_broadcast(&jobs->jobStarted);
+	pthread_mutex_unlock(&jobs->mutex);
+
+	for(int i = 0; i < jobs->workerCount; i++)
+	{
+		pthread_join(jobs->workers[i], NULL);
+	}
+	jobs->workerCount = 0;
+	pthread_cond_destroy(&jobs->jobFinished);
+	pthread_cond_destroy(&jobs->jobStarted);
+	pthread_mutex_destroy(&jobs->mutex);
+}
+
+// splits [0, itemCount) into batches run by the workers and the calling thread, returns when all are done
+void JobParallelFor(JobRangeFunction function, int itemCount, int batchSize, void* userData)
+{
+	JobSystem* jobs = &g_jobSystem;
+	if(jobs->workerCount == 0 || itemCount <= batchSize)
+	{
+		function(0, itemCount, userData);
+		return;
+	}
+
+	pthread_mutex_lock(&jobs->mutex);
+	jobs->function = function;
+	jobs->userData = userData;
+	jobs->itemCount = itemCount;
+	jobs->batchSize = batchSize;
+	jobs->nextItem = 0;
+	jobs->workersBusy = jobs->workerCount;
+	jobs->jobGeneration++;
+	pthread_cond_broadcast(&jobs->jobStarted);
+	pthread_mutex_unlock(&jobs->mutex);
+
+	JobRunBatches(jobs);
+
+	pthread_mutex_lock(&jobs->mutex);
+	while(jobs->workersBusy > 0)
+	{
+		pthread_cond_wait(&jobs->jobFinished, &jobs->mutex);
+	}
+	pthread_mutex_unlock(&jobs->mutex);
+}
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+// Tile occupancy
+//----------------------------------------------------------------------------------------------------------------------
+// every tile has a doubly linked list of the trains on it, the links are stored by train id in the pool
+static void TileOccupancyInsert(TrainID trainID, int tileIndex)
+{
+	TrainPool* pool = &g_game.trains;
+	TrainID firstOccupant = g_game.mapTileOccupants[tileIndex];
+	pool->occupiedTileById[trainID] = tileIndex;
+	pool->previousOccupantById[trainID] = g_TrainIDNone;
+	pool->nextOccupantById[trainID] = firstOccupant;
+	if(firstOccupant != g_TrainIDNone)
+	{
+		pool->previousOccupantById[firstOccupant] = trainID;
+	}
+	g_game.mapTileOccupants[tileIndex] = trainID;
+}
+
+static void TileOccupancyRemove(TrainID trainID)
+{
+	TrainPool* pool = &g_game.trains;
+	TrainID previousOccupant = pool->previousOccupantById[trainID];
+	TrainID nextOccupant = pool->nextOccupantById[trainID];
+	if(previousOccupant != g_TrainIDNone)
+	{
+		pool->nextOccupantById[previousOccupant] = nextOccupant;
+	}
+	else
+	{
+		g_game.mapTileOccupants[pool->occupiedTileById[trainID]] = nextOccupant;
+	}
+	if(nextOccupant != g_TrainIDNone)
+	{
+		pool->previousOccupantById[nextOccupant] = previousOccupant;
+	}
+	pool->occupiedTileById[trainID] = -1;
+}
+
+static void TileOccupancyUpdateTrain(int slot)
+{
+	TrainPool* pool = &g_game.trains;
+	TrainID trainID = pool->idBySlot[slot];
+	TileCoords tileCoords = pool->routes[slot].tileCurrent;
+	int tileIndex = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
+	if(pool->occupiedTileById[trainID] != tileIndex)
+	{
+		TileOccupancyRemove(trainID);
+		TileOccupancyInsert(trainID, tileIndex);
+	}
+}
+
+// the train tick only moves trains along their own route, this moves them in the shared index afterwards.
+// Runs on one thread in slot order, so the occupant order of a tile is the same on every run
+static void TileOccupancyResolve(void)
+{
+	for(int slot = 0; slot < g_game.trains.count; ++slot)
+	{
+		TileOccupancyUpdateTrain(slot);
+	}
+}
+
+// iterate the trains on a tile: for(id = TileGetFirstOccupant(i); id != g_TrainIDNone; id = TrainGetNextOccupant(id))
+static inline TrainID TileGetFirstOccupant(int tileIndex)
+{
+	return g_game.mapTileOccupants[tileIndex];
+}
+
+static inline TrainID TrainGetNextOccupant(TrainID trainID)
+{
+	return g_game.trains.nextOccupantById[trainID];
+}
+
+static inline bool TileIsOccupied(int tileIndex)
+{
+	return g_game.mapTileOccupants[tileIndex] != g_TrainIDNone;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Train pool
+//----------------------------------------------------------------------------------------------------------------------
+static void TrainPoolFree(void)
+{
+	TrainPool* pool = &g_game.trains;
+	MemFree(pool->states);
+	MemFree(pool->pathProgressNormalized);
+	MemFree(pool->speedDrive);
+	MemFree(pool->routes);
+	MemFree(pool->renderInfos);
+	MemFree(pool->cargoInfos);
+	MemFree(pool->idBySlot);
+	MemFree(pool->slotById);
+	MemFree(pool->freeIds);
+	MemFree(pool->occupiedTileById);
+	MemFree(pool->nextOccupantById);
+	MemFree(pool->previousOccupantById);
+	MemFree(pool->requestedBlocks);
+	MemFree(pool->reservedBlockById);
+	MemFree(pool->waitingBlockById);
+	MemFree(pool->nextWaitingById);
+	MemFree(pool->progressStarts);
+	MemFree(pool->events);
+	MemFree(pool->eventTickById);
+	MemFree(pool->dueSlots);
+	*pool = (TrainPool) {0};
+}
+
+static void TrainPoolReserve(int capacity)
+{
+	TrainPool* pool = &g_game.trains;
+	if(capacity <= pool->capacity)
+	{
+		return;
+	}
+
+	pool->states = MemRealloc(pool->states, capacity * sizeof(TrainState));
+	pool->pathProgressNormalized = MemRealloc(pool->pathProgressNormalized, capacity * sizeof(float));
+	pool->speedDrive = MemRealloc(pool->speedDrive, capacity * sizeof(float));
+	pool->routes = MemRealloc(pool->routes, capacity * sizeof(TrainRoute));
+	pool->renderInfos = MemRealloc(pool->renderInfos, capacity * sizeof(TrainRenderInfo));
+	pool->cargoInfos = MemRealloc(pool->cargoInfos, capacity * sizeof(TrainCargoInfo));
+	pool->idBySlot = MemRealloc(pool->idBySlot, capacity * sizeof(TrainID));
+	pool->slotById = MemRealloc(pool->slotById, capacity * sizeof(int));
+	pool->freeIds = MemRealloc(pool->freeIds, capacity * sizeof(TrainID));
+	pool->occupiedTileById = MemRealloc(pool->occupiedTileById, capacity * sizeof(int));
+	pool->nextOccupantById = MemRealloc(pool->nextOccupantById, capacity * sizeof(TrainID));
+	pool->previousOccupantById = MemRealloc(pool->previousOccupantById, capacity * sizeof(TrainID));
+	pool->requestedBlocks = MemRealloc(pool->requestedBlocks, capacity * sizeof(int));
+	pool->reservedBlockById = MemRealloc(pool->reservedBlockById, capacity * sizeof(int));
+	pool->waitingBlockById = MemRealloc(pool->waitingBlockById, capacity * sizeof(int));
+	pool->nextWaitingById = MemRealloc(pool->nextWaitingById, capacity * sizeof(TrainID));
+	pool->progressStarts = MemRealloc(pool->progressStarts, capacity * sizeof(TrainProgressStart));
+	pool->eventTickById = MemRealloc(pool->eventTickById, capacity * sizeof(uint64_t));
+	pool->dueSlots = MemRealloc(pool->dueSlots, capacity * sizeof(int));
+	pool->capacity = capacity;
+}
+
+// despawns all trains, keeps the memory
+static void TrainPoolReset(void)
+{
+	TrainPoolReserve(g_TrainPoolInitialCapacity);
+	g_game.trains.count = 0;
+	g_game.trains.freeIdCount = 0;
+	g_game.trains.idCount = 0;
+	g_game.trains.waitingCount = 0;
+	g_game.trains.reservationsAreDirty = true;
+	g_game.trains.tickCount = 0;
+	g_game.trains.tickDuration = 0;
+	g_game.trains.eventCount = 0;
+	g_game.trainInstances.isDirty = true;
+}
+
+static inline int TrainGetSlot(TrainID trainID)
+{
+	return g_game.trains.slotById[trainID];
+}
+
+static TrainID TrainSpawn(TrainInfo info)
+{
+	TrainPool* pool = &g_game.trains;
+	if(pool->count == pool->capacity)
+	{
+		TrainPoolReserve(pool->capacity * 2);
+	}
+
+	TrainID trainID = pool->freeIdCount > 0 ? pool->freeIds[--pool->freeIdCount] : pool->idCount++;
+	int slot = pool->count++;
+	pool->idBySlot[slot] = trainID;
+	pool->slotById[trainID] = slot;
+
+	pool->states[slot] = info.state;
+	pool->pathProgressNormalized[slot] = info.pathProgressNormalized;
+	pool->speedDrive[slot] = info.speedDrive;
+	pool->routes[slot] = (TrainRoute)
+	{
+		.tileCurrent = info.tileCurrent,
+		.tilePrevious = info.tilePrevious,
+		.tileNext = info.tileNext,
+		.tileConnectionUsed = info.tileConnectionUsed,
+		.driveFromSector = info.driveFromSector,
+		.driveToSector = info.driveToSector,
+	};
+	TrainRouteUpdateCurve(&pool->routes[slot]);
+	pool->renderInfos[slot] = (TrainRenderInfo)
+	{
+		.modelID = info.modelID,
+		.modelRotationInDegree = info.modelRotationInDegree,
+		.modelPosition = info.modelPosition,
+		.previousModelRotationInDegree = info.modelRotationInDegree,
+		.previousModelPosition = info.modelPosition,
+	};
+	pool->cargoInfos[slot].speedUnload = info.speedUnload;
+	pool->cargoInfos[slot].speedLoad = info.speedLoad;
+	TileOccupancyInsert(trainID, TileIndexByTileCoords(info.tileCurrent.x, info.tileCurrent.z));
+	pool->requestedBlocks[slot] = -1;
+	pool->reservedBlockById[trainID] = -1;
+	pool->waitingBlockById[trainID] = -1;
+	// before the seating, a train that has to wait gets materialized from its progress start
+	TrainSetProgressStart(slot, pool->tickCount);
+	pool->eventTickById[trainID] = g_TrainEventNone;
+	BlockSeatTrain(trainID);
+	TrainEventSchedule(slot);
+	g_game.trainInstances.isDirty = true;
+
+	return trainID;
+}
+
+// swap-remove, the last train takes over the slot
+static void TrainDespawn(TrainID trainID)
+{
+	TrainPool* pool = &g_game.trains;
+	int slot = pool->slotById[trainID];
+	int lastSlot = pool->count - 1;
+	TileOccupancyRemove(trainID);
+	BlockRemoveTrain(trainID);
+
+	pool->states[slot] = pool->states[lastSlot];
+	pool->pathProgressNormalized[slot] = pool->pathProgressNormalized[lastSlot];
+	pool->speedDrive[slot] = pool->speedDrive[lastSlot];
+	pool->routes[slot] = pool->routes[lastSlot];
+	pool->renderInfos[slot] = pool->renderInfos[lastSlot];
+	pool->progressStarts[slot] = pool->progressStarts[lastSlot];
+	pool->cargoInfos[slot] = pool->cargoInfos[lastSlot];
+	pool->requestedBlocks[slot] = pool->requestedBlocks[lastSlot];
+	pool->idBySlot[slot] = pool->idBySlot[lastSlot];
+	pool->slotById[pool->idBySlot[slot]] = slot;
+
+	pool->slotById[trainID] = -1;
+	pool->eventTickById[trainID] = g_TrainEventNone;
+	pool->freeIds[pool->freeIdCount++] = trainID;
+	pool->count--;
+	g_game.trainInstances.isDirty = true;
+}
+
+// transform between the previous and the current simulation tick, rotation takes the shorter way around
+static inline void TrainGetInterpolatedTransform(const TrainRenderInfo* renderInfo, float alpha, Vector3* position, float* rotationInDegree)
+{
+	*position = Vector3Lerp(renderInfo->previousModelPosition, renderInfo->modelPosition, alpha);
+	float rotationDelta = fmodf(renderInfo->modelRotationInDegree - renderInfo->previousModelRotationInDegree + 540.0f, 360.0f) - 180.0f;
+	*rotationInDegree = renderInfo->previousModelRotationInDegree + rotationDelta * alpha;
+}
+
+// the one progress formula, ticking and lazy evaluation must round the same way
+static inline float TrainGetProgressAtTick(int slot, uint64_t tick)
+{
+	const TrainPool* pool = &g_game.trains;
+	const TrainProgressStart* start = &pool->progressStarts[slot];
+	return start->progress + pool->speedDrive[slot] * pool->tickDuration * (float) (tick - start->tick);
+}
+
+// progress starts over on spawn, on tile transitions and when a stopped train drives on
+static void TrainSetProgressStart(int slot, uint64_t tick)
+{
+	TrainPool* pool = &g_game.trains;
+	pool->progressStarts[slot] = (TrainProgressStart)
+	{
+		.tick = tick,
+		.progress = pool->pathProgressNormalized[slot],
+		.modelRotationInDegree = pool->renderInfos[slot].modelRotationInDegree,
+		.modelPosition = pool->renderInfos[slot].modelPosition,
+	};
+}
+
+// transform of a driving train at a tick since its progress start, on the tile it is on now
+static void TrainGetTransformAtTick(int slot, uint64_t tick, Vector3* position, float* rotationInDegree)
+{
+	const TrainProgressStart* start = &g_game.trains.progressStarts[slot];
+	if(tick == start->tick)
+	{
+		*position = start->modelPosition;
+		*rotationInDegree = start->modelRotationInDegree;
+		return;
+	}
+	float progress = Clamp(TrainGetProgressAtTick(slot, tick), 0.0f, 1.0f);
+	TrainRouteSampleCurve(&g_game.trains.routes[slot], progress, position, rotationInDegree);
+}
+
+// the last two tick transforms, with event stepping evaluated here for trains that drove on without being stepped
+static TrainRenderInfo TrainGetRenderInfo(int slot)
+{
+	const TrainPool* pool = &g_game.trains;
+	TrainRenderInfo renderInfo = pool->renderInfos[slot];
+	if(g_simEventSteppingOn && pool->states[slot] == TRAIN_STATE_DRIVING && pool->progressStarts[slot].tick < pool->tickCount)
+	{
+		TrainGetTransformAtTick(slot, pool->tickCount - 1, &renderInfo.previousModelPosition, &renderInfo.previousModelRotationInDegree);
+		TrainGetTransformAtTick(slot, pool->tickCount, &renderInfo.modelPosition, &renderInfo.modelRotationInDegree);
+	}
+	return renderInfo;
+}
+
+// writes progress and transforms of the current tick back, so the pool reads as if every train got stepped
+static void TrainMaterialize(int slot)
+{
+	TrainPool* pool = &g_game.trains;
+	if(g_simEventSteppingOn && pool->states[slot] == TRAIN_STATE_DRIVING)
+	{
+		pool->renderInfos[slot] = TrainGetRenderInfo(slot);
+		pool->pathProgressNormalized[slot] = TrainGetProgressAtTick(slot, pool->tickCount);
+	}
+}
+
+// first tick after the current one with the progress past the tile end, found by the formula the tick uses
+static uint64_t TrainGetTransitionTick(int slot)
+{
+	const TrainPool* pool = &g_game.trains;
+	const TrainProgressStart* start = &pool->progressStarts[slot];
+	float step = pool->speedDrive[slot] * pool->tickDuration;
+	if(!(step > 0.0f))
+	{
+		return g_TrainEventNone;
+	}
+	double estimate = ceil((1.0 - (double) start->progress) / (double) step);
+	if(estimate > 1e12)
+	{
+		return g_TrainEventNone;
+	}
+	uint64_t first = pool->tickCount + 1;
+	uint64_t tick = start->tick + (uint64_t) fmax(estimate, 0.0);
+	tick = tick < first ? first : tick;
+	// the estimate can be off by rounding, the formula decides
+	while(TrainGetProgressAtTick(slot, tick) < 1.0f)
+	{
+		tick++;
+	}
+	while(tick > first && TrainGetProgressAtTick(slot, tick - 1) >= 1.0f)
+	{
+		tick--;
+	}
+	return tick;
+}
+
+static void TrainEventHeapPush(TrainEvent event)
+{
+	TrainPool* pool = &g_game.trains;
+	if(pool->eventCount == pool->eventCapacity)
+	{
+		pool->eventCapacity = pool->eventCapacity > 0 ? pool->eventCapacity * 2 : pool->capacity;
+		pool->events = MemRealloc(pool->events, pool->eventCapacity * sizeof(TrainEvent));
+	}
+	int index = pool->eventCount++;
+	while(index > 0 && pool->events[(index - 1) / 2].tick > event.tick)
+	{
+		pool->events[index] = pool->events[(index - 1) / 2];
+		index = (index - 1) / 2;
+	}
+	pool->events[index] = event;
+}
+
+static TrainEvent TrainEventHeapPop(void)
+{
+	TrainPool* pool = &g_game.trains;
+	TrainEvent top = pool->events[0];
+	TrainEvent last = pool->events[--pool->eventCount];
+	int index = 0;
+	for(;;)
+	{
+		int child = index * 2 + 1;
+		if(child >= pool->eventCount)
+		{
+			break;
+		}
+		if(child + 1 < pool->eventCount && pool->events[child + 1].tick < pool->events[child].tick)
+		{
+			child++;
+		}
+		if(last.tick <= pool->events[child].tick)
+		{
+			break;
+		}
+		pool->events[index] = pool->events[child];
+		index = child;
+	}
+	if(pool->eventCount > 0)
+	{
+		pool->events[index] = last;
+	}
+	return top;
+}
+
+// from the trains alone, also gets rid of the stale entries
+static void TrainEventsRebuild(void)
+{
+	TrainPool* pool = &g_game.trains;
+	pool->eventCount = 0;
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		pool->eventTickById[pool->idBySlot[slot]] = g_TrainEventNone;
+	}
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		TrainEventSchedule(slot);
+	}
+}
+
+// after anything that changes when a driving train leaves its tile
+static void TrainEventSchedule(int slot)
+{
+	TrainPool* pool = &g_game.trains;
+	if(!g_simEventSteppingOn || pool->states[slot] != TRAIN_STATE_DRIVING)
+	{
+		return;
+	}
+	TrainID trainID = pool->idBySlot[slot];
+	uint64_t tick = TrainGetTransitionTick(slot);
+	if(tick == pool->eventTickById[trainID])
+	{
+		return;
+	}
+	pool->eventTickById[trainID] = tick;
+	if(tick == g_TrainEventNone)
+	{
+		return;
+	}
+	if(pool->eventCount == pool->eventCapacity && pool->eventCount >= 2 * pool->count)
+	{
+		TrainEventsRebuild(); // mostly stale, schedules this train as well
+		return;
+	}
+	TrainEventHeapPush((TrainEvent) {tick, trainID});
+}
+
+// a stopped train drives on from where it stands
+static void TrainResume(int slot)
+{
+	TrainPool* pool = &g_game.trains;
+	pool->states[slot] = TRAIN_STATE_DRIVING;
+	TrainSetProgressStart(slot, pool->tickCount);
+	TrainEventSchedule(slot);
+}
+
+static void SimSetEventStepping(bool isOn)
+{
+	if(isOn == g_simEventSteppingOn)
+	{
+		return;
+	}
+	SimPipelineWait();
+	if(!isOn)
+	{
+		for(int slot = 0; slot < g_game.trains.count; ++slot)
+		{
+			TrainMaterialize(slot);
+		}
+	}
+	g_simEventSteppingOn = isOn;
+	if(isOn)
+	{
+		TrainEventsRebuild();
+	}
+	g_game.trainInstances.isDirty = true;
+}
+
+// gathers the split up data of a train again, not meant for hot paths
+static TrainInfo TrainGetInfoBySlot(int slot)
+{
+	TrainPool* pool = &g_game.trains;
+	TrainMaterialize(slot);
+	TrainRoute route = pool->routes[slot];
+	TrainRenderInfo renderInfo = pool->renderInfos[slot];
+	TrainInfo info =
+	{
+		.state = pool->states[slot],
+		.modelID = renderInfo.modelID,
+		.tileCurrent = route.tileCurrent,
+		.tilePrevious = route.tilePrevious,
+		.tileNext = route.tileNext,
+		.tileConnectionUsed = route.tileConnectionUsed,
+		.driveFromSector = route.driveFromSector,
+		.driveToSector = route.driveToSector,
+		.pathProgressNormalized = pool->pathProgressNormalized[slot],
+		.modelRotationInDegree = renderInfo.modelRotationInDegree,
+		.speedDrive = pool->speedDrive[slot],
+		.speedUnload = pool->cargoInfos[slot].speedUnload,
+		.speedLoad = pool->cargoInfos[slot].speedLoad,
+		.modelPosition = renderInfo.modelPosition,
+	};
+	for(int i = 0; i < 4; ++i)
+	{
+		info.pathCurvePoints[i] = route.pathCurvePoints[i];
+	}
+	return info;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Debug
+//----------------------------------------------------------------------------------------------------------------------
+
+// profiler panel on the right side of the debug window, times in ms over the last g_ProfilerHistoryLength frames
+static void RenderProfilerPanel(void)
+{
+	float lineHeight = 18;
+	Rectangle panel = (Rectangle) {(float) g_ScreenWidth - 16 - 280, 80, 280, 384};
+	GuiDrawRectangle(panel, 2, COLOR_BLACK, COLOR_GREY);
+	Rectangle rect = (Rectangle) {panel.x + 10, panel.y + 6, panel.width - 20, lineHeight};
+	char textBuffer[96];
+
+	GuiDrawText("Zone              avg    p50    p95    p99", rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	for(int zone = 0; zone < PROFILE_ZONE_COUNT; ++zone)
+	{
+		rect.y += lineHeight;
+		sprintf(textBuffer, "%-12s %6.2f %6.2f %6.2f %6.2f", ProfileZoneToString(zone), ProfileGetAverage(zone),
+			ProfileGetPercentile(zone, 0.5f), ProfileGetPercentile(zone, 0.95f), ProfileGetPercentile(zone, 0.99f));
+		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	}
+
+	rect.y += lineHeight;
+	sprintf(textBuffer, "Model Draw Calls: %d", g_profiler.drawCallsLastFrame);
+	GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+
+	rect.y += lineHeight;
+	sprintf(textBuffer, "Triangles: %d", g_profiler.trianglesLastFrame);
+	GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+
+	rect.y += lineHeight;
+	sprintf(textBuffer, "Trains Active: %d", g_game.trains.count);
+	GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+
+	int64_t memoryUsage = ProfileGetMemoryUsage();
+	rect.y += lineHeight;
+	if(memoryUsage >= 0)
+	{
+		sprintf(textBuffer, "Memory: %.1f MB", (double) memoryUsage / (1024.0 * 1024.0));
+	}
+	else
+	{
+		sprintf(textBuffer, "Memory: n/a");
+	}
+	GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+
+	// arenas: used (last frame for the frame arena) / reserved, and how many heap blocks they ever allocated
+	const MemoryArena* arenas[2] = {&g_memory.frameArena, &g_memory.sessionArena};
+	for(int i = 0; i < 2; ++i)
+	{
+		const MemoryArena* arena = arenas[i];
+		size_t used = arena == &g_memory.frameArena ? arena->lastUsed : arena->used;
+		rect.y += lineHeight;
+		sprintf(textBuffer, "%s Arena: %.0f / %.0f KB, %d allocs", arena->name, (double) used / 1024.0,
+			(double) arena->reserved / 1024.0, arena->heapAllocationCount);
+		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	}
+
+	// pools: used / capacity, they grow by doubling and keep their memory over gameplay resets
+	const RailGraph* graph = &g_game.railGraph;
+	rect.y += lineHeight;
+	sprintf(textBuffer, "Pools: trains %d/%d (%d waiting) nodes %d/%d", g_game.trains.count, g_game.trains.capacity,
+		g_game.trainSnapshots.buffers[g_game.trainSnapshots.front].waitingCount, graph->nodeCount - graph->freeNodeCount, graph->nodeCapacity);
+	GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+
+	// dumps, the trace records the next g_ProfilerTraceFrameCount frames
+	Rectangle button = (Rectangle) {panel.x + 10, panel.y + panel.height - 50, 120, 40};
+	if(GuiButton(button, "Dump CSV"))
+	{
+		ProfileWriteCsv(g_ProfilerCsvFilePath);
+	}
+	button.x += 130;
+	if(GuiButton(button, g_profiler.traceFramesLeft > 0 ? "Tracing..." : "Chrome Trace") && g_profiler.traceFramesLeft == 0)
+	{
+		ProfileTraceStart();
+	}
+}
+
+// the hovered tile block of the debug panel
+static void DebugPanelFormatTileText(const DebugTileTextKey* key)
+{
+	DebugPanelText* text = &g_game.debugPanelText;
+	text->tileLineCount = 0;
+	if(!key->isHit)
+	{
+		return;
+	}
+
+	char (*lines)[g_DebugPanelLineSize] = text->tileLines;
+	int count = 0;
+	sprintf(lines[count++], "TileCoords: x=%d, z=%d", key->coords.x, key->coords.z);
+	sprintf(lines[count++], "Sector: %s", TileSectorToString(key->sector));
+	sprintf(lines[count++], "Sector: %s", TileTypeToString(key->tile.type));
+	sprintf(lines[count++], "Connection Count: %d", TileHConnectionsCount(key->tile.connectionOptions));
+	sprintf(lines[count++], "Connections Active Count: %d", TileHConnectionsCount(key->tile.connectionsActive));
+	sprintf(lines[count++], "Rotation: %f", TileModelInfoGetRotationInDegree(key->tileModel));
+	sprintf(lines[count++], "Model: %s", ModelIdToString(TileModelInfoGetModelID(key->tileModel)));
+	sprintf(lines[count++], "Connection NS-SN: %s", TileHasConnectionFlag(key->tile.connectionOptions, CONNECTION_NS_SN) ? "True" : "False");
+	sprintf(lines[count++], "Connection EW-WE: %s", TileHasConnectionFlag(key->tile.connectionOptions, CONNECTION_EW_WE) ? "True" : "False");
+	sprintf(lines[count++], "Connection SW-WS: %s", TileHasConnectionFlag(key->tile.connectionOptions, CONNECTION_SW_WS) ? "True" : "False");
+	sprintf(lines[count++], "Connection NW_WN: %s", TileHasConnectionFlag(key->tile.connectionOptions, CONNECTION_NW_WN) ? "True" : "False");
+	sprintf(lines[count++], "Connection NE_EN: %s", TileHasConnectionFlag(key->tile.connectionOptions, CONNECTION_NE_EN) ? "True" : "False");
+	sprintf(lines[count++], "Connection ES_SE: %s", TileHasConnectionFlag(key->tile.connectionOptions, CONNECTION_ES_SE) ? "True" : "False");
+	text->tileLineCount = count;
+}
+
+// the map, simulation and first train block of the debug panel
+static void DebugPanelFormatStatusText(const DebugStatusTextKey* key)
+{
+	char (*lines)[g_DebugPanelLineSize] = g_game.debugPanelText.statusLines;
+	int count = 0;
+	sprintf(lines[count++], "-----------------------------");
+	sprintf(lines[count++], "Chunks Visible: %d / %d", key->chunksVisibleCount, g_MapChunkCount);
+	sprintf(lines[count++], "Sim: %.0f Hz, %d ticks/frame", key->tickRate, key->ticksLastFrame);
+	sprintf(lines[count++], "Rail Graph: %d nodes, %d segments", key->railNodeCount, key->railSegmentCount);
+	sprintf(lines[count++], "Route Cache: %d hits, %d misses", key->routeCacheHits, key->routeCacheMisses);
+	sprintf(lines[count++], "Trains Active: %d", key->trainCount);
+	if(key->trainCount > 0)
+	{
+		sprintf(lines[count++], "Train Tile: x%d z%d", key->trainTile.x, key->trainTile.z);
+		sprintf(lines[count++], "Train To: %s", TileSectorToString(key->trainDriveToSector));
+		sprintf(lines[count++], "Train From: %s", TileSectorToString(key->trainDriveFromSector));
+		sprintf(lines[count++], "Train Connection: %s", ConnectionDirectionToString(key->trainConnection));
+		sprintf(lines[count++], "Train Next Tile: %d %d", key->trainNextTile.x, key->trainNextTile.z);
+		sprintf(lines[count++], "Train Next Tile: %d %d", key->trainNextTile.x, key->trainNextTile.z);
+		sprintf(lines[count++], "Train Rotation: %f", key->trainRotationInDegree);
+	}
+	g_game.debugPanelText.statusLineCount = count;
+}
+
+// gathers what the panel shows and formats only the blocks whose values changed since the last frame
+static void DebugPanelUpdateText(void)
+{
+	DebugPanelText* text = &g_game.debugPanelText;
+	const HoveredTile* hovered = &g_game.hoveredTile;
+
+	DebugTileTextKey tileKey;
+	memset(&tileKey, 0, sizeof(tileKey));
+	tileKey.isHit = hovered->isHit;
+	if(hovered->isHit)
+	{
+		tileKey.coords = hovered->coords;
+		tileKey.sector = hovered->sector;
+		tileKey.tile = g_game.mapTiles[hovered->tileIndex];
+		tileKey.tileModel = g_game.mapTileModels[hovered->tileIndex];
+	}
+
+	DebugStatusTextKey statusKey;
+	memset(&statusKey, 0, sizeof(statusKey));
+	statusKey.chunksVisibleCount = g_game.mapChunksVisibleCount;
+	statusKey.tickRate = g_game.simClock.tickRate;
+	statusKey.ticksLastFrame = g_game.simClock.ticksLastFrame;
+	statusKey.railNodeCount = g_game.railGraph.nodeCount - g_game.railGraph.freeNodeCount;
+	statusKey.railSegmentCount = g_game.railGraph.segmentCount - g_game.railGraph.freeSegmentCount;
+	statusKey.routeCacheHits = g_game.routePlanner.cacheHits;
+	statusKey.routeCacheMisses = g_game.routePlanner.cacheMisses;
+	const TrainRenderSnapshot* snapshot = &g_game.trainSnapshots.buffers[g_game.trainSnapshots.front];
+	statusKey.trainCount = g_game.trains.count;
+	if(snapshot->trainCount > 0)
+	{
+		const TrainInfo* train = &snapshot->firstTrain;
+		statusKey.trainTile = train->tileCurrent;
+		statusKey.trainDriveToSector = train->driveToSector;
+		statusKey.trainDriveFromSector = train->driveFromSector;
+		statusKey.trainConnection = train->tileConnectionUsed;
+		statusKey.trainNextTile = train->tileNext;
+		statusKey.trainRotationInDegree = train->modelRotationInDegree;
+	}
+
+	if(!text->isValid || memcmp(&tileKey, &text->tileKey, sizeof(tileKey)) != 0)
+	{
+		memcpy(&text->tileKey, &tileKey, sizeof(tileKey)); // with the padding, for the next memcmp
+		DebugPanelFormatTileText(&tileKey);
+	}
+	if(!text->isValid || memcmp(&statusKey, &text->statusKey, sizeof(statusKey)) != 0)
+	{
+		memcpy(&text->statusKey, &statusKey, sizeof(statusKey)); // with the padding, for the next memcmp
+		DebugPanelFormatStatusText(&statusKey);
+	}
+	text->isValid = true;
+}
+
+void RenderDebugWindow()
+{
+	if(IsKeyPressed(g_debugWindowKey))
+	{
+		g_debugWindowOn = !g_debugWindowOn;
+	}
+
+	if(g_debugWindowOn)
+	{
+		// sim pause button
+		if(GuiButton((Rectangle) {15, (float) g_ScreenHeight - 65, 80, 50}, "Pause Sim"))
+		{
+			g_debugSimPauseOn = !g_debugSimPauseOn;
+		}
+
+		// render path toggle, to compare merged chunk meshes against instanced and per tile draw calls
+		const char* renderPathLabel = g_renderMergedRailsOn ? "Merged" : g_renderInstancingOn ? "Instancing" : "Per Tile";
+		if(GuiButton((Rectangle) {105, (float) g_ScreenHeight - 65, 80, 50}, renderPathLabel))
+		{
+			// merged -> instancing -> per tile -> merged
+			if(g_renderMergedRailsOn)
+			{
+				g_renderMergedRailsOn = false;
+				g_renderInstancingOn = true;
+			}
+			else if(g_renderInstancingOn)
+			{
+				g_renderInstancingOn = false;
+			}
+			else
+			{
+				g_renderMergedRailsOn = true;
+			}
+		}
+
+		// grid shader against the line mesh fallback
+		if(GuiButton((Rectangle) {195, (float) g_ScreenHeight - 65, 80, 50}, g_renderGridShaderOn ? "Grid Shader" : "Grid Mesh"))
+		{
+			g_renderGridShaderOn = !g_renderGridShaderOn;
+		}
+
+		// rails LODs for far chunks against full detail everywhere
+		if(GuiButton((Rectangle) {195, (float) g_ScreenHeight - 185, 80, 50}, g_renderLodOn ? "LOD On" : "LOD Off"))
+		{
+			g_renderLodOn = !g_renderLodOn;
+		}
+
+		// instanced trains against one draw call per train
+		if(GuiButton((Rectangle) {195, (float) g_ScreenHeight - 125, 80, 50}, g_renderTrainInstancingOn ? "Trains Inst." : "Trains Each"))
+		{
+			g_renderTrainInstancingOn = !g_renderTrainInstancingOn;
+		}
+
+		// only trains reaching their next tile get stepped, against stepping every train every tick
+		if(GuiButton((Rectangle) {195, (float) g_ScreenHeight - 245, 80, 50}, g_simEventSteppingOn ? "Step Events" : "Step Ticks"))
+		{
+			SimSetEventStepping(!g_simEventSteppingOn);
+		}
+
+		#if defined(SIM_MULTITHREADED)
+			// ticks on the simulation thread while the frame is drawn, against ticking before drawing
+			if(GuiButton((Rectangle) {195, (float) g_ScreenHeight - 305, 80, 50}, g_simPipelineOn ? "Pipelined" : "Serial"))
+			{
+				SimPipelineWait();
+				g_simPipelineOn = !g_simPipelineOn;
+			}
+		#endif
+
+		// train pool stress test, clones the first train or despawns the most recent one
+		const TrainRenderSnapshot* snapshot = &g_game.trainSnapshots.buffers[g_game.trainSnapshots.front];
+		if(GuiButton((Rectangle) {15, (float) g_ScreenHeight - 125, 80, 50}, "+ Train") && snapshot->trainCount > 0)
+		{
+			TrainInfo clone = snapshot->firstTrain;
+			clone.pathProgressNormalized = 0;
+			GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_TRAIN_SPAWN, .params.train = clone});
+		}
+		if(GuiButton((Rectangle) {105, (float) g_ScreenHeight - 125, 80, 50}, "- Train") && g_game.trains.count > 0)
+		{
+			GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_TRAIN_DESPAWN, .params.trainSlot = g_game.trains.count - 1});
+		}
+
+		// snapshot of map and trains. No command, so off during replays: a load would replace the game under them
+		bool isReplayRunning = g_replay.state == REPLAY_STATE_RECORDING || g_replay.state == REPLAY_STATE_PLAYING;
+		if(isReplayRunning)
+		{
+			GuiDisable();
+		}
+		if(GuiButton((Rectangle) {15, (float) g_ScreenHeight - 185, 80, 50}, "Save"))
+		{
+			SnapshotSave(g_SnapshotFilePath);
+		}
+		if(GuiButton((Rectangle) {105, (float) g_ScreenHeight - 185, 80, 50}, "Load"))
+		{
+			SnapshotLoad(g_SnapshotFilePath);
+		}
+		GuiEnable();
+
+		// replay of the player's actions, recording starts from a snapshot of the current map
+		const char* recordLabel = g_replay.state == REPLAY_STATE_RECORDING ? "Stop Rec" : "Record";
+		if(GuiButton((Rectangle) {15, (float) g_ScreenHeight - 245, 80, 50}, recordLabel) && g_replay.state != REPLAY_STATE_PLAYING)
+		{
+			ReplayRequest(g_replay.state == REPLAY_STATE_RECORDING ? REPLAY_STATE_OFF : REPLAY_STATE_RECORDING, g_ReplayFilePath);
+		}
+		const char* replayLabel = g_replay.state == REPLAY_STATE_PLAYING ? "Stop" : "Replay";
+		if(GuiButton((Rectangle) {105, (float) g_ScreenHeight - 245, 80, 50}, replayLabel) && g_replay.state != REPLAY_STATE_RECORDING)
+		{
+			ReplayRequest(g_replay.state == REPLAY_STATE_PLAYING ? REPLAY_STATE_OFF : REPLAY_STATE_PLAYING, g_ReplayFilePath);
+		}
+
+		// debug panel
+		float lineHeight = 20;
+		Rectangle rect = (Rectangle) {16, 80, 180, 500};
 		GuiDrawRectangle(rect, 2, COLOR_BLACK, COLOR_GREY);
-		RayCollision rayCollision = MapMouseRaycast();
 		rect.x += 10;
-		char textBuffer[64];
 		rect.y = -100; // ????
-		if(rayCollision.hit)
+		DebugPanelUpdateText();
+		const DebugPanelText* text = &g_game.debugPanelText;
+		for(int line = 0; line < text->tileLineCount; ++line)
+		{
+			rect.y += line > 0 ? lineHeight : 0;
+			GuiDrawText(text->tileLines[line], rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+		}
+		for(int line = 0; line < text->statusLineCount; ++line)
+		{
+			rect.y += lineHeight;
+			GuiDrawText(text->statusLines[line], rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+		}
+
+		RenderProfilerPanel();
+	}
+}
+
+Vector3 Bezier3D(Vector3 start, Vector3 middle, Vector3 end, float t)
+{
+	// Ensure t is clamped between 0 and 1
+	if (t < 0.0f) t = 0.0f;
+	if (t > 1.0f) t = 1.0f;
+
+	// Calculate tangents
+	Vector3 tangentStart = Vector3Add(start, Vector3Scale(Vector3Subtract(middle, start), 0.5f));
+	Vector3 tangentEnd = Vector3Add(end, Vector3Scale(Vector3Subtract(middle, end), 0.5f));
+
+	// Calculate Bezier coefficients
+	float u = 1.0f - t;
+	float tt = t * t;
+	float uu = u * u;
+	float uuu = uu * u;
+	float ttt = tt * t;
+
+	// Combine the weighted contributions of each control point
+	Vector3 p = Vector3Scale(start, uuu); // (1-t)^3 * start
+	p = Vector3Add(p, Vector3Scale(tangentStart, 3 * uu * t)); // 3(1-t)^2 * t * tangentStart
+	p = Vector3Add(p, Vector3Scale(tangentEnd, 3 * u * tt)); // 3(1-t) * t^2 * tangentEnd
+	p = Vector3Add(p, Vector3Scale(end, ttt)); // t^3 * end
+
+	return p;
+}
+
+float CalculateLookAtAngle(Vector3 from, Vector3 to)
+{
+	// Compute the direction vector from 'from' to 'to'
+	Vector3 direction = Vector3Subtract(to, from);
+
+	// Calculate the angle using atan2
+	// atan2(y, x) returns the angle in radians between the positive X-axis and the point (x, y)
+	// We use direction.x and direction.z since we are rotating around the Y-axis
+	float angle = atan2f(direction.x, direction.z) * RAD2DEG;
+
+	// Ensure the angle is within the range [0, 360)
+	if (angle < 0.0f)
+	{
+		angle += 360.0f;
+	}
+
+	return angle;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Track curves
+//----------------------------------------------------------------------------------------------------------------------
+// the path through a tile only depends on the entry and exit edge, so every curve is sampled once at startup
+static TrackCurveSample g_trackCurves[TILE_EDGE_COUNT][TILE_EDGE_COUNT][g_TrackCurveSampleCount + 1];
+static float g_trackCurveLengths[TILE_EDGE_COUNT][TILE_EDGE_COUNT];
+
+static void TrackCurvesBuild(void)
+{
+	static const TileSector edgeSectors[] = {TILE_SECTOR_N, TILE_SECTOR_E, TILE_SECTOR_S, TILE_SECTOR_W};
+	const TileCoords tileCoords = {0, 0};
+	const Vector3 middle = TileGetCenterPosition(tileCoords);
+	const float headingEpsilon = 0.001f;
+
+	for(int fromIndex = 0; fromIndex < 4; fromIndex++)
+	{
+		for(int toIndex = 0; toIndex < 4; toIndex++)
+		{
+			if(fromIndex == toIndex)
+			{
+				continue;
+			}
+			Vector3 start = TileSectorGetEdgePosition(tileCoords, edgeSectors[fromIndex]);
+			Vector3 end = TileSectorGetEdgePosition(tileCoords, edgeSectors[toIndex]);
+
+			// arc length at every build step
+			float lengths[g_TrackCurveBuildSteps + 1];
+			lengths[0] = 0.0f;
+			Vector3 previousPoint = start;
+			for(int step = 1; step <= g_TrackCurveBuildSteps; step++)
+			{
+				Vector3 point = Bezier3D(start, middle, end, (float) step / (float) g_TrackCurveBuildSteps);
+				lengths[step] = lengths[step - 1] + Vector3Distance(previousPoint, point);
+				previousPoint = point;
+			}
+
+			// place samples at even arc length distances, so trains drive at constant speed through curves
+			TileEdge fromEdge = g_tileSectorToEdge[edgeSectors[fromIndex]];
+			TileEdge toEdge = g_tileSectorToEdge[edgeSectors[toIndex]];
+			g_trackCurveLengths[fromEdge][toEdge] = lengths[g_TrackCurveBuildSteps];
+			TrackCurveSample* samples = g_trackCurves[fromEdge][toEdge];
+			int step = 0;
+			for(int sampleIndex = 0; sampleIndex <= g_TrackCurveSampleCount; sampleIndex++)
+			{
+				float length = lengths[g_TrackCurveBuildSteps] * (float) sampleIndex / (float) g_TrackCurveSampleCount;
+				while(step < g_TrackCurveBuildSteps - 1 && lengths[step + 1] < length)
+				{
+					step++;
+				}
+				float stepLength = lengths[step + 1] - lengths[step];
+				float stepAlpha = (stepLength > 0.0f) ? Clamp((length - lengths[step]) / stepLength, 0.0f, 1.0f) : 0.0f;
+				float t = ((float) step + stepAlpha) / (float) g_TrackCurveBuildSteps;
+
+				samples[sampleIndex].position = Vector3Subtract(Bezier3D(start, middle, end, t), middle);
+				float heading = CalculateLookAtAngle(Bezier3D(start, middle, end, t - headingEpsilon), Bezier3D(start, middle, end, t + headingEpsilon));
+				if(sampleIndex > 0)
+				{
+					// keep the heading continuous to the previous sample
+					float previousHeading = samples[sampleIndex - 1].headingInDegree;
+					if(heading - previousHeading > 180.0f)
+					{
+						heading -= 360.0f;
+					}
+					else if(heading - previousHeading < -180.0f)
+					{
+						heading += 360.0f;
+					}
+				}
+				samples[sampleIndex].headingInDegree = heading;
+			}
+		}
+	}
+}
+
+// selects the curve for the current tile path, call whenever the route enters a tile
+static void TrainRouteUpdateCurve(TrainRoute* route)
+{
+	route->curve = g_trackCurves[g_tileSectorToEdge[route->driveFromSector]][g_tileSectorToEdge[route->driveToSector]];
+	route->curveOrigin = TileGetCenterPosition(route->tileCurrent);
+
+	// same control points Bezier3D uses
+	Vector3 start = TileSectorGetEdgePosition(route->tileCurrent, route->driveFromSector);
+	Vector3 end = TileSectorGetEdgePosition(route->tileCurrent, route->driveToSector);
+	Vector3 middle = route->curveOrigin;
+	Vector3 tangentStart = Vector3Add(start, Vector3Scale(Vector3Subtract(middle, start), 0.5f));
+	Vector3 tangentEnd = Vector3Add(end, Vector3Scale(Vector3Subtract(middle, end), 0.5f));
+	route->pathCurvePoints[0] = (Vector2) {start.x, start.z};
+	route->pathCurvePoints[1] = (Vector2) {tangentStart.x, tangentStart.z};
+	route->pathCurvePoints[2] = (Vector2) {tangentEnd.x, tangentEnd.z};
+	route->pathCurvePoints[3] = (Vector2) {end.x, end.z};
+}
+
+// world position and heading at a progress along the route's tile path
+static inline void TrainRouteSampleCurve(const TrainRoute* route, float progressNormalized, Vector3* position, float* headingInDegree)
+{
+	float samplePosition = Clamp(progressNormalized, 0.0f, 1.0f) * (float) g_TrackCurveSampleCount;
+	int sampleIndex = (int) samplePosition;
+	if(sampleIndex >= g_TrackCurveSampleCount)
+	{
+		sampleIndex = g_TrackCurveSampleCount - 1;
+	}
+	float alpha = samplePosition - (float) sampleIndex;
+	const TrackCurveSample* sampleA = &route->curve[sampleIndex];
+	const TrackCurveSample* sampleB = &route->curve[sampleIndex + 1];
+
+	*position = Vector3Add(route->curveOrigin, Vector3Lerp(sampleA->position, sampleB->position, alpha));
+	float heading = Lerp(sampleA->headingInDegree, sampleB->headingInDegree, alpha);
+	if(heading < 0.0f)
+	{
+		heading += 360.0f;
+	}
+	else if(heading >= 360.0f)
+	{
+		heading -= 360.0f;
+	}
+	*headingInDegree = heading;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Rail network graph
+//----------------------------------------------------------------------------------------------------------------------
+// maintained incrementally: a tile change only retraces the segments touching the tile and its neighbours
+static void RailGraphReset(void)
+{
+	RailGraph* graph = &g_game.railGraph;
+	graph->nodeCount = 0;
+	graph->freeNodeCount = 0;
+	graph->segmentCount = 0;
+	graph->freeSegmentCount = 0;
+	graph->pendingTileCount = 0;
+	graph->version++;
+}
+
+static void RailGraphFree(void)
+{
+	RailGraph* graph = &g_game.railGraph;
+	for(int segmentIndex = 0; segmentIndex < graph->segmentCapacity; ++segmentIndex)
+	{
+		MemFree(graph->segments[segmentIndex].tileIndices);
+	}
+	MemFree(graph->nodes);
+	MemFree(graph->freeNodes);
+	MemFree(graph->segments);
+	MemFree(graph->freeSegments);
+	MemFree(graph->pendingTiles);
+	unsigned int version = graph->version;
+	*graph = (RailGraph) {0};
+	graph->version = version + 1; // never hand out a version again, cached routes would come back to life
+}
+
+static inline int RailGraphGetNodeAt(int tileIndex)
+{
+	return g_game.mapTileRailNodes[tileIndex];
+}
+
+static inline int RailGraphGetSegmentAt(int tileIndex)
+{
+	return g_game.mapTileRailSegments[tileIndex];
+}
+
+static inline bool RailGraphIsJunction(int tileIndex)
+{
+	return TileHConnectionsCount(g_game.mapTiles[tileIndex].connectionOptions) >= 2;
+}
+
+// exit edge of a single connection tile
+static inline TileEdge RailGraphGetExitEdge(int tileIndex, TileEdge entryEdge)
+{
+	ConnectionsConfig connection = g_game.mapTiles[tileIndex].connectionOptions;
+	return g_tileSectorToEdge[g_connectionExitByEntry[connection][entryEdge]];
+}
+
+// neighbour across an edge if its rails lead back through the opposite edge, -1 otherwise
+static int RailGraphGetConnectedNeighbour(int tileIndex, TileEdge edge, TileEdge* neighbourEntryEdge)
+{
+	TileCoords coords = TileCoordsByIndex(tileIndex);
+	TileCoords offset = g_tileEdgeNeighbourOffset[edge];
+	int x = coords.x + offset.x;
+	int z = coords.z + offset.z;
+	if(x < 0 || z < 0 || x >= g_MapGridSize || z >= g_MapGridSize)
+	{
+		return -1;
+	}
+
+	int neighbourIndex = TileIndexByTileCoords(x, z);
+	TileEdge entryEdge = g_tileSectorToEdge[g_tileEdgeOppositeSector[edge]];
+	if((g_game.mapTiles[neighbourIndex].connectionOptions & g_tileEdgeConnections[entryEdge]) == 0)
+	{
+		return -1;
+	}
+	*neighbourEntryEdge = entryEdge;
+	return neighbourIndex;
+}
+
+static void RailGraphQueueTile(int tileIndex)
+{
+	RailGraph* graph = &g_game.railGraph;
+	if(graph->pendingTileCount == graph->pendingTileCapacity)
+	{
+		graph->pendingTileCapacity = graph->pendingTileCapacity > 0 ? graph->pendingTileCapacity * 2 : g_RailGraphInitialCapacity;
+		graph->pendingTiles = MemRealloc(graph->pendingTiles, graph->pendingTileCapacity * sizeof(int));
+	}
+	graph->pendingTiles[graph->pendingTileCount++] = tileIndex;
+}
+
+static int RailGraphAddNode(int tileIndex)
+{
+	RailGraph* graph = &g_game.railGraph;
+	int nodeIndex;
+	if(graph->freeNodeCount > 0)
+	{
+		nodeIndex = graph->freeNodes[--graph->freeNodeCount];
+	}
+	else
+	{
+		if(graph->nodeCount == graph->nodeCapacity)
+		{
+			graph->nodeCapacity = graph->nodeCapacity > 0 ? graph->nodeCapacity * 2 : g_RailGraphInitialCapacity;
+			graph->nodes = MemRealloc(graph->nodes, graph->nodeCapacity * sizeof(RailNode));
+			graph->freeNodes = MemRealloc(graph->freeNodes, graph->nodeCapacity * sizeof(int));
+		}
+		nodeIndex = graph->nodeCount++;
+	}
+
+	RailNode* node = &graph->nodes[nodeIndex];
+	node->tileIndex = tileIndex;
+	node->isUsed = true;
+	for(int edge = 0; edge < TILE_EDGE_COUNT; ++edge)
+	{
+		node->segments[edge] = -1;
+	}
+	g_game.mapTileRailNodes[tileIndex] = nodeIndex;
+	return nodeIndex;
+}
+
+static int RailGraphAddSegment(void)
+{
+	RailGraph* graph = &g_game.railGraph;
+	int segmentIndex;
+	if(graph->freeSegmentCount > 0)
+	{
+		segmentIndex = graph->freeSegments[--graph->freeSegmentCount];
+	}
+	else
+	{
+		if(graph->segmentCount == graph->segmentCapacity)
+		{
+			int capacity = graph->segmentCapacity > 0 ? graph->segmentCapacity * 2 : g_RailGraphInitialCapacity;
+			graph->segments = MemRealloc(graph->segments, capacity * sizeof(RailSegment));
+			graph->freeSegments = MemRealloc(graph->freeSegments, capacity * sizeof(int));
+			// new slots have no tile buffer yet
+			memset(&graph->segments[graph->segmentCapacity], 0, (capacity - graph->segmentCapacity) * sizeof(RailSegment));
+			graph->segmentCapacity = capacity;
+		}
+		segmentIndex = graph->segmentCount++;
+	}
+
+	RailSegment* segment = &graph->segments[segmentIndex];
+	segment->ends[0] = (RailSegmentEnd) {-1, -1, TILE_EDGE_NONE};
+	segment->ends[1] = (RailSegmentEnd) {-1, -1, TILE_EDGE_NONE};
+	segment->length = 0;
+	segment->tileCount = 0;
+	segment->isUsed = true;
+	segment->isLoop = false;
+	return segmentIndex;
+}
+
+static void RailSegmentAppendTile(int segmentIndex, int tileIndex, float length)
+{
+	RailSegment* segment = &g_game.railGraph.segments[segmentIndex];
+	if(segment->tileCount == segment->tileCapacity)
+	{
+		segment->tileCapacity = segment->tileCapacity > 0 ? segment->tileCapacity * 2 : 16;
+		segment->tileIndices = MemRealloc(segment->tileIndices, segment->tileCapacity * sizeof(int));
+	}
+	segment->tileIndices[segment->tileCount++] = tileIndex;
+	segment->length += length;
+	g_game.mapTileRailSegments[tileIndex] = segmentIndex;
+}
+
+// unlinks the segment and queues all its tiles and end nodes for retracing
+static void RailGraphRemoveSegment(int segmentIndex)
+{
+	RailGraph* graph = &g_game.railGraph;
+	RailSegment* segment = &graph->segments[segmentIndex];
+	for(int endIndex = 0; endIndex < 2; ++endIndex)
+	{
+		RailSegmentEnd end = segment->ends[endIndex];
+		if(end.nodeIndex >= 0)
+		{
+			if(graph->nodes[end.nodeIndex].segments[end.edge] == segmentIndex)
+			{
+				graph->nodes[end.nodeIndex].segments[end.edge] = -1;
+			}
+			RailGraphQueueTile(end.tileIndex);
+		}
+	}
+	for(int i = 0; i < segment->tileCount; ++i)
+	{
+		g_game.mapTileRailSegments[segment->tileIndices[i]] = -1;
+		RailGraphQueueTile(segment->tileIndices[i]);
+	}
+	segment->tileCount = 0;
+	segment->isUsed = false;
+	graph->freeSegments[graph->freeSegmentCount++] = segmentIndex;
+}
+
+static void RailGraphRemoveNode(int nodeIndex)
+{
+	RailGraph* graph = &g_game.railGraph;
+	for(int edge = 0; edge < TILE_EDGE_COUNT; ++edge)
+	{
+		if(graph->nodes[nodeIndex].segments[edge] >= 0)
+		{
+			RailGraphRemoveSegment(graph->nodes[nodeIndex].segments[edge]);
+		}
+	}
+	g_game.mapTileRailNodes[graph->nodes[nodeIndex].tileIndex] = -1;
+	graph->nodes[nodeIndex].isUsed = false;
+	graph->freeNodes[graph->freeNodeCount++] = nodeIndex;
+}
+
+// follows the rails into tileIndex through entryEdge and appends single connection tiles to the segment
+// until it reaches a junction, a dead end or its own first tile again. Sets the segment's second end
+static void RailGraphWalkSegment(int segmentIndex, int tileIndex, TileEdge entryEdge)
+{
+	RailGraph* graph = &g_game.railGraph;
+	for(int step = 0; step <= g_TileCount; ++step)
+	{
+		int nodeIndex = g_game.mapTileRailNodes[tileIndex];
+		if(nodeIndex >= 0)
+		{
+			graph->segments[segmentIndex].ends[1] = (RailSegmentEnd) {nodeIndex, tileIndex, entryEdge};
+			graph->nodes[nodeIndex].segments[entryEdge] = segmentIndex;
+			return;
+		}
+		if(g_game.mapTileRailSegments[tileIndex] == segmentIndex)
+		{
+			graph->segments[segmentIndex].ends[1] = graph->segments[segmentIndex].ends[0];
+			graph->segments[segmentIndex].isLoop = true;
+			return;
+		}
+
+		TileEdge exitEdge = RailGraphGetExitEdge(tileIndex, entryEdge);
+		RailSegmentAppendTile(segmentIndex, tileIndex, g_trackCurveLengths[entryEdge][exitEdge]);
+
+		TileEdge nextEntryEdge;
+		int nextTileIndex = RailGraphGetConnectedNeighbour(tileIndex, exitEdge, &nextEntryEdge);
+		if(nextTileIndex < 0)
+		{
+			graph->segments[segmentIndex].ends[1] = (RailSegmentEnd) {-1, tileIndex, exitEdge};
+			return;
+		}
+		tileIndex = nextTileIndex;
+		entryEdge = nextEntryEdge;
+	}
+}
+
+// builds the segment leaving a node through an edge, if there is none yet
+static void RailGraphTraceFromNode(int nodeIndex, TileEdge edge)
+{
+	RailGraph* graph = &g_game.railGraph;
+	int tileIndex = graph->nodes[nodeIndex].tileIndex;
+	if(graph->nodes[nodeIndex].segments[edge] >= 0 || (g_game.mapTiles[tileIndex].connectionOptions & g_tileEdgeConnections[edge]) == 0)
+	{
+		return;
+	}
+
+	// an open edge of the junction itself has nothing to collapse
+	TileEdge neighbourEntryEdge;
+	int neighbourIndex = RailGraphGetConnectedNeighbour(tileIndex, edge, &neighbourEntryEdge);
+	if(neighbourIndex < 0)
+	{
+		return;
+	}
+
+	int segmentIndex = RailGraphAddSegment();
+	graph->segments[segmentIndex].ends[0] = (RailSegmentEnd) {nodeIndex, tileIndex, edge};
+	graph->nodes[nodeIndex].segments[edge] = segmentIndex;
+	RailGraphWalkSegment(segmentIndex, neighbourIndex, neighbourEntryEdge);
+}
+
+// builds the segment a single connection tile belongs to, if there is none yet
+static void RailGraphTraceThroughTile(int tileIndex)
+{
+	ConnectionsConfig connection = g_game.mapTiles[tileIndex].connectionOptions;
+	if(g_game.mapTileRailSegments[tileIndex] >= 0 || TileHConnectionsCount(connection) != 1)
+	{
+		return;
+	}
+
+	TileEdge firstEdge = TILE_EDGE_NONE;
+	for(int edge = TILE_EDGE_NONE + 1; edge < TILE_EDGE_COUNT; ++edge)
+	{
+		if(connection & g_tileEdgeConnections[edge])
+		{
+			firstEdge = edge;
+			break;
+		}
+	}
+
+	// walk back to where the run starts: a junction, a dead end, or all the way around a loop
+	RailSegmentEnd start = (RailSegmentEnd) {-1, tileIndex, firstEdge};
+	int currentIndex = tileIndex;
+	TileEdge exitEdge = firstEdge;
+	for(int step = 0; step <= g_TileCount; ++step)
+	{
+		TileEdge nextEntryEdge;
+		int nextIndex = RailGraphGetConnectedNeighbour(currentIndex, exitEdge, &nextEntryEdge);
+		if(nextIndex < 0)
+		{
+			start = (RailSegmentEnd) {-1, currentIndex, exitEdge};
+			break;
+		}
+		if(g_game.mapTileRailNodes[nextIndex] >= 0)
+		{
+			start = (RailSegmentEnd) {g_game.mapTileRailNodes[nextIndex], nextIndex, nextEntryEdge};
+			break;
+		}
+		if(nextIndex == tileIndex)
+		{
+			start = (RailSegmentEnd) {-1, currentIndex, exitEdge};
+			break;
+		}
+		currentIndex = nextIndex;
+		exitEdge = RailGraphGetExitEdge(nextIndex, nextEntryEdge);
+	}
+
+	// then collect the run in the opposite direction
+	RailGraph* graph = &g_game.railGraph;
+	int segmentIndex = RailGraphAddSegment();
+	graph->segments[segmentIndex].ends[0] = start;
+	if(start.nodeIndex >= 0)
+	{
+		graph->nodes[start.nodeIndex].segments[start.edge] = segmentIndex;
+	}
+	RailGraphWalkSegment(segmentIndex, currentIndex, exitEdge);
+}
+
+// builds the whole graph from the tiles, for when the map got replaced at once
+static void RailGraphRebuild(void)
+{
+	RailGraphReset();
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		g_game.mapTileRailNodes[tileIndex] = -1;
+		g_game.mapTileRailSegments[tileIndex] = -1;
+	}
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		if(RailGraphIsJunction(tileIndex))
+		{
+			RailGraphAddNode(tileIndex);
+		}
+	}
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		int nodeIndex = g_game.mapTileRailNodes[tileIndex];
+		if(nodeIndex >= 0)
+		{
+			for(int edge = TILE_EDGE_NONE + 1; edge < TILE_EDGE_COUNT; ++edge)
+			{
+				RailGraphTraceFromNode(nodeIndex, edge);
+			}
+		}
+		else
+		{
+			RailGraphTraceThroughTile(tileIndex);
+		}
+	}
+}
+
+// call after the rails of tiles changed, a batch of tiles bumps the version and retraces only once.
+// tileIndices must not contain a tile twice
+static void RailGraphUpdateTiles(const int* tileIndices, int tileCount)
+{
+	RailGraph* graph = &g_game.railGraph;
+	graph->pendingTileCount = 0;
+	graph->version++;
+
+	// drop everything the changes can affect, which queues the remaining parts for retracing
+	for(int i = 0; i < tileCount; ++i)
+	{
+		int tileIndex = tileIndices[i];
+		TileCoords coords = TileCoordsByIndex(tileIndex);
+		if(g_game.mapTileRailNodes[tileIndex] >= 0)
+		{
+			RailGraphRemoveNode(g_game.mapTileRailNodes[tileIndex]);
+		}
+		RailGraphQueueTile(tileIndex);
+		for(int edge = TILE_EDGE_NONE; edge < TILE_EDGE_COUNT; ++edge) // TILE_EDGE_NONE is the tile itself
+		{
+			TileCoords offset = g_tileEdgeNeighbourOffset[edge];
+			int neighbourX = coords.x + offset.x;
+			int neighbourZ = coords.z + offset.z;
+			if(neighbourX < 0 || neighbourZ < 0 || neighbourX >= g_MapGridSize || neighbourZ >= g_MapGridSize)
+			{
+				continue;
+			}
+			int neighbourIndex = TileIndexByTileCoords(neighbourX, neighbourZ);
+			if(g_game.mapTileRailSegments[neighbourIndex] >= 0)
+			{
+				RailGraphRemoveSegment(g_game.mapTileRailSegments[neighbourIndex]);
+			}
+		}
+	}
+
+	// only the changed tiles can become junctions
+	for(int i = 0; i < tileCount; ++i)
+	{
+		if(RailGraphIsJunction(tileIndices[i]))
+		{
+			RailGraphAddNode(tileIndices[i]);
+		}
+	}
+
+	for(int i = 0; i < graph->pendingTileCount; ++i)
+	{
+		int pendingIndex = graph->pendingTiles[i];
+		int nodeIndex = g_game.mapTileRailNodes[pendingIndex];
+		if(nodeIndex >= 0)
+		{
+			for(int edge = TILE_EDGE_NONE + 1; edge < TILE_EDGE_COUNT; ++edge)
+			{
+				RailGraphTraceFromNode(nodeIndex, edge);
+			}
+		}
+		else
+		{
+			RailGraphTraceThroughTile(pendingIndex);
+		}
+	}
+	graph->pendingTileCount = 0;
+}
+
+static void RailGraphUpdateTile(int x, int z)
+{
+	int tileIndex = TileIndexByTileCoords(x, z);
+	RailGraphUpdateTiles(&tileIndex, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Block reservations
+//----------------------------------------------------------------------------------------------------------------------
+// Every rail graph segment is a block a single train holds at a time, junction tiles belong to no block. A train that
+// would enter a block it doesn't hold stops as TRAIN_STATE_BLOCKED, after the tick it either gets the block or sleeps
+// in the block's wait queue as TRAIN_STATE_WAITING. A train gives its block up as soon as it left it, which hands it to
+// the first train waiting for it.
+// Segment indices only last until the graph changes, so then all reservations are rebuilt from the train positions
+static inline bool BlockReservationsAreCurrent(void)
+{
+	return !g_game.trains.reservationsAreDirty && g_game.trains.reservationsGraphVersion == g_game.railGraph.version;
+}
+
+static void BlockWaitQueuePush(int segmentIndex, TrainID trainID)
+{
+	RailSegment* segment = &g_game.railGraph.segments[segmentIndex];
+	g_game.trains.nextWaitingById[trainID] = g_TrainIDNone;
+	if(segment->lastWaiting != g_TrainIDNone)
+	{
+		g_game.trains.nextWaitingById[segment->lastWaiting] = trainID;
+	}
+	else
+	{
+		segment->firstWaiting = trainID;
+	}
+	segment->lastWaiting = trainID;
+}
+
+// for despawning, queues are short so walking it is fine
+static void BlockWaitQueueRemove(int segmentIndex, TrainID trainID)
+{
+	RailSegment* segment = &g_game.railGraph.segments[segmentIndex];
+	TrainID previous = g_TrainIDNone;
+	for(TrainID waiting = segment->firstWaiting; waiting != g_TrainIDNone; waiting = g_game.trains.nextWaitingById[waiting])
+	{
+		if(waiting == trainID)
+		{
+			TrainID next = g_game.trains.nextWaitingById[waiting];
+			if(previous != g_TrainIDNone)
+			{
+				g_game.trains.nextWaitingById[previous] = next;
+			}
+			else
+			{
+				segment->firstWaiting = next;
+			}
+			if(segment->lastWaiting == trainID)
+			{
+				segment->lastWaiting = previous;
+			}
+			return;
+		}
+		previous = waiting;
+	}
+}
+
+// the first waiting train takes the block over and drives on. It waits on a junction or inside the block, so it holds
+// no other block
+static void BlockRelease(TrainID trainID)
+{
+	TrainPool* pool = &g_game.trains;
+	int segmentIndex = pool->reservedBlockById[trainID];
+	pool->reservedBlockById[trainID] = -1;
+	if(segmentIndex < 0)
+	{
+		return;
+	}
+	RailSegment* segment = &g_game.railGraph.segments[segmentIndex];
+	TrainID next = segment->firstWaiting;
+	segment->reservedBy = next;
+	if(next == g_TrainIDNone)
+	{
+		return;
+	}
+	segment->firstWaiting = pool->nextWaitingById[next];
+	if(segment->firstWaiting == g_TrainIDNone)
+	{
+		segment->lastWaiting = g_TrainIDNone;
+	}
+	pool->reservedBlockById[next] = segmentIndex;
+	pool->waitingBlockById[next] = -1;
+	pool->waitingCount--;
+	TrainResume(pool->slotById[next]);
+}
+
+static void BlockReserve(TrainID trainID, int segmentIndex)
+{
+	BlockRelease(trainID);
+	g_game.railGraph.segments[segmentIndex].reservedBy = trainID;
+	g_game.trains.reservedBlockById[trainID] = segmentIndex;
+}
+
+// a train put on the map takes the block it stands on, or waits in it until the train holding it has left
+static void BlockSeatTrain(TrainID trainID)
+{
+	TrainPool* pool = &g_game.trains;
+	if(!BlockReservationsAreCurrent())
+	{
+		return; // the rebuild seats it
+	}
+	int slot = pool->slotById[trainID];
+	if(pool->states[slot] == TRAIN_STATE_WAITING || pool->states[slot] == TRAIN_STATE_BLOCKED)
+	{
+		pool->states[slot] = TRAIN_STATE_DRIVING; // e.g. a clone of a waiting train, it is in no queue yet
+	}
+	TileCoords tileCoords = pool->routes[slot].tileCurrent;
+	int segmentIndex = g_game.mapTileRailSegments[TileIndexByTileCoords(tileCoords.x, tileCoords.z)];
+	if(segmentIndex < 0)
+	{
+		return;
+	}
+	if(g_game.railGraph.segments[segmentIndex].reservedBy == g_TrainIDNone)
+	{
+		BlockReserve(trainID, segmentIndex);
+	}
+	else if(pool->states[slot] == TRAIN_STATE_DRIVING)
+	{
+		TrainMaterialize(slot); // stops where it is now, event stepping may not have stepped it this tick
+		BlockWaitQueuePush(segmentIndex, trainID);
+		pool->waitingBlockById[trainID] = segmentIndex;
+		pool->states[slot] = TRAIN_STATE_WAITING;
+		pool->waitingCount++;
+	}
+}
+
+static void BlockRemoveTrain(TrainID trainID)
+{
+	TrainPool* pool = &g_game.trains;
+	if(!BlockReservationsAreCurrent())
+	{
+		return;
+	}
+	if(pool->waitingBlockById[trainID] != -1)
+	{
+		if(pool->waitingBlockById[trainID] >= 0)
+		{
+			BlockWaitQueueRemove(pool->waitingBlockById[trainID], trainID);
+		}
+		pool->waitingBlockById[trainID] = -1;
+		pool->waitingCount--;
+	}
+	BlockRelease(trainID);
+}
+
+// after rail changes: wakes every waiting train to look again and seats the trains in slot order
+static void BlockReservationsRebuild(void)
+{
+	TrainPool* pool = &g_game.trains;
+	RailGraph* graph = &g_game.railGraph;
+	for(int segmentIndex = 0; segmentIndex < graph->segmentCount; ++segmentIndex)
+	{
+		graph->segments[segmentIndex].reservedBy = g_TrainIDNone;
+		graph->segments[segmentIndex].firstWaiting = g_TrainIDNone;
+		graph->segments[segmentIndex].lastWaiting = g_TrainIDNone;
+	}
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		TrainID trainID = pool->idBySlot[slot];
+		pool->reservedBlockById[trainID] = -1;
+		pool->waitingBlockById[trainID] = -1;
+		if(pool->states[slot] == TRAIN_STATE_WAITING || pool->states[slot] == TRAIN_STATE_BLOCKED)
+		{
+			TrainResume(slot);
+		}
+	}
+	pool->waitingCount = 0;
+	pool->reservationsGraphVersion = graph->version;
+	pool->reservationsAreDirty = false;
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		BlockSeatTrain(pool->idBySlot[slot]);
+	}
+}
+
+// a train that drove out of its block this tick gives it up, a train blocked this tick gets its block or goes to sleep
+static void BlockResolveTrain(int slot)
+{
+	TrainPool* pool = &g_game.trains;
+	TrainID trainID = pool->idBySlot[slot];
+	int reservedBlock = pool->reservedBlockById[trainID];
+	if(reservedBlock >= 0)
+	{
+		// on the junction in front of the block it got, it keeps the block
+		const TrainRoute* route = &pool->routes[slot];
+		int currentBlock = g_game.mapTileRailSegments[TileIndexByTileCoords(route->tileCurrent.x, route->tileCurrent.z)];
+		int nextBlock = g_game.mapTileRailSegments[TileIndexByTileCoords(route->tileNext.x, route->tileNext.z)];
+		if(currentBlock != reservedBlock && !(currentBlock < 0 && nextBlock == reservedBlock))
+		{
+			BlockRelease(trainID);
+		}
+	}
+	if(pool->states[slot] != TRAIN_STATE_BLOCKED)
+	{
+		return;
+	}
+	int segmentIndex = pool->requestedBlocks[slot];
+	if(segmentIndex < 0)
+	{
+		pool->waitingBlockById[trainID] = g_BlockWaitingForRails;
+		pool->states[slot] = TRAIN_STATE_WAITING;
+		pool->waitingCount++;
+	}
+	else if(g_game.railGraph.segments[segmentIndex].reservedBy == g_TrainIDNone)
+	{
+		BlockReserve(trainID, segmentIndex);
+		TrainResume(slot);
+	}
+	else
+	{
+		BlockWaitQueuePush(segmentIndex, trainID);
+		pool->waitingBlockById[trainID] = segmentIndex;
+		pool->states[slot] = TRAIN_STATE_WAITING;
+		pool->waitingCount++;
+	}
+}
+
+// after the train tick, on one thread in slot order so every run hands out the blocks the same way
+static void BlockReservationsResolve(void)
+{
+	if(!BlockReservationsAreCurrent())
+	{
+		BlockReservationsRebuild();
+	}
+	for(int slot = 0; slot < g_game.trains.count; ++slot)
+	{
+		BlockResolveTrain(slot);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Routing
+//----------------------------------------------------------------------------------------------------------------------
+// forgets all requests, cached routes expire by the graph version
+static void RoutePlannerReset(void)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	for(int i = 0; i < g_RouteRequestMax; ++i)
+	{
+		planner->requests[i].state = ROUTE_REQUEST_FREE;
+	}
+	planner->nextRequest = 0;
+	planner->cacheHits = 0;
+	planner->cacheMisses = 0;
+	g_game.debugRouteRequest = -1;
+}
+
+static void RoutePlannerFree(void)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	MemFree(planner->costs);
+	MemFree(planner->cameFrom);
+	MemFree(planner->seenStamps);
+	MemFree(planner->closedStamps);
+	MemFree(planner->heap);
+	for(int i = 0; i < g_RouteCacheSize; ++i)
+	{
+		MemFree(planner->cache[i].path.steps);
+	}
+	for(int i = 0; i < g_RouteRequestMax; ++i)
+	{
+		MemFree(planner->requests[i].path.steps);
+	}
+	*planner = (RoutePlanner) {0};
+}
+
+static void RoutePlannerReserve(int stepCapacity)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	if(stepCapacity <= planner->stepCapacity)
+	{
+		return;
+	}
+	planner->costs = MemRealloc(planner->costs, stepCapacity * sizeof(float));
+	planner->cameFrom = MemRealloc(planner->cameFrom, stepCapacity * sizeof(int));
+	planner->seenStamps = MemRealloc(planner->seenStamps, stepCapacity * sizeof(unsigned int));
+	planner->closedStamps = MemRealloc(planner->closedStamps, stepCapacity * sizeof(unsigned int));
+	// new entries must not look seen by an earlier search
+	memset(&planner->seenStamps[planner->stepCapacity], 0, (stepCapacity - planner->stepCapacity) * sizeof(unsigned int));
+	memset(&planner->closedStamps[planner->stepCapacity], 0, (stepCapacity - planner->stepCapacity) * sizeof(unsigned int));
+	planner->stepCapacity = stepCapacity;
+}
+
+static void RoutePathPush(RoutePath* path, int step)
+{
+	if(path->stepCount == path->stepCapacity)
+	{
+		path->stepCapacity = path->stepCapacity > 0 ? path->stepCapacity * 2 : 16;
+		path->steps = MemRealloc(path->steps, path->stepCapacity * sizeof(int));
+	}
+	path->steps[path->stepCount++] = step;
+}
+
+static void RoutePathCopy(RoutePath* destination, const RoutePath* source)
+{
+	destination->isFound = source->isFound;
+	destination->cost = source->cost;
+	destination->stepCount = 0;
+	for(int i = 0; i < source->stepCount; ++i)
+	{
+		RoutePathPush(destination, source->steps[i]);
+	}
+}
+
+static void RouteHeapPush(float priority, int step)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	if(planner->heapCount == planner->heapCapacity)
+	{
+		planner->heapCapacity = planner->heapCapacity > 0 ? planner->heapCapacity * 2 : 64;
+		planner->heap = MemRealloc(planner->heap, planner->heapCapacity * sizeof(RouteHeapEntry));
+	}
+	int index = planner->heapCount++;
+	while(index > 0)
+	{
+		int parent = (index - 1) / 2;
+		if(planner->heap[parent].priority <= priority)
+		{
+			break;
+		}
+		planner->heap[index] = planner->heap[parent];
+		index = parent;
+	}
+	planner->heap[index] = (RouteHeapEntry) {priority, step};
+}
+
+static RouteHeapEntry RouteHeapPop(void)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	RouteHeapEntry top = planner->heap[0];
+	RouteHeapEntry last = planner->heap[--planner->heapCount];
+	int index = 0;
+	for(;;)
+	{
+		int child = index * 2 + 1;
+		if(child >= planner->heapCount)
+		{
+			break;
+		}
+		if(child + 1 < planner->heapCount && planner->heap[child + 1].priority < planner->heap[child].priority)
+		{
+			child++;
+		}
+		if(last.priority <= planner->heap[child].priority)
+		{
+			break;
+		}
+		planner->heap[index] = planner->heap[child];
+		index = child;
+	}
+	if(planner->heapCount > 0)
+	{
+		planner->heap[index] = last;
+	}
+	return top;
+}
+
+// straight line distance from where a step starts to the closer end of the target, never more than the rails.
+// One tile less as the segment ends are tiles, not points
+static float RouteHeuristic(int step, int toSegment)
+{
+	const RailGraph* graph = &g_game.railGraph;
+	TileCoords from = TileCoordsByIndex(graph->segments[step / 2].ends[step % 2].tileIndex);
+	float best = -1.0f;
+	for(int endIndex = 0; endIndex < 2; ++endIndex)
+	{
+		TileCoords to = TileCoordsByIndex(graph->segments[toSegment].ends[endIndex].tileIndex);
+		float dx = (float) (to.x - from.x);
+		float dz = (float) (to.z - from.z);
+		float distance = sqrtf(dx * dx + dz * dz);
+		if(best < 0.0f || distance < best)
+		{
+			best = distance;
+		}
+	}
+	return best > 1.0f ? best - 1.0f : 0.0f;
+}
+
+// A* from a step to any step on the target segment. Junctions are only passed where the tile has a connection
+// between the entry and the exit edge, so a train never gets routed through a turn it can't take
+static void RouteSearch(int fromStep, int toSegment, RoutePath* path)
+{
+	const RailGraph* graph = &g_game.railGraph;
+	RoutePlanner* planner = &g_game.routePlanner;
+	path->isFound = false;
+	path->cost = 0;
+	path->stepCount = 0;
+	if(fromStep < 0 || fromStep / 2 >= graph->segmentCount || !graph->segments[fromStep / 2].isUsed ||
+		toSegment < 0 || toSegment >= graph->segmentCount || !graph->segments[toSegment].isUsed)
+	{
+		return;
+	}
+
+	RoutePlannerReserve(graph->segmentCapacity * 2);
+	unsigned int stamp = ++planner->searchStamp;
+	planner->heapCount = 0;
+	planner->costs[fromStep] = 0;
+	planner->cameFrom[fromStep] = -1;
+	planner->seenStamps[fromStep] = stamp;
+	RouteHeapPush(RouteHeuristic(fromStep, toSegment), fromStep);
+
+	while(planner->heapCount > 0)
+	{
+		int step = RouteHeapPop().step;
+		if(planner->closedStamps[step] == stamp)
+		{
+			continue;
+		}
+		planner->closedStamps[step] = stamp;
+
+		if(step / 2 == toSegment)
+		{
+			int stepCount = 0;
+			for(int i = step; i >= 0; i = planner->cameFrom[i])
+			{
+				stepCount++;
+			}
+			for(int i = 0; i < stepCount; ++i)
+			{
+				RoutePathPush(path, 0);
+			}
+			for(int i = step, index = stepCount - 1; i >= 0; i = planner->cameFrom[i], --index)
+			{
+				path->steps[index] = i;
+			}
+			path->isFound = true;
+			path->cost = planner->costs[step];
+			return;
+		}
+
+		const RailSegment* segment = &graph->segments[step / 2];
+		RailSegmentEnd exitEnd = segment->ends[1 - step % 2];
+		if(exitEnd.nodeIndex < 0)
+		{
+			continue; // dead end, trains don't reverse
+		}
+		const RailNode* node = &graph->nodes[exitEnd.nodeIndex];
+		ConnectionsConfig connections = g_game.mapTiles[node->tileIndex].connectionOptions;
+		for(int exitEdge = TILE_EDGE_NONE + 1; exitEdge < TILE_EDGE_COUNT; ++exitEdge)
+		{
+			int nextSegmentIndex = node->segments[exitEdge];
+			if(exitEdge == exitEnd.edge || nextSegmentIndex < 0 ||
+				(connections & g_tileEdgeConnections[exitEnd.edge] & g_tileEdgeConnections[exitEdge]) == 0)
+			{
+				continue;
+			}
+
+			const RailSegment* nextSegment = &graph->segments[nextSegmentIndex];
+			int direction = (nextSegment->ends[0].nodeIndex == exitEnd.nodeIndex && nextSegment->ends[0].edge == exitEdge) ? 0 : 1;
+			int nextStep = nextSegmentIndex * 2 + direction;
+			if(planner->closedStamps[nextStep] == stamp)
+			{
+				continue;
+			}
+			float cost = planner->costs[step] + segment->length + g_trackCurveLengths[exitEnd.edge][exitEdge];
+			if(planner->seenStamps[nextStep] != stamp || cost < planner->costs[nextStep])
+			{
+				planner->seenStamps[nextStep] = stamp;
+				planner->costs[nextStep] = cost;
+				planner->cameFrom[nextStep] = step;
+				RouteHeapPush(cost + RouteHeuristic(nextStep, toSegment), nextStep);
+			}
+		}
+	}
+}
+
+// synchronous planning through the route cache
+static void RoutePlan(int fromStep, int toSegment, RoutePath* path)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	unsigned int cacheIndex = ((unsigned int) fromStep * 2654435761u ^ (unsigned int) toSegment * 40503u) & (unsigned int) (g_RouteCacheSize - 1);
+	RouteCacheEntry* entry = &planner->cache[cacheIndex];
+	if(entry->graphVersion != g_game.railGraph.version || entry->fromStep != fromStep || entry->toSegment != toSegment)
+	{
+		RouteSearch(fromStep, toSegment, &entry->path);
+		entry->graphVersion = g_game.railGraph.version;
+		entry->fromStep = fromStep;
+		entry->toSegment = toSegment;
+		planner->cacheMisses++;
+	}
+	else
+	{
+		planner->cacheHits++;
+	}
+	RoutePathCopy(path, &entry->path);
+}
+
+// queues a route request, -1 if the queue is full. Poll with RouteRequestGetPath and release when done
+static RouteRequestID RouteRequestSubmit(int fromStep, int toSegment)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	for(int i = 0; i < g_RouteRequestMax; ++i)
+	{
+		if(planner->requests[i].state == ROUTE_REQUEST_FREE)
+		{
+			planner->requests[i].state = ROUTE_REQUEST_PENDING;
+			planner->requests[i].fromStep = fromStep;
+			planner->requests[i].toSegment = toSegment;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// NULL while the request is still pending
+static const RoutePath* RouteRequestGetPath(RouteRequestID requestID)
+{
+	const RouteRequest* request = &g_game.routePlanner.requests[requestID];
+	return request->state == ROUTE_REQUEST_DONE ? &request->path : NULL;
+}
+
+static void RouteRequestRelease(RouteRequestID requestID)
+{
+	g_game.routePlanner.requests[requestID].state = ROUTE_REQUEST_FREE;
+}
+
+// works off a bounded number of pending requests, so many trains asking at once never stall a frame
+static void TickRouting(void)
+{
+	RoutePlanner* planner = &g_game.routePlanner;
+	int plansLeft = g_RoutePlansPerFrame;
+	for(int i = 0; i < g_RouteRequestMax && plansLeft > 0; ++i)
+	{
+		int requestIndex = (planner->nextRequest + i) % g_RouteRequestMax;
+		RouteRequest* request = &planner->requests[requestIndex];
+		if(request->state == ROUTE_REQUEST_PENDING)
+		{
+			RoutePlan(request->fromStep, request->toSegment, &request->path);
+			request->state = ROUTE_REQUEST_DONE;
+			plansLeft--;
+			planner->nextRequest = (requestIndex + 1) % g_RouteRequestMax;
+		}
+	}
+}
+
+// step a train on tileCurrent driving to driveToSector drives on, false if it's off the graph
+static bool RouteGetTrainStep(TileCoords tileCurrent, TileSector driveToSector, int* step)
+{
+	const RailGraph* graph = &g_game.railGraph;
+	int tileIndex = TileIndexByTileCoords(tileCurrent.x, tileCurrent.z);
+	TileEdge exitEdge = g_tileSectorToEdge[driveToSector];
+
+	// crossing a junction, the route starts with the segment behind it
+	int nodeIndex = g_game.mapTileRailNodes[tileIndex];
+	if(nodeIndex >= 0)
+	{
+		int segmentIndex = graph->nodes[nodeIndex].segments[exitEdge];
+		if(segmentIndex < 0)
+		{
+			return false;
+		}
+		const RailSegment* segment = &graph->segments[segmentIndex];
+		int direction = (segment->ends[0].nodeIndex == nodeIndex && segment->ends[0].edge == exitEdge) ? 0 : 1;
+		*step = segmentIndex * 2 + direction;
+		return true;
+	}
+
+	int segmentIndex = g_game.mapTileRailSegments[tileIndex];
+	if(segmentIndex < 0)
+	{
+		return false;
+	}
+	const RailSegment* segment = &graph->segments[segmentIndex];
+	int position = 0;
+	while(position < segment->tileCount && segment->tileIndices[position] != tileIndex)
+	{
+		position++;
+	}
+
+	// driving towards ends[1] if the exit edge leads on in segment order
+	TileEdge neighbourEntryEdge;
+	int neighbourIndex = RailGraphGetConnectedNeighbour(tileIndex, exitEdge, &neighbourEntryEdge);
+	bool isTowardsEnd;
+	if(position + 1 < segment->tileCount || segment->isLoop)
+	{
+		isTowardsEnd = neighbourIndex == segment->tileIndices[(position + 1) % segment->tileCount];
+	}
+	else if(segment->ends[1].nodeIndex >= 0)
+	{
+		isTowardsEnd = neighbourIndex == segment->ends[1].tileIndex;
+	}
+	else
+	{
+		isTowardsEnd = exitEdge == segment->ends[1].edge;
+	}
+	*step = segmentIndex * 2 + (isTowardsEnd ? 0 : 1);
+	return true;
+}
+
+// debug: route preview of the first train to the hovered rails, goes through the request queue like any train would
+static void RenderDebugRoute(void)
+{
+	int targetSegment = -1;
+	int fromStep = -1;
+	const TrainRenderSnapshot* snapshot = &g_game.trainSnapshots.buffers[g_game.trainSnapshots.front];
+	if(g_debugWindowOn && snapshot->trainCount > 0 && g_game.hoveredTile.isHit)
+	{
+		targetSegment = g_game.mapTileRailSegments[g_game.hoveredTile.tileIndex];
+	}
+	if(targetSegment < 0 || !RouteGetTrainStep(snapshot->firstTrain.tileCurrent, snapshot->firstTrain.driveToSector, &fromStep))
+	{
+		if(g_game.debugRouteRequest >= 0)
+		{
+			RouteRequestRelease(g_game.debugRouteRequest);
+			g_game.debugRouteRequest = -1;
+		}
+		return;
+	}
+
+	if(g_game.debugRouteRequest < 0 || g_game.debugRouteFromStep != fromStep || g_game.debugRouteTargetSegment != targetSegment)
+	{
+		if(g_game.debugRouteRequest >= 0)
+		{
+			RouteRequestRelease(g_game.debugRouteRequest);
+		}
+		g_game.debugRouteRequest = RouteRequestSubmit(fromStep, targetSegment);
+		g_game.debugRouteFromStep = fromStep;
+		g_game.debugRouteTargetSegment = targetSegment;
+	}
+
+	const RoutePath* path = g_game.debugRouteRequest >= 0 ? RouteRequestGetPath(g_game.debugRouteRequest) : NULL;
+	if(path == NULL || !path->isFound)
+	{
+		return;
+	}
+	for(int i = 0; i < path->stepCount; ++i)
+	{
+		const RailSegment* segment = &g_game.railGraph.segments[path->steps[i] / 2];
+		for(int tile = 0; tile < segment->tileCount; ++tile)
+		{
+			Vector3 position = TileGetCenterPosition(TileCoordsByIndex(segment->tileIndices[tile]));
+			DrawCube(position, 0.2f, 0.2f, 0.2f, COLOR_BLUE);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Snapshots
+//----------------------------------------------------------------------------------------------------------------------
+static inline uint32_t SnapshotAlign(uint32_t offset)
+{
+	return (offset + 7u) & ~7u;
+}
+
+static bool MapChunkHasRails(int chunkIndex)
+{
+	const TileInfo* tiles = &g_game.mapTiles[chunkIndex * g_MapChunkTileCount];
+	for(int i = 0; i < g_MapChunkTileCount; ++i)
+	{
+		if(tiles[i].type != TILE_TYPE_EMPTY)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool SnapshotSave(const char* filePath)
+{
+	SimPipelineWait();
+	const uint32_t tilesSize = g_MapChunkTileCount * sizeof(TileInfo);
+	const uint32_t modelsSize = g_MapChunkTileCount * sizeof(TileModelInfo);
+	int storedChunkCount = 0;
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		storedChunkCount += MapChunkHasRails(chunkIndex) ? 1 : 0;
+	}
+
+	uint32_t chunkTableOffset = SnapshotAlign(sizeof(SnapshotHeader));
+	uint32_t chunkDataOffset = SnapshotAlign(chunkTableOffset + storedChunkCount * sizeof(SnapshotChunkEntry));
+	uint32_t trainsOffset = SnapshotAlign(chunkDataOffset + storedChunkCount * SnapshotAlign(tilesSize + modelsSize));
+	uint32_t fileSize = trainsOffset + g_game.trains.count * sizeof(TrainInfo);
+	unsigned char* data = MemAlloc(fileSize);
+
+	SnapshotHeader* header = (SnapshotHeader*) data;
+	*header = (SnapshotHeader)
+	{
+		.magic = {'R', 'A', 'Y', 'L'},
+		.version = g_SnapshotVersion,
+		.tileInfoSize = sizeof(TileInfo),
+		.trainInfoSize = sizeof(TrainInfo),
+		.mapGridSize = g_MapGridSize,
+		.chunkSize = g_MapChunkSize,
+		.storedChunkCount = storedChunkCount,
+		.trainCount = g_game.trains.count,
+		.chunkTableOffset = chunkTableOffset,
+		.trainsOffset = trainsOffset
+	};
+
+	SnapshotChunkEntry* chunkTable = (SnapshotChunkEntry*) (data + chunkTableOffset);
+	uint32_t offset = chunkDataOffset;
+	int entryIndex = 0;
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		if(!MapChunkHasRails(chunkIndex))
+		{
+			continue;
+		}
+		chunkTable[entryIndex++] = (SnapshotChunkEntry) {chunkIndex, offset, offset + tilesSize, 0};
+		memcpy(data + offset, &g_game.mapTiles[chunkIndex * g_MapChunkTileCount], tilesSize);
+		memcpy(data + offset + tilesSize, &g_game.mapTileModels[chunkIndex * g_MapChunkTileCount], modelsSize);
+		offset += SnapshotAlign(tilesSize + modelsSize);
+	}
+
+	TrainInfo* trains = (TrainInfo*) (data + trainsOffset);
+	for(int slot = 0; slot < g_game.trains.count; ++slot)
+	{
+		trains[slot] = TrainGetInfoBySlot(slot);
+	}
+
+	bool isSaved = SaveFileData(filePath, data, (int) fileSize);
+	MemFree(data);
+	#if defined(PLATFORM_WEB)
+		// flush the IDBFS mount to IndexedDB
+		EM_ASM(FS.syncfs(false, function(error) { if(error) console.log(error); }););
+	#endif
+	TraceLog(LOG_INFO, "===> snapshot: saved %d chunks, %d trains to %s (%u bytes)", storedChunkCount, g_game.trains.count, filePath, fileSize);
+	return isSaved;
+}
+
+// the whole file as one block, mapped where the platform allows it
+static unsigned char* SnapshotMapFile(const char* filePath, int* dataSize)
+{
+	#if defined(SUPPORT_SNAPSHOT_MMAP)
+		int file = open(filePath, O_RDONLY);
+		if(file < 0)
+		{
+			return NULL;
+		}
+		struct stat fileStat;
+		void* data = MAP_FAILED;
+		if(fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+		{
+			data = mmap(NULL, (size_t) fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		}
+		close(file);
+		if(data == MAP_FAILED)
+		{
+			return NULL;
+		}
+		*dataSize = (int) fileStat.st_size;
+		return data;
+	#else
+		return LoadFileData(filePath, dataSize);
+	#endif
+}
+
+static void SnapshotUnmapFile(unsigned char* data, int dataSize)
+{
+	#if defined(SUPPORT_SNAPSHOT_MMAP)
+		munmap(data, (size_t) dataSize);
+	#else
+		(void) dataSize;
+		UnloadFileData(data);
+	#endif
+}
+
+// checks the whole snapshot before the running game gets replaced
+static bool SnapshotValidate(const unsigned char* data, int dataSize)
+{
+	const uint32_t tilesSize = g_MapChunkTileCount * sizeof(TileInfo);
+	const uint32_t modelsSize = g_MapChunkTileCount * sizeof(TileModelInfo);
+	const SnapshotHeader* header = (const SnapshotHeader*) data;
+	if(dataSize < (int) sizeof(SnapshotHeader) || memcmp(header->magic, "RAYL", 4) != 0)
+	{
+		TraceLog(LOG_WARNING, "===> snapshot: not a snapshot file");
+		return false;
+	}
+	if(header->version != g_SnapshotVersion || header->tileInfoSize != sizeof(TileInfo) || header->trainInfoSize != sizeof(TrainInfo))
+	{
+		TraceLog(LOG_WARNING, "===> snapshot: version %u not supported", header->version);
+		return false;
+	}
+	if(header->chunkSize != g_MapChunkSize || header->mapGridSize < g_MapGridSizeMin || header->mapGridSize > g_MapGridSizeMax ||
+		header->mapGridSize % g_MapChunkSize != 0)
+	{
+		TraceLog(LOG_WARNING, "===> snapshot: invalid map size %d", header->mapGridSize);
+		return false;
+	}
+
+	int chunksPerSide = header->mapGridSize / g_MapChunkSize;
+	uint64_t chunkTableEnd = (uint64_t) header->chunkTableOffset + (uint64_t) header->storedChunkCount * sizeof(SnapshotChunkEntry);
+	uint64_t trainsEnd = (uint64_t) header->trainsOffset + (uint64_t) header->trainCount * sizeof(TrainInfo);
+	if(header->storedChunkCount < 0 || header->storedChunkCount > chunksPerSide * chunksPerSide || header->trainCount < 0 ||
+		header->chunkTableOffset % 8 != 0 || header->trainsOffset % 8 != 0 ||
+		chunkTableEnd > (uint64_t) dataSize || trainsEnd > (uint64_t) dataSize)
+	{
+		TraceLog(LOG_WARNING, "===> snapshot: truncated or corrupt");
+		return false;
+	}
+
+	const SnapshotChunkEntry* chunkTable = (const SnapshotChunkEntry*) (data + header->chunkTableOffset);
+	for(int i = 0; i < header->storedChunkCount; ++i)
+	{
+		const SnapshotChunkEntry* entry = &chunkTable[i];
+		if(entry->chunkIndex < 0 || entry->chunkIndex >= chunksPerSide * chunksPerSide ||
+			(uint64_t) entry->tilesOffset + tilesSize > (uint64_t) dataSize || (uint64_t) entry->modelsOffset + modelsSize > (uint64_t) dataSize)
+		{
+			TraceLog(LOG_WARNING, "===> snapshot: corrupt chunk table");
+			return false;
+		}
+		const TileInfo* tiles = (const TileInfo*) (data + entry->tilesOffset);
+		const TileModelInfo* models = data + entry->modelsOffset;
+		for(int tile = 0; tile < g_MapChunkTileCount; ++tile)
+		{
+			if(tiles[tile].type > TILE_TYPE_TODO || (tiles[tile].connectionOptions & ~g_ConnectionsConfigAll) != 0 ||
+				(tiles[tile].connectionsActive & ~g_ConnectionsConfigAll) != 0 || TileModelInfoGetModelID(models[tile]) >= g_RailsModelCount)
+			{
+				TraceLog(LOG_WARNING, "===> snapshot: corrupt tile %d in chunk %d", tile, entry->chunkIndex);
+				return false;
+			}
+		}
+	}
+
+	const TrainInfo* trains = (const TrainInfo*) (data + header->trainsOffset);
+	for(int i = 0; i < header->trainCount; ++i)
+	{
+		const TrainInfo* train = &trains[i];
+		const TileCoords tiles[3] = {train->tileCurrent, train->tilePrevious, train->tileNext};
+		for(int t = 0; t < 3; ++t)
+		{
+			if(tiles[t].x < 0 || tiles[t].z < 0 || tiles[t].x >= header->mapGridSize || tiles[t].z >= header->mapGridSize)
+			{
+				TraceLog(LOG_WARNING, "===> snapshot: train %d off the map", i);
+				return false;
+			}
+		}
+		// the connection is a single ConnectionDirection, not a set of them
+		bool isConnectionValid = train->tileConnectionUsed != 0 && (train->tileConnectionUsed & (train->tileConnectionUsed - 1)) == 0 &&
+			(train->tileConnectionUsed & ~g_ConnectionsConfigAll) == 0;
+		if(train->state > TRAIN_STATE_WAITING || train->modelID >= MODEL_COUNT || !isConnectionValid ||
+			train->driveFromSector > TILE_SECTOR_NE || train->driveToSector > TILE_SECTOR_NE)
+		{
+			TraceLog(LOG_WARNING, "===> snapshot: corrupt train %d", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+// replaces the running game, keeps it when the file can't be used
+static bool SnapshotLoad(const char* filePath)
+{
+	SimPipelineWait();
+	double startTime = GetTime();
+	int dataSize = 0;
+	unsigned char* data = SnapshotMapFile(filePath, &dataSize);
+	if(data == NULL)
+	{
+		TraceLog(LOG_WARNING, "===> snapshot: can't read %s", filePath);
+		return false;
+	}
+	if(!SnapshotValidate(data, dataSize))
+	{
+		SnapshotUnmapFile(data, dataSize);
+		return false;
+	}
+
+	const SnapshotHeader* header = (const SnapshotHeader*) data;
+	GameplayClearState(header->mapGridSize);
+
+	// tiles are stored chunk-major like in memory, every chunk is a single copy
+	const uint32_t tilesSize = g_MapChunkTileCount * sizeof(TileInfo);
+	const uint32_t modelsSize = g_MapChunkTileCount * sizeof(TileModelInfo);
+	const SnapshotChunkEntry* chunkTable = (const SnapshotChunkEntry*) (data + header->chunkTableOffset);
+	for(int i = 0; i < header->storedChunkCount; ++i)
+	{
+		int firstTileIndex = chunkTable[i].chunkIndex * g_MapChunkTileCount;
+		memcpy(&g_game.mapTiles[firstTileIndex], data + chunkTable[i].tilesOffset, tilesSize);
+		memcpy(&g_game.mapTileModels[firstTileIndex], data + chunkTable[i].modelsOffset, modelsSize);
+		for(int tileIndex = firstTileIndex; tileIndex < firstTileIndex + g_MapChunkTileCount; ++tileIndex)
+		{
+			MapChunkSyncTile(tileIndex);
+		}
+	}
+	RailGraphRebuild();
+
+	const TrainInfo* trains = (const TrainInfo*) (data + header->trainsOffset);
+	for(int i = 0; i < header->trainCount; ++i)
+	{
+		TrainSpawn(trains[i]);
+	}
+	TrainRenderSnapshotsRewrite();
+
+	TraceLog(LOG_INFO, "===> snapshot: loaded %d chunks, %d trains from %s in %.2f ms", header->storedChunkCount, header->trainCount, filePath, (GetTime() - startTime) * 1000.0);
+	SnapshotUnmapFile(data, dataSize);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Replay
+//----------------------------------------------------------------------------------------------------------------------
+// the map the replay starts from, stored next to it
+static const char* ReplayGetSnapshotFilePath(const char* filePath)
+{
+	return TextFormat("%s.snapshot", filePath);
+}
+
+static inline bool ReplayTileIsOnMap(TileCoords coords)
+{
+	return coords.x >= 0 && coords.z >= 0 && coords.x < g_MapGridSize && coords.z < g_MapGridSize;
+}
+
+// the one place player actions change the game, live and on playback
+static void GameCommandExecute(const GameCommand* command)
+{
+	switch (command->type)
+	{
+		case GAME_COMMAND_BRUSH_PAINT:
+			SectorTrailPaintAt(command->params.brush.coords, command->params.brush.sector);
+			break;
+		case GAME_COMMAND_BRUSH_RELEASE:
+			BrushStrokeCommit(false);
+			break;
+		case GAME_COMMAND_TILE_CLEAR:
+			TileClearRails(command->params.tile.x, command->params.tile.z);
+			break;
+		case GAME_COMMAND_TRAIN_SPAWN:
+			TrainSpawn(command->params.train);
+			break;
+		case GAME_COMMAND_TRAIN_DESPAWN:
+			TrainDespawn(g_game.trains.idBySlot[command->params.trainSlot]);
+			break;
+		case GAME_COMMAND_CAMERA_SET:
+			g_game.cameraControlValues = command->params.camera;
+			CameraUpdateFromControlValues();
+			break;
+		default:
+			break;
+	}
+}
+
+// recorded commands come from a file, checked against the current game before they run
+static bool ReplayCommandIsValid(const GameCommand* command)
+{
+	switch (command->type)
+	{
+		case GAME_COMMAND_BRUSH_PAINT:
+			return ReplayTileIsOnMap(command->params.brush.coords) && command->params.brush.sector <= TILE_SECTOR_NE;
+		case GAME_COMMAND_TILE_CLEAR:
+			return ReplayTileIsOnMap(command->params.tile);
+		case GAME_COMMAND_TRAIN_SPAWN:
+			return ReplayTileIsOnMap(command->params.train.tileCurrent) && ReplayTileIsOnMap(command->params.train.tilePrevious) &&
+				ReplayTileIsOnMap(command->params.train.tileNext) && command->params.train.modelID < MODEL_COUNT &&
+				command->params.train.driveFromSector <= TILE_SECTOR_NE && command->params.train.driveToSector <= TILE_SECTOR_NE;
+		case GAME_COMMAND_TRAIN_DESPAWN:
+			return command->params.trainSlot >= 0 && command->params.trainSlot < g_game.trains.count;
+		case GAME_COMMAND_BRUSH_RELEASE:
+		case GAME_COMMAND_CAMERA_SET:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void ReplayReserve(int recordCapacity, int frameCapacity)
+{
+	if(recordCapacity > g_replay.recordCapacity)
+	{
+		g_replay.records = MemRealloc(g_replay.records, recordCapacity * sizeof(ReplayRecord));
+		g_replay.recordCapacity = recordCapacity;
+	}
+	if(frameCapacity > g_replay.frameCapacity)
+	{
+		g_replay.frameTicks = MemRealloc(g_replay.frameTicks, frameCapacity * sizeof(uint8_t));
+		g_replay.frameCapacity = frameCapacity;
+	}
+}
+
+// player input goes through here and gets recorded while a recording runs. During playback the replay drives the game
+static void GameCommandSubmit(GameCommand command)
+{
+	// commands come after the ticks of the frame, as they do without the pipeline. Painting only extends the brush
+	// trail and the camera is not simulated, those don't wait while the player holds the button or moves the view
+	if(command.type != GAME_COMMAND_BRUSH_PAINT && command.type != GAME_COMMAND_CAMERA_SET)
+	{
+		SimPipelineWait();
+	}
+	if(g_replay.state == REPLAY_STATE_PLAYING)
+	{
+		return;
+	}
+	if(g_replay.state == REPLAY_STATE_RECORDING)
+	{
+		if(g_replay.recordCount == g_replay.recordCapacity)
+		{
+			ReplayReserve(g_replay.recordCapacity > 0 ? g_replay.recordCapacity * 2 : g_ReplayInitialCapacity, 0);
+		}
+		g_replay.records[g_replay.recordCount++] = (ReplayRecord)
+		{
+			.frame = g_replay.frame,
+			.command = command
+		};
+	}
+	GameCommandExecute(&command);
+}
+
+static uint32_t ReplayHashBytes(uint32_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = data;
+	for(size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// FNV-1a over the trains, playback ends with the recorded value when the simulation ran the same way
+static uint32_t ReplayGetStateChecksum(void)
+{
+	const TrainPool* pool = &g_game.trains;
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		TrainMaterialize(slot);
+	}
+	uint32_t hash = ReplayHashBytes(2166136261u, &pool->count, sizeof(pool->count));
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		hash = ReplayHashBytes(hash, &pool->states[slot], sizeof(pool->states[slot]));
+		hash = ReplayHashBytes(hash, &pool->pathProgressNormalized[slot], sizeof(pool->pathProgressNormalized[slot]));
+		hash = ReplayHashBytes(hash, &pool->routes[slot].tileCurrent, sizeof(pool->routes[slot].tileCurrent));
+		hash = ReplayHashBytes(hash, &pool->renderInfos[slot].modelPosition, sizeof(pool->renderInfos[slot].modelPosition));
+	}
+	return hash;
+}
+
+// takes effect at the start of the next frame
+static void ReplayRequest(ReplayState state, const char* filePath)
+{
+	g_replay.pendingState = state;
+	g_replay.hasPendingState = true;
+	g_replay.pendingFilePath = filePath;
+}
+
+static void ReplayRecordStart(void)
+{
+	// the saved map gets loaded right away, so the recording runs from exactly the state playback starts with
+	CameraControlValues cameraControlValues = g_game.cameraControlValues;
+	const char* snapshotFilePath = ReplayGetSnapshotFilePath(g_replay.filePath);
+	if(!SnapshotSave(snapshotFilePath) || !SnapshotLoad(snapshotFilePath))
+	{
+		TraceLog(LOG_WARNING, "===> replay: can't store the starting map, not recording");
+		return;
+	}
+	g_replay.state = REPLAY_STATE_RECORDING;
+	g_replay.recordCount = 0;
+	g_replay.frameCount = 0;
+	g_replay.frame = 0;
+	GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_CAMERA_SET, .params.camera = cameraControlValues});
+	TraceLog(LOG_INFO, "===> replay: recording to %s", g_replay.filePath);
+}
+
+static bool ReplayRecordStop(void)
+{
+	uint32_t recordsOffset = SnapshotAlign(sizeof(ReplayHeader));
+	uint32_t frameTicksOffset = recordsOffset + g_replay.recordCount * sizeof(ReplayRecord);
+	uint32_t fileSize = frameTicksOffset + g_replay.frameCount * sizeof(uint8_t);
+	unsigned char* data = MemAlloc(fileSize);
+	*(ReplayHeader*) data = (ReplayHeader)
+	{
+		.magic = {'R', 'P', 'L', 'Y'},
+		.version = g_ReplayVersion,
+		.recordSize = sizeof(ReplayRecord),
+		.simTickRate = g_game.simClock.tickRate,
+		.frameCount = g_replay.frameCount,
+		.recordCount = g_replay.recordCount,
+		.recordsOffset = recordsOffset,
+		.frameTicksOffset = frameTicksOffset,
+		.stateChecksum = ReplayGetStateChecksum()
+	};
+	memcpy(data + recordsOffset, g_replay.records, g_replay.recordCount * sizeof(ReplayRecord));
+	memcpy(data + frameTicksOffset, g_replay.frameTicks, g_replay.frameCount * sizeof(uint8_t));
+
+	bool isSaved = SaveFileData(g_replay.filePath, data, (int) fileSize);
+	MemFree(data);
+	#if defined(PLATFORM_WEB)
+		// flush the IDBFS mount to IndexedDB
+		EM_ASM(FS.syncfs(false, function(error) { if(error) console.log(error); }););
+	#endif
+	TraceLog(LOG_INFO, "===> replay: saved %d frames, %d commands to %s (%u bytes)", g_replay.frameCount, g_replay.recordCount, g_replay.filePath, fileSize);
+	g_replay.state = REPLAY_STATE_OFF;
+	return isSaved;
+}
+
+static bool ReplayValidate(const unsigned char* data, int dataSize)
+{
+	const ReplayHeader* header = (const ReplayHeader*) data;
+	if(dataSize < (int) sizeof(ReplayHeader) || memcmp(header->magic, "RPLY", 4) != 0)
+	{
+		TraceLog(LOG_WARNING, "===> replay: not a replay file");
+		return false;
+	}
+	if(header->version != g_ReplayVersion || header->recordSize != sizeof(ReplayRecord))
+	{
+		TraceLog(LOG_WARNING, "===> replay: version %u not supported", header->version);
+		return false;
+	}
+	uint64_t recordsEnd = (uint64_t) header->recordsOffset + (uint64_t) header->recordCount * sizeof(ReplayRecord);
+	uint64_t frameTicksEnd = (uint64_t) header->frameTicksOffset + (uint64_t) header->frameCount * sizeof(uint8_t);
+	if(header->recordCount < 0 || header->frameCount < 0 || recordsEnd > (uint64_t) dataSize || frameTicksEnd > (uint64_t) dataSize)
+	{
+		TraceLog(LOG_WARNING, "===> replay: truncated or corrupt");
+		return false;
+	}
+
+	// the records may sit unaligned in the file, they get copied out one by one
+	int previousFrame = 0;
+	for(int i = 0; i < header->recordCount; ++i)
+	{
+		ReplayRecord record;
+		memcpy(&record, data + header->recordsOffset + i * sizeof(ReplayRecord), sizeof(ReplayRecord));
+		if(record.frame < previousFrame || record.frame >= header->frameCount || record.command.type >= GAME_COMMAND_COUNT)
+		{
+			TraceLog(LOG_WARNING, "===> replay: corrupt record %d", i);
+			return false;
+		}
+		previousFrame = record.frame;
+	}
+	for(int frame = 0; frame < header->frameCount; ++frame)
+	{
+		if(data[header->frameTicksOffset + frame] > g_SimMaxTicksPerFrame)
+		{
+			TraceLog(LOG_WARNING, "===> replay: corrupt frame %d", frame);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool ReplayPlayStart(void)
+{
+	int dataSize = 0;
+	unsigned char* data = LoadFileData(g_replay.filePath, &dataSize);
+	if(data == NULL)
+	{
+		TraceLog(LOG_WARNING, "===> replay: can't read %s", g_replay.filePath);
+		return false;
+	}
+	if(!ReplayValidate(data, dataSize) || !SnapshotLoad(ReplayGetSnapshotFilePath(g_replay.filePath)))
+	{
+		UnloadFileData(data);
+		return false;
+	}
+
+	const ReplayHeader* header = (const ReplayHeader*) data;
+	ReplayReserve(header->recordCount, header->frameCount);
+	memcpy(g_replay.records, data + header->recordsOffset, header->recordCount * sizeof(ReplayRecord));
+	memcpy(g_replay.frameTicks, data + header->frameTicksOffset, header->frameCount * sizeof(uint8_t));
+	g_replay.recordCount = header->recordCount;
+	g_replay.frameCount = header->frameCount;
+	g_game.simClock.tickRate = Clamp(header->simTickRate, g_SimTickRateMin, g_SimTickRateMax);
+	g_replay.recordedStateChecksum = header->stateChecksum;
+	UnloadFileData(data);
+
+	g_replay.state = REPLAY_STATE_PLAYING;
+	g_replay.frame = 0;
+	g_replay.nextRecord = 0;
+	g_replay.hasDiverged = false;
+	g_replay.startTime = GetTime();
+	#if !defined(PLATFORM_WEB)
+		SetTargetFPS(0); // as fast as it renders, the browser paces the web build regardless
+	#endif
+	TraceLog(LOG_INFO, "===> replay: playing %d frames, %d commands from %s", g_replay.frameCount, g_replay.recordCount, g_replay.filePath);
+	return true;
+}
+
+static void ReplayPlayStop(void)
+{
+	double duration = GetTime() - g_replay.startTime;
+	bool isComplete = g_replay.frame >= g_replay.frameCount;
+	bool isMatching = isComplete && !g_replay.hasDiverged && ReplayGetStateChecksum() == g_replay.recordedStateChecksum;
+	double frameTime = g_replay.frame > 0 ? duration * 1000.0 / (double) g_replay.frame : 0.0;
+	TraceLog(LOG_INFO, "===> replay: %d frames, %llu ticks in %.2f s, %.3f ms per frame, %s", g_replay.frame,
+		(unsigned long long) g_game.simClock.tickCount, duration, frameTime, isMatching ? "same end state" : isComplete ? "DIFFERENT end state" : "stopped");
+	if(g_replay.isQuitWhenDone)
+	{
+		// one line for scripts comparing builds
+		printf("replay=%s frames=%d ticks=%llu seconds=%.3f ms_per_frame=%.3f deterministic=%d\n", g_replay.filePath, g_replay.frame,
+			(unsigned long long) g_game.simClock.tickCount, duration, frameTime, isMatching ? 1 : 0);
+		#if defined(SUPPORT_PROFILER)
+			ProfileWriteCsv(g_ProfilerCsvFilePath);
+		#endif
+		g_replay.isQuitRequested = true;
+	}
+	g_replay.state = REPLAY_STATE_OFF;
+	#if !defined(PLATFORM_WEB)
+		SetTargetFPS(60);
+	#endif
+}
+
+// starts and stops what got requested, ends a playback after its last frame
+static void ReplayFrameBegin(void)
+{
+	if(g_replay.hasPendingState)
+	{
+		g_replay.hasPendingState = false;
+		if(g_replay.state == REPLAY_STATE_RECORDING)
+		{
+			ReplayRecordStop();
+		}
+		else if(g_replay.state == REPLAY_STATE_PLAYING)
+		{
+			ReplayPlayStop();
+		}
+
+		g_replay.filePath = g_replay.pendingFilePath;
+		if(g_replay.pendingState == REPLAY_STATE_RECORDING)
+		{
+			ReplayRecordStart();
+		}
+		else if(g_replay.pendingState == REPLAY_STATE_PLAYING && !ReplayPlayStart())
+		{
+			g_replay.isQuitRequested = g_replay.isQuitWhenDone;
+		}
+	}
+	if(g_replay.state == REPLAY_STATE_PLAYING && g_replay.frame >= g_replay.frameCount)
+	{
+		ReplayPlayStop();
+	}
+}
+
+// the commands recorded in this frame, run after the simulation ticks of the frame like they were recorded
+static void ReplayPlayFrameCommands(void)
+{
+	if(g_replay.state != REPLAY_STATE_PLAYING)
+	{
+		return;
+	}
+	while(g_replay.nextRecord < g_replay.recordCount && g_replay.records[g_replay.nextRecord].frame == g_replay.frame)
+	{
+		const ReplayRecord* record = &g_replay.records[g_replay.nextRecord++];
+		if(ReplayCommandIsValid(&record->command))
+		{
+			GameCommandExecute(&record->command);
+		}
+		else if(!g_replay.hasDiverged)
+		{
+			TraceLog(LOG_WARNING, "===> replay: diverged in frame %d", g_replay.frame);
+			g_replay.hasDiverged = true;
+		}
+	}
+}
+
+static void ReplayFrameEnd(void)
+{
+	if(g_replay.state == REPLAY_STATE_RECORDING)
+	{
+		if(g_replay.frameCount == g_replay.frameCapacity)
+		{
+			ReplayReserve(0, g_replay.frameCapacity > 0 ? g_replay.frameCapacity * 2 : g_ReplayInitialCapacity);
+		}
+		g_replay.frameTicks[g_replay.frameCount++] = (uint8_t) g_game.simClock.ticksLastFrame;
+	}
+	if(g_replay.state != REPLAY_STATE_OFF)
+	{
+		g_replay.frame++;
+	}
+}
+
+// a recording still running gets saved
+static void ReplayFree(void)
+{
+	if(g_replay.state == REPLAY_STATE_RECORDING)
+	{
+		ReplayRecordStop();
+	}
+	MemFree(g_replay.records);
+	MemFree(g_replay.frameTicks);
+	g_replay = (Replay) {0};
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Rendering
+//----------------------------------------------------------------------------------------------------------------------
+// CPU side arrays of meshes built at runtime. GL 1.1 draws from them and UnloadMesh frees them, so they are heap
+// memory there. Everywhere else only the GPU buffers are needed after UploadMesh, the arrays are frame arena memory
+// from RenderMeshArraysBegin on and given back by RenderMeshArraysUpload, so a frame rebuilding many chunks only holds
+// the arrays of one mesh at a time
+static void* RenderMeshArrayAlloc(size_t size)
+{
+	return rlGetVersion() == RL_OPENGL_11 ? MemAlloc((unsigned int) size) : MemoryArenaAlloc(&g_memory.frameArena, size);
+}
+
+static MemoryArenaMark RenderMeshArraysBegin(void)
+{
+	return MemoryArenaGetMark(&g_memory.frameArena);
+}
+
+static void RenderMeshArraysUpload(Mesh* mesh, MemoryArenaMark mark)
+{
+	UploadMesh(mesh, false);
+	if(rlGetVersion() != RL_OPENGL_11)
+	{
+		mesh->vertices = mesh->normals = mesh->texcoords = NULL;
+		mesh->colors = NULL;
+		mesh->indices = NULL;
+		MemoryArenaRewind(&g_memory.frameArena, mark);
+	}
+}
+
+// instancing needs shaders (not available on GL 1.1) and the shader must have compiled, else raylib hands back its default
+static bool RenderInstancingIsSupported(void)
+{
+	return 	rlGetVersion() != RL_OPENGL_11 &&
+			g_game.assetInstancingShader.id != rlGetShaderIdDefault() &&
+			g_game.assetInstancingShader.locs[SHADER_LOC_MATRIX_MODEL] != -1;
+}
+
+// same transform composition as DrawModelEx: model transform, then rotation around up axis, then translation
+static inline Matrix RenderGetModelTransform(Model model, Vector3 position, float rotationInDegree)
+{
+	Matrix matRotation = MatrixRotateY(rotationInDegree * DEG2RAD);
+	Matrix matTranslation = MatrixTranslate(position.x, position.y, position.z);
+	return MatrixMultiply(model.transform, MatrixMultiply(matRotation, matTranslation));
+}
+
+// one instanced draw call per mesh of the model, materials get the instancing shader swapped in
+static void RenderModelInstanced(Model model, const Matrix* transforms, int instanceCount)
+{
+	if(instanceCount <= 0)
+	{
+		return;
+	}
+
+	for (int meshIndex = 0; meshIndex < model.meshCount; meshIndex++)
+	{
+		Material material = model.materials[model.meshMaterial[meshIndex]];
+		material.shader = g_game.assetInstancingShader;
+		DrawMeshInstanced(model.meshes[meshIndex], material, transforms, instanceCount);
+		ProfileCountDraws(1, model.meshes[meshIndex].triangleCount * instanceCount);
+	}
+}
+
+// the instance attributes need the train shader, on top of what RenderInstancingIsSupported checks
+static bool RenderTrainInstancingIsSupported(void)
+{
+	return 	RenderInstancingIsSupported() &&
+			g_game.assetTrainShader.id != rlGetShaderIdDefault() &&
+			g_game.assetTrainShaderPreviousLoc != -1 &&
+			g_game.assetTrainShaderCurrentLoc != -1;
+}
+
+// what drawing needs of the trains into the back snapshot, false if nothing changed since the front one.
+// Runs on the simulation thread in pipelined frames
+static bool TrainRenderSnapshotWrite(void)
+{
+	TrainRenderSnapshots* snapshots = &g_game.trainSnapshots;
+	const TrainRenderSnapshot* front = &snapshots->buffers[snapshots->front];
+	TrainRenderSnapshot* back = &snapshots->buffers[1 - snapshots->front];
+	TrainPool* pool = &g_game.trains;
+	if(!g_game.trainInstances.isDirty && front->tickCount == pool->tickCount && front->railGraphVersion == g_game.railGraph.version)
+	{
+		return false;
+	}
+	if(back->capacity < pool->capacity)
+	{
+		back->trains = MemRealloc(back->trains, pool->capacity * sizeof(TrainRenderInfo));
+		back->capacity = pool->capacity;
+	}
+
+	back->count = 0;
+	for(int i = 0; i < pool->count; ++i)
+	{
+		if(pool->states[i] != TRAIN_STATE_DISABLED && pool->states[i] != TRAIN_STATE_HIDDEN)
+		{
+			back->trains[back->count++] = TrainGetRenderInfo(i);
+		}
+	}
+	back->tickCount = pool->tickCount;
+	back->version = front->version + 1;
+	back->trainCount = pool->count;
+	back->waitingCount = pool->waitingCount;
+	back->firstTrain = pool->count > 0 ? TrainGetInfoBySlot(0) : (TrainInfo) {0};
+
+	const RailGraph* graph = &g_game.railGraph;
+	if(back->blockCapacity < graph->segmentCapacity)
+	{
+		back->blocks = MemRealloc(back->blocks, graph->segmentCapacity * sizeof(BlockViewState));
+		back->blockCapacity = graph->segmentCapacity;
+	}
+	back->areBlocksCurrent = BlockReservationsAreCurrent();
+	back->railGraphVersion = graph->version;
+	back->blockCount = back->areBlocksCurrent ? graph->segmentCount : 0;
+	for(int segmentIndex = 0; segmentIndex < back->blockCount; ++segmentIndex)
+	{
+		const RailSegment* segment = &graph->segments[segmentIndex];
+		back->blocks[segmentIndex] = segment->firstWaiting != g_TrainIDNone ? BLOCK_VIEW_WAITED_FOR :
+			segment->reservedBy != g_TrainIDNone ? BLOCK_VIEW_RESERVED : BLOCK_VIEW_FREE;
+	}
+	g_game.trainInstances.isDirty = false;
+	return true;
+}
+
+static void TrainRenderSnapshotSwap(void)
+{
+	g_game.trainSnapshots.front = 1 - g_game.trainSnapshots.front;
+}
+
+// after the game got replaced, the next frame draws the new trains. A back snapshot the ticks wrote of the old game
+// must not be swapped in, its coordinates are from the old map
+static void TrainRenderSnapshotsRewrite(void)
+{
+	#if defined(SIM_MULTITHREADED)
+		g_simPipeline.isSnapshotWritten = false;
+	#endif
+	g_game.trainInstances.isDirty = true;
+	TrainRenderSnapshotWrite();
+	TrainRenderSnapshotSwap();
+}
+
+static void TrainRenderSnapshotsFree(void)
+{
+	for(int i = 0; i < 2; ++i)
+	{
+		MemFree(g_game.trainSnapshots.buffers[i].trains);
+		MemFree(g_game.trainSnapshots.buffers[i].blocks);
+	}
+	g_game.trainSnapshots = (TrainRenderSnapshots) {0};
+}
+
+static void TrainInstancesFree(void)
+{
+	TrainInstanceBuffer* buffer = &g_game.trainInstances;
+	for(int i = 0; i < 2; ++i)
+	{
+		if(buffer->vboIds[i] != 0)
+		{
+			rlUnloadVertexBuffer(buffer->vboIds[i]);
+		}
+	}
+	MemFree(buffer->instances);
+	*buffer = (TrainInstanceBuffer) {0};
+}
+
+// gathers the snapshot's trains grouped by model (counting sort) and uploads them into the buffer not used last frame
+static void TrainInstancesUpload(void)
+{
+	TrainInstanceBuffer* buffer = &g_game.trainInstances;
+	const TrainRenderSnapshot* snapshot = &g_game.trainSnapshots.buffers[g_game.trainSnapshots.front];
+	if(buffer->capacity < snapshot->capacity)
+	{
+		buffer->instances = MemRealloc(buffer->instances, snapshot->capacity * sizeof(TrainInstance));
+		buffer->capacity = snapshot->capacity;
+	}
+
+	memset(buffer->modelInstanceCount, 0, sizeof(buffer->modelInstanceCount));
+	for(int i = 0; i < snapshot->count; ++i)
+	{
+		buffer->modelInstanceCount[snapshot->trains[i].modelID]++;
+	}
+	int modelNext[MODEL_COUNT];
+	buffer->instanceCount = 0;
+	for(int modelID = 0; modelID < MODEL_COUNT; ++modelID)
+	{
+		buffer->modelFirst[modelID] = buffer->instanceCount;
+		modelNext[modelID] = buffer->instanceCount;
+		buffer->instanceCount += buffer->modelInstanceCount[modelID];
+	}
+	for(int i = 0; i < snapshot->count; ++i)
+	{
+		const TrainRenderInfo* renderInfo = &snapshot->trains[i];
+		buffer->instances[modelNext[renderInfo->modelID]++] = (TrainInstance)
+		{
+			.previousPosition = renderInfo->previousModelPosition,
+			.previousRotationInDegree = renderInfo->previousModelRotationInDegree,
+			.position = renderInfo->modelPosition,
+			.rotationInDegree = renderInfo->modelRotationInDegree,
+		};
+	}
+
+	// both buffers grow together, to the pool capacity so growing stays rare
+	if(buffer->instanceCount > buffer->vboCapacity)
+	{
+		for(int i = 0; i < 2; ++i)
+		{
+			if(buffer->vboIds[i] != 0)
+			{
+				rlUnloadVertexBuffer(buffer->vboIds[i]);
+			}
+			buffer->vboIds[i] = rlLoadVertexBuffer(NULL, buffer->capacity * sizeof(TrainInstance), true);
+		}
+		buffer->vboCapacity = buffer->capacity;
+	}
+	if(buffer->instanceCount > 0)
+	{
+		buffer->vboCurrent = 1 - buffer->vboCurrent;
+		rlUpdateVertexBuffer(buffer->vboIds[buffer->vboCurrent], buffer->instances, buffer->instanceCount * sizeof(TrainInstance), 0);
+	}
+	buffer->uploadedSnapshotVersion = snapshot->version;
+}
+
+// what DrawMeshInstanced does, with the two vec4 instance attributes of TrainInstance instead of a matrix per instance
+static void RenderTrainModelInstanced(Model model, int firstInstance, int instanceCount)
+{
+	const TrainInstanceBuffer* buffer = &g_game.trainInstances;
+	Shader shader = g_game.assetTrainShader;
+	int previousLoc = g_game.assetTrainShaderPreviousLoc;
+	int currentLoc = g_game.assetTrainShaderCurrentLoc;
+	float alpha = g_game.trainSnapshots.interpolationAlpha;
+	Matrix matModelView = MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview());
+
+	rlEnableShader(shader.id);
+	rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], MatrixMultiply(matModelView, rlGetMatrixProjection()));
+	rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MODEL], model.transform);
+	rlSetUniform(g_game.assetTrainShaderAlphaLoc, &alpha, SHADER_UNIFORM_FLOAT, 1);
+
+	for (int meshIndex = 0; meshIndex < model.meshCount; meshIndex++)
+	{
+		Mesh mesh = model.meshes[meshIndex];
+		MaterialMap diffuseMap = model.materials[model.meshMaterial[meshIndex]].maps[MATERIAL_MAP_DIFFUSE];
+		Vector4 diffuseColor = ColorNormalize(diffuseMap.color);
+		int textureSlot = 0;
+		rlSetUniform(shader.locs[SHADER_LOC_COLOR_DIFFUSE], &diffuseColor, SHADER_UNIFORM_VEC4, 1);
+		rlActiveTextureSlot(textureSlot);
+		rlEnableTexture(diffuseMap.texture.id > 0 ? diffuseMap.texture.id : rlGetTextureIdDefault());
+		rlSetUniform(shader.locs[SHADER_LOC_MAP_DIFFUSE], &textureSlot, SHADER_UNIFORM_INT, 1);
+
+		// without vertex array objects (WebGL missing the extension) the mesh buffers get bound one by one
+		bool isVertexArrayBound = rlEnableVertexArray(mesh.vaoId);
+		if(!isVertexArrayBound)
+		{
+			rlEnableVertexBuffer(mesh.vboId[RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION]);
+			rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_POSITION], 3, RL_FLOAT, 0, 0, 0);
+			rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_POSITION]);
+			rlEnableVertexBuffer(mesh.vboId[RL_DEFAULT_SHADER_ATTRIB_LOCATION_TEXCOORD]);
+			rlSetVertexAttribute(shader.locs[SHADER_LOC_VERTEX_TEXCOORD01], 2, RL_FLOAT, 0, 0, 0);
+			rlEnableVertexAttribute(shader.locs[SHADER_LOC_VERTEX_TEXCOORD01]);
+			if(mesh.indices != NULL)
+			{
+				rlEnableVertexBufferElement(mesh.vboId[RL_DEFAULT_SHADER_ATTRIB_LOCATION_INDICES]);
+			}
+		}
+		// the model's instance range of the buffer, one instance per train
+		int instanceOffset = firstInstance * sizeof(TrainInstance);
+		rlEnableVertexBuffer(buffer->vboIds[buffer->vboCurrent]);
+		rlSetVertexAttribute(previousLoc, 4, RL_FLOAT, 0, sizeof(TrainInstance), instanceOffset);
+		rlSetVertexAttribute(currentLoc, 4, RL_FLOAT, 0, sizeof(TrainInstance), instanceOffset + sizeof(Vector4));
+		rlEnableVertexAttribute(previousLoc);
+		rlEnableVertexAttribute(currentLoc);
+		rlSetVertexAttributeDivisor(previousLoc, 1);
+		rlSetVertexAttributeDivisor(currentLoc, 1);
+
+		if(mesh.indices != NULL)
+		{
+			rlDrawVertexArrayElementsInstanced(0, mesh.triangleCount * 3, 0, instanceCount);
+		}
+		else
+		{
+			rlDrawVertexArrayInstanced(0, mesh.vertexCount, instanceCount);
+		}
+		ProfileCountDraws(1, mesh.triangleCount * instanceCount);
+
+		// the vertex array object keeps attribute state, leave it as other draw calls of the mesh expect it
+		rlSetVertexAttributeDivisor(previousLoc, 0);
+		rlSetVertexAttributeDivisor(currentLoc, 0);
+		rlDisableVertexAttribute(previousLoc);
+		rlDisableVertexAttribute(currentLoc);
+		rlDisableVertexArray();
+		rlDisableVertexBuffer();
+		rlDisableVertexBufferElement();
+	}
+
+	rlActiveTextureSlot(0);
+	rlDisableTexture();
+	rlDisableShader();
+}
+
+// all trains in one instanced draw call per model mesh, the instance data is only uploaded for a new snapshot
+static void RenderTrainsInstanced(void)
+{
+	TrainInstanceBuffer* buffer = &g_game.trainInstances;
+	if(buffer->uploadedSnapshotVersion != g_game.trainSnapshots.buffers[g_game.trainSnapshots.front].version)
+	{
+		TrainInstancesUpload();
+	}
+	if(buffer->instanceCount == 0)
+	{
+		return;
+	}
+
+	// the batch may still hold vertices drawn with the current matrices, they must go out before the custom draw calls
+	rlDrawRenderBatchActive();
+	for(int modelID = 0; modelID < MODEL_COUNT; ++modelID)
+	{
+		if(buffer->modelInstanceCount[modelID] > 0)
+		{
+			RenderTrainModelInstanced(AssetsGetModel(modelID), buffer->modelFirst[modelID], buffer->modelInstanceCount[modelID]);
+		}
+	}
+}
+
+// signals view: red blocks are held by a train, yellow ones also have trains waiting for them. The ticks change the
+// reservations, this draws them from the trains snapshot
+static void RenderBlockReservations(void)
+{
+	const RailGraph* graph = &g_game.railGraph;
+	const TrainRenderSnapshot* snapshot = &g_game.trainSnapshots.buffers[g_game.trainSnapshots.front];
+	if(!snapshot->areBlocksCurrent || snapshot->railGraphVersion != graph->version)
+	{
+		return; // a rails change the ticks haven't seen yet
+	}
+	for(int segmentIndex = 0; segmentIndex < snapshot->blockCount; ++segmentIndex)
+	{
+		const RailSegment* segment = &graph->segments[segmentIndex];
+		if(!segment->isUsed)
+		{
+			continue;
+		}
+		BlockViewState block = snapshot->blocks[segmentIndex];
+		Color color = block == BLOCK_VIEW_WAITED_FOR ? COLOR_YELLOW : block == BLOCK_VIEW_RESERVED ? COLOR_RED : COLOR_GREEN;
+		for(int i = 0; i < segment->tileCount; ++i)
+		{
+			Vector3 position = TileGetCenterPosition(TileCoordsByIndex(segment->tileIndices[i]));
+			DrawCube(position, 0.2f, 0.12f, 0.2f, color);
+		}
+	}
+}
+
+// old path: one DrawModelEx per train, interpolated on the CPU
+static void RenderTrainsPerTrain(void)
+{
+	const Vector3 vectorUp = (Vector3) {0,1,0};
+	const TrainRenderSnapshots* snapshots = &g_game.trainSnapshots;
+	const TrainRenderSnapshot* snapshot = &snapshots->buffers[snapshots->front];
+	for(int i = 0; i < snapshot->count; ++i)
+	{
+		const TrainRenderInfo* train = &snapshot->trains[i];
+		Vector3 position;
+		float rotationInDegree;
+		TrainGetInterpolatedTransform(train, snapshots->interpolationAlpha, &position, &rotationInDegree);
+		Model model = AssetsGetModel(train->modelID);
+		DrawModelEx(model, position, vectorUp, rotationInDegree, Vector3One(), WHITE);
+		ProfileCountModelDraws(model, 1);
+	}
+}
+
+static void RenderTrains(void)
+{
+	if(g_renderTrainInstancingOn && RenderTrainInstancingIsSupported())
+	{
+		RenderTrainsInstanced();
+	}
+	else
+	{
+		RenderTrainsPerTrain();
+	}
+}
+
+// frustum and distance culling per chunk, chunks without rails are skipped as well. Also picks the chunk LODs
+static void RenderCullMapChunks(void)
+{
+	g_game.mapChunksVisibleCount = 0;
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+
+		int railsTileCount = MapChunkRailsTileCount(chunk);
+
+		Vector3 chunkCenter = Vector3Scale(Vector3Add(chunk->bounds.min, chunk->bounds.max), 0.5f);
+		float chunkRadius = (float) g_MapChunkSize * 0.71f; // half diagonal
+		float distance = Vector3Distance(chunkCenter, g_game.camera.position);
+		bool isInRange = distance - chunkRadius < g_MapChunkCullDistance;
+
+		chunk->isVisible = railsTileCount > 0 && isInRange && CameraFrustumContainsBox(chunk->bounds);
+		if(chunk->isVisible)
+		{
+			g_game.mapChunksVisibleCount++;
+		}
+
+		chunk->lod = MAP_CHUNK_LOD_FULL;
+		if(g_renderLodOn && distance > g_MapChunkLodImpostorDistance)
+		{
+			chunk->lod = MAP_CHUNK_LOD_IMPOSTOR;
+		}
+		else if(g_renderLodOn && distance > g_MapChunkLodStripsDistance)
+		{
+			chunk->lod = MAP_CHUNK_LOD_STRIPS;
+		}
+	}
+}
+
+// old path: one DrawModelEx per rails tile
+static void RenderRailTilesPerTile(void)
+{
+	const Vector3 vectorUp = (Vector3) {0,1,0};
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		if(chunk->isVisible == false || chunk->lod != MAP_CHUNK_LOD_FULL)
+		{
+			continue;
+		}
+
+		for(int slot = 0; slot < MapChunkRailsTileCount(chunk); ++slot)
+		{
+			int tileIndex = chunk->tileIndices[slot];
+			TileModelInfo tileModel = g_game.mapTileModels[tileIndex];
+			Vector3 tileCenter = TileGetCenterPosition(TileCoordsByIndex(tileIndex));
+			Model model = g_game.assetModels[TileModelInfoGetModelID(tileModel)];
+			DrawModelEx(model, tileCenter, vectorUp, TileModelInfoGetRotationInDegree(tileModel), Vector3One(), COLOR_WHITE);
+			ProfileCountModelDraws(model, 1);
+		}
+	}
+}
+
+// rebuilds the instancing transforms from the chunk lists, only needed after a tile of the chunk changed
+static void MapChunkUpdateTransforms(MapChunk* chunk)
+{
+	if(chunk->transforms == NULL)
+	{
+		chunk->transforms = MemAlloc(g_MapChunkTileCount * sizeof(Matrix));
+	}
+
+	for(int slot = 0; slot < MapChunkRailsTileCount(chunk); ++slot)
+	{
+		int tileIndex = chunk->tileIndices[slot];
+		TileModelInfo tileModel = g_game.mapTileModels[tileIndex];
+		Vector3 tileCenter = TileGetCenterPosition(TileCoordsByIndex(tileIndex));
+		Model model = g_game.assetModels[TileModelInfoGetModelID(tileModel)];
+		chunk->transforms[slot] = RenderGetModelTransform(model, tileCenter, TileModelInfoGetRotationInDegree(tileModel));
+	}
+	chunk->transformsDirty = false;
+}
+
+// draws each rails model once per visible chunk with the cached transforms
+static void RenderRailTilesInstanced(void)
+{
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		if(chunk->isVisible == false || chunk->lod != MAP_CHUNK_LOD_FULL)
+		{
+			continue;
+		}
+
+		if(chunk->transformsDirty)
+		{
+			MapChunkUpdateTransforms(chunk);
+		}
+
+		for(int modelIndex = 0; modelIndex < g_RailsModelCount; ++modelIndex)
+		{
+			int first = chunk->modelOffsets[modelIndex];
+			int count = chunk->modelOffsets[modelIndex + 1] - first;
+			RenderModelInstanced(g_game.assetModels[modelIndex], &chunk->transforms[first], count);
+		}
+	}
+}
+
+static inline Model MapChunkGetSlotModel(const MapChunk* chunk, int slot)
+{
+	return g_game.assetModels[TileModelInfoGetModelID(g_game.mapTileModels[chunk->tileIndices[slot]])];
+}
+
+// appends the meshes of the tiles from (slot, meshIndex) on until the merged mesh is full,
+// returns where the next merged mesh starts
+static void MapChunkAppendMergedMesh(MapChunk* chunk, int* slot, int* meshIndex)
+{
+	// count first, a source mesh always goes into one merged mesh as a whole
+	int railsTileCount = MapChunkRailsTileCount(chunk);
+	int vertexCount = 0;
+	int indexCount = 0;
+	int endSlot = *slot;
+	int endMeshIndex = *meshIndex;
+	while(endSlot < railsTileCount)
+	{
+		Model model = MapChunkGetSlotModel(chunk, endSlot);
+		Mesh source = model.meshes[endMeshIndex];
+		if(vertexCount + source.vertexCount > g_MergedMeshVertexMax && vertexCount > 0)
+		{
+			break;
+		}
+		vertexCount += source.vertexCount;
+		indexCount += source.triangleCount * 3;
+		if(++endMeshIndex == model.meshCount)
+		{
+			endMeshIndex = 0;
+			++endSlot;
+		}
+	}
+
+	MemoryArenaMark arrayMark = RenderMeshArraysBegin();
+	Mesh merged = {0};
+	merged.vertexCount = vertexCount;
+	merged.triangleCount = indexCount / 3;
+	merged.vertices = RenderMeshArrayAlloc(vertexCount * 3 * sizeof(float));
+	merged.normals = RenderMeshArrayAlloc(vertexCount * 3 * sizeof(float));
+	merged.texcoords = RenderMeshArrayAlloc(vertexCount * 2 * sizeof(float));
+	merged.indices = RenderMeshArrayAlloc(indexCount * sizeof(unsigned short));
+
+	int vertexOffset = 0;
+	int indexOffset = 0;
+	while(*slot != endSlot || *meshIndex != endMeshIndex)
+	{
+		int tileIndex = chunk->tileIndices[*slot];
+		TileModelInfo tileModel = g_game.mapTileModels[tileIndex];
+		Model model = MapChunkGetSlotModel(chunk, *slot);
+		Mesh source = model.meshes[*meshIndex];
+		Matrix transform = RenderGetModelTransform(model, TileGetCenterPosition(TileCoordsByIndex(tileIndex)), TileModelInfoGetRotationInDegree(tileModel));
+		Matrix normalTransform = transform;
+		normalTransform.m12 = normalTransform.m13 = normalTransform.m14 = 0;
+
+		for(int i = 0; i < source.vertexCount; ++i)
+		{
+			Vector3 position = Vector3Transform((Vector3) {source.vertices[i * 3], source.vertices[i * 3 + 1], source.vertices[i * 3 + 2]}, transform);
+			Vector3 normal = source.normals != NULL ? (Vector3) {source.normals[i * 3], source.normals[i * 3 + 1], source.normals[i * 3 + 2]} : (Vector3) {0, 1, 0};
+			normal = Vector3Normalize(Vector3Transform(normal, normalTransform));
+			int v = vertexOffset + i;
+			merged.vertices[v * 3] = position.x;
+			merged.vertices[v * 3 + 1] = position.y;
+			merged.vertices[v * 3 + 2] = position.z;
+			merged.normals[v * 3] = normal.x;
+			merged.normals[v * 3 + 1] = normal.y;
+			merged.normals[v * 3 + 2] = normal.z;
+			merged.texcoords[v * 2] = source.texcoords != NULL ? source.texcoords[i * 2] : 0;
+			merged.texcoords[v * 2 + 1] = source.texcoords != NULL ? source.texcoords[i * 2 + 1] : 0;
+		}
+		// meshes straight from LoadOBJ aren't indexed
+		for(int i = 0; i < source.triangleCount * 3; ++i)
+		{
+			merged.indices[indexOffset + i] = (unsigned short) (vertexOffset + (source.indices != NULL ? source.indices[i] : i));
+		}
+		vertexOffset += source.vertexCount;
+		indexOffset += source.triangleCount * 3;
+
+		if(++(*meshIndex) == model.meshCount)
+		{
+			*meshIndex = 0;
+			++(*slot);
+		}
+	}
+
+	RenderMeshArraysUpload(&merged, arrayMark);
+
+	if(chunk->mergedMeshCount == chunk->mergedMeshCapacity)
+	{
+		chunk->mergedMeshCapacity = chunk->mergedMeshCapacity == 0 ? 2 : chunk->mergedMeshCapacity * 2;
+		chunk->mergedMeshes = MemRealloc(chunk->mergedMeshes, chunk->mergedMeshCapacity * sizeof(Mesh));
+	}
+	chunk->mergedMeshes[chunk->mergedMeshCount++] = merged;
+}
+
+// bakes the rails of the chunk into as few static meshes as the index size allows
+static void MapChunkUpdateMergedMeshes(MapChunk* chunk)
+{
+	for(int meshIndex = 0; meshIndex < chunk->mergedMeshCount; ++meshIndex)
+	{
+		UnloadMesh(chunk->mergedMeshes[meshIndex]);
+	}
+	chunk->mergedMeshCount = 0;
+
+	int slot = 0;
+	int meshIndex = 0;
+	while(slot < MapChunkRailsTileCount(chunk))
+	{
+		MapChunkAppendMergedMesh(chunk, &slot, &meshIndex);
+	}
+	chunk->mergedMeshesDirty = false;
+}
+
+// all rails models use the same palette material
+static inline Material RenderGetRailsMaterial(void)
+{
+	Model straight = g_game.assetModels[MODEL_RAILS_STRAIGHT];
+	return straight.materials[straight.meshMaterial[0]];
+}
+
+// one draw call per merged mesh of each visible chunk, no per instance data at all
+static void RenderRailTilesMerged(void)
+{
+	Material material = RenderGetRailsMaterial();
+	Matrix identity = MatrixIdentity();
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		if(chunk->isVisible == false || chunk->lod != MAP_CHUNK_LOD_FULL)
+		{
+			continue;
+		}
+
+		if(chunk->mergedMeshesDirty)
+		{
+			MapChunkUpdateMergedMeshes(chunk);
+		}
+
+		for(int meshIndex = 0; meshIndex < chunk->mergedMeshCount; ++meshIndex)
+		{
+			DrawMesh(chunk->mergedMeshes[meshIndex], material, identity);
+			ProfileCountDraws(1, chunk->mergedMeshes[meshIndex].triangleCount);
+		}
+	}
+}
+
+// render textures need framebuffer objects, not available on GL 1.1
+static bool RenderImpostorsAreSupported(void)
+{
+	return rlGetVersion() != RL_OPENGL_11;
+}
+
+// the precomputed curve of a single connection, both directions look the same from above
+static const TrackCurveSample* RenderGetConnectionCurve(ConnectionDirection connection)
+{
+	TileEdge edges[2] = {TILE_EDGE_NONE, TILE_EDGE_NONE};
+	int edgeCount = 0;
+	for(int edge = TILE_EDGE_S; edge < TILE_EDGE_COUNT && edgeCount < 2; ++edge)
+	{
+		if(g_tileEdgeConnections[edge] & connection)
+		{
+			edges[edgeCount++] = (TileEdge) edge;
+		}
+	}
+	return g_trackCurves[edges[0]][edges[1]];
+}
+
+// one flat strip along the track curve per connection of every rails tile, every g_RailsLodCurveStep-th sample
+static void MapChunkUpdateLodStripsMesh(MapChunk* chunk)
+{
+	if(chunk->lodStripsMesh.vertexCount > 0)
+	{
+		UnloadMesh(chunk->lodStripsMesh);
+	}
+	chunk->lodStripsMesh = (Mesh) {0};
+	chunk->lodStripsMeshDirty = false;
+
+	int railsTileCount = MapChunkRailsTileCount(chunk);
+	int connectionCount = 0;
+	for(int slot = 0; slot < railsTileCount; ++slot)
+	{
+		connectionCount += TileHConnectionsCount(g_game.mapTiles[chunk->tileIndices[slot]].connectionOptions);
+	}
+	if(connectionCount == 0)
+	{
+		return;
+	}
+
+	// a full chunk of crossings stays far below g_MergedMeshVertexMax
+	const int segmentCount = g_TrackCurveSampleCount / g_RailsLodCurveStep;
+	MemoryArenaMark arrayMark = RenderMeshArraysBegin();
+	Mesh mesh = {0};
+	mesh.vertexCount = connectionCount * (segmentCount + 1) * 2;
+	mesh.triangleCount = connectionCount * segmentCount * 2;
+	mesh.vertices = RenderMeshArrayAlloc(mesh.vertexCount * 3 * sizeof(float));
+	mesh.indices = RenderMeshArrayAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
+
+	float halfWidth = g_RailsLodStripWidth * 0.5f;
+	int vertexOffset = 0;
+	int indexOffset = 0;
+	for(int slot = 0; slot < railsTileCount; ++slot)
+	{
+		int tileIndex = chunk->tileIndices[slot];
+		Vector3 tileCenter = TileGetCenterPosition(TileCoordsByIndex(tileIndex));
+		ConnectionsConfig connectionOptions = g_game.mapTiles[tileIndex].connectionOptions;
+		for(int bit = 0; bit < 6; ++bit)
 		{
-			TileCoords tileCoords = TileGetCoordsFromWorldPoint(rayCollision.point);
-			int tileIndex = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
-			TileInfo tile = g_game.mapTiles[tileIndex];
+			ConnectionDirection connection = (ConnectionDirection) (1 << bit);
+			if((connectionOptions & connection) == 0)
+			{
+				continue;
+			}
 
-			sprintf(textBuffer, "TileCoords: x=%d, z=%d", tileCoords.x, tileCoords.z);
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+			const TrackCurveSample* curve = RenderGetConnectionCurve(connection);
+			for(int segment = 0; segment <= segmentCount; ++segment)
+			{
+				// sideways to the direction between the neighbouring samples
+				int sample = segment * g_RailsLodCurveStep;
+				Vector3 before = curve[sample > 0 ? sample - 1 : sample].position;
+				Vector3 after = curve[sample < g_TrackCurveSampleCount ? sample + 1 : sample].position;
+				Vector3 direction = Vector3Normalize(Vector3Subtract(after, before));
+				Vector3 side = (Vector3) {-direction.z * halfWidth, 0, direction.x * halfWidth};
+				Vector3 center = Vector3Add(tileCenter, curve[sample].position);
+				center.y = g_RailsLodHeight;
+
+				Vector3 left = Vector3Subtract(center, side);
+				Vector3 right = Vector3Add(center, side);
+				int v = vertexOffset + segment * 2;
+				memcpy(&mesh.vertices[v * 3], &left, sizeof(Vector3));
+				memcpy(&mesh.vertices[(v + 1) * 3], &right, sizeof(Vector3));
+				if(segment > 0)
+				{
+					// counter clockwise seen from above
+					const int quadIndices[6] = {0, 1, 2, 1, 3, 2};
+					for(int i = 0; i < 6; ++i)
+					{
+						mesh.indices[indexOffset++] = (unsigned short) (v - 2 + quadIndices[i]);
+					}
+				}
+			}
+			vertexOffset += (segmentCount + 1) * 2;
+		}
+	}
 
-			TileSector sector = TileSectorGetFromWorldPoint(rayCollision.point);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Sector: %s", TileSectorToString(sector));
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	RenderMeshArraysUpload(&mesh, arrayMark);
+	chunk->lodStripsMesh = mesh;
+}
 
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Sector: %s", TileTypeToString(tile.type));
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+static void MapChunkImpostorsFree(void)
+{
+	MapChunkImpostorPool* pool = &g_game.mapChunkImpostors;
+	for(int target = 0; target < g_MapChunkImpostorPoolSize; ++target)
+	{
+		if(pool->targets[target].id != 0)
+		{
+			UnloadRenderTexture(pool->targets[target]);
+		}
+		pool->targets[target] = (RenderTexture2D) {0};
+	}
+}
 
-			int connectionCount = TileHConnectionsCount(tile.connectionOptions);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection Count: %d", connectionCount);
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// a free target or the least recently drawn one, false while all of them are drawn this frame
+static bool MapChunkAcquireImpostor(int chunkIndex)
+{
+	MapChunkImpostorPool* pool = &g_game.mapChunkImpostors;
+	int best = -1;
+	for(int target = 0; target < g_MapChunkImpostorPoolSize; ++target)
+	{
+		if(pool->chunkByTarget[target] < 0)
+		{
+			best = target;
+			break;
+		}
+		if(pool->drawnFrameByTarget[target] != pool->frame && (best < 0 || pool->drawnFrameByTarget[target] < pool->drawnFrameByTarget[best]))
+		{
+			best = target;
+		}
+	}
+	if(best < 0)
+	{
+		return false;
+	}
+	if(pool->chunkByTarget[best] >= 0)
+	{
+		g_game.mapChunks[pool->chunkByTarget[best]].impostorTarget = -1;
+	}
+	if(pool->targets[best].id == 0)
+	{
+		pool->targets[best] = LoadRenderTexture(g_MapChunkImpostorSize, g_MapChunkImpostorSize);
+		SetTextureFilter(pool->targets[best].texture, TEXTURE_FILTER_BILINEAR);
+	}
+	pool->chunkByTarget[best] = chunkIndex;
+	pool->drawnFrameByTarget[best] = pool->frame;
+	g_game.mapChunks[chunkIndex].impostorTarget = best;
+	g_game.mapChunks[chunkIndex].impostorDirty = true;
+	return true;
+}
 
-			int activeConnectionCount = TileHConnectionsCount(tile.connectionsActive);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connections Active Count: %d", activeConnectionCount);
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// the chunk's full detail rails seen from straight above, into the target it owns. Render textures replace the
+// matrices of BeginMode3D, so this only works outside of it
+static void MapChunkUpdateImpostor(MapChunk* chunk)
+{
+	if(chunk->mergedMeshesDirty)
+	{
+		MapChunkUpdateMergedMeshes(chunk);
+	}
 
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Rotation: %f", tile.modelRotationInDegree);
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	// screen right is +x and screen up is -z, RenderMapChunkImpostor maps the texture the same way
+	Vector3 center = Vector3Scale(Vector3Add(chunk->bounds.min, chunk->bounds.max), 0.5f);
+	Camera3D camera =
+	{
+		.position = (Vector3) {center.x, g_MapChunkHeight + 10.0f, center.z},
+		.target = (Vector3) {center.x, 0, center.z},
+		.up = (Vector3) {0, 0, -1},
+		.fovy = (float) g_MapChunkSize,
+		.projection = CAMERA_ORTHOGRAPHIC,
+	};
+	Material material = RenderGetRailsMaterial();
+	Matrix identity = MatrixIdentity();
+	BeginTextureMode(g_game.mapChunkImpostors.targets[chunk->impostorTarget]);
+		ClearBackground(BLANK);
+		BeginMode3D(camera);
+			for(int meshIndex = 0; meshIndex < chunk->mergedMeshCount; ++meshIndex)
+			{
+				DrawMesh(chunk->mergedMeshes[meshIndex], material, identity);
+				ProfileCountDraws(1, chunk->mergedMeshes[meshIndex].triangleCount);
+			}
+		EndMode3D();
+	EndTextureMode();
+	chunk->impostorDirty = false;
+}
 
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Model: %s", ModelIdToString(tile.modelID));
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// one quad over the chunk, goes through the render batch
+static void RenderMapChunkImpostor(const MapChunk* chunk)
+{
+	float minX = chunk->bounds.min.x;
+	float minZ = chunk->bounds.min.z;
+	float maxX = chunk->bounds.max.x;
+	float maxZ = chunk->bounds.max.z;
+	rlSetTexture(g_game.mapChunkImpostors.targets[chunk->impostorTarget].texture.id);
+	rlBegin(RL_QUADS);
+		rlColor4ub(255, 255, 255, 255);
+		rlNormal3f(0, 1, 0);
+		// render textures are upside down, texture v runs from maxZ to minZ
+		rlTexCoord2f(0, 1); rlVertex3f(minX, g_RailsLodHeight, minZ);
+		rlTexCoord2f(0, 0); rlVertex3f(minX, g_RailsLodHeight, maxZ);
+		rlTexCoord2f(1, 0); rlVertex3f(maxX, g_RailsLodHeight, maxZ);
+		rlTexCoord2f(1, 1); rlVertex3f(maxX, g_RailsLodHeight, minZ);
+	rlEnd();
+	rlSetTexture(0);
+	ProfileCountDraws(1, 2);
+}
 
-			bool connection_NS = TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NS_SN);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection NS-SN: %s", connection_NS ? "True" : "False");
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// culling and LOD picking for the frame, then the outdated impostors of visible chunks, a few per frame.
+// Call before BeginMode3D, see MapChunkUpdateImpostor
+static void RenderPrepareRailTiles(void)
+{
+	RenderCullMapChunks();
+	if(!RenderImpostorsAreSupported())
+	{
+		return;
+	}
 
-			bool connection_WE = TileHasConnectionFlag(tile.connectionOptions, CONNECTION_EW_WE);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection EW-WE: %s", connection_WE ? "True" : "False");
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	// the targets drawn this frame are kept, the others may go to chunks that need one
+	MapChunkImpostorPool* pool = &g_game.mapChunkImpostors;
+	pool->frame++;
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		const MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		if(chunk->isVisible && chunk->lod == MAP_CHUNK_LOD_IMPOSTOR && chunk->impostorTarget >= 0)
+		{
+			pool->drawnFrameByTarget[chunk->impostorTarget] = pool->frame;
+		}
+	}
 
-			bool connection_SW = TileHasConnectionFlag(tile.connectionOptions, CONNECTION_SW_WS);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection SW-WS: %s", connection_SW ? "True" : "False");
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	int updatesLeft = g_MapChunkImpostorUpdatesPerFrame;
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount && updatesLeft > 0; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		if(!chunk->isVisible || chunk->lod != MAP_CHUNK_LOD_IMPOSTOR || !(chunk->impostorDirty || chunk->impostorTarget < 0))
+		{
+			continue;
+		}
+		if(chunk->impostorTarget < 0 && !MapChunkAcquireImpostor(chunkIndex))
+		{
+			break; // the rest stays strips
+		}
+		MapChunkUpdateImpostor(chunk);
+		updatesLeft--;
+	}
+}
 
-			bool connection_NW = TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NW_WN);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection NW_WN: %s", connection_NW ? "True" : "False");
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// visible chunks not drawn at full detail. Impostors not rendered yet, or outdated by an edit this frame, draw as strips
+static void RenderRailTilesLowDetail(void)
+{
+	Material material = g_game.assetGroundMaterial;
+	material.maps[MATERIAL_MAP_DIFFUSE].color = COLOR_BROWN;
+	Matrix identity = MatrixIdentity();
+	for(int chunkIndex = 0; chunkIndex < g_MapChunkCount; ++chunkIndex)
+	{
+		MapChunk* chunk = &g_game.mapChunks[chunkIndex];
+		if(chunk->isVisible == false || chunk->lod == MAP_CHUNK_LOD_FULL)
+		{
+			continue;
+		}
 
-			bool connection_NE = TileHasConnectionFlag(tile.connectionOptions, CONNECTION_NE_EN);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection NE_EN: %s", connection_NE ? "True" : "False");
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+		if(chunk->lod == MAP_CHUNK_LOD_IMPOSTOR && chunk->impostorTarget >= 0 && !chunk->impostorDirty)
+		{
+			RenderMapChunkImpostor(chunk);
+			continue;
+		}
 
-			bool connection_ES = TileHasConnectionFlag(tile.connectionOptions, CONNECTION_ES_SE);
-			rect.y += lineHeight;
-			sprintf(textBuffer, "Connection ES_SE: %s", connection_ES ? "True" : "False");
-			GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+		if(chunk->lodStripsMeshDirty)
+		{
+			MapChunkUpdateLodStripsMesh(chunk);
+		}
+		if(chunk->lodStripsMesh.vertexCount > 0)
+		{
+			DrawMesh(chunk->lodStripsMesh, material, identity);
+			ProfileCountDraws(1, chunk->lodStripsMesh.triangleCount);
 		}
+	}
+}
 
-		rect.y += lineHeight;
-		GuiDrawText("-----------------------------", rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// the grid shader draws into the ground quad, needs shaders and a successful compile like instancing
+static bool RenderGridShaderIsSupported(void)
+{
+	return rlGetVersion() != RL_OPENGL_11 && g_game.assetGridShader.id != rlGetShaderIdDefault();
+}
 
-		TrainInfo train = g_game.trains[0];
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train Tile: x%d z%d", train.tileCurrent.x, train.tileCurrent.z);
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// tile borders as thin quads on top of the ground, with the center lines in the axis color
+static void RenderUpdateGridLinesMesh(void)
+{
+	if(g_game.mapGridLinesMeshSize == g_MapGridSize)
+	{
+		return;
+	}
+	if(g_game.mapGridLinesMeshSize > 0)
+	{
+		UnloadMesh(g_game.mapGridLinesMesh);
+	}
 
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train To: %s", TileSectorToString(train.driveToSector));
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	int lineCount = 2 * (g_MapGridSize + 1); // below g_MergedMeshVertexMax up to g_MapGridSizeMax
+	MemoryArenaMark arrayMark = RenderMeshArraysBegin();
+	Mesh mesh = { 0 };
+	mesh.vertexCount = lineCount * 4;
+	mesh.triangleCount = lineCount * 2;
+	mesh.vertices = RenderMeshArrayAlloc(mesh.vertexCount * 3 * sizeof(float));
+	mesh.colors = RenderMeshArrayAlloc(mesh.vertexCount * 4 * sizeof(unsigned char));
+	mesh.indices = RenderMeshArrayAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
+
+	float size = (float) g_MapGridSize;
+	float halfWidth = g_MapGridLineWidth * 0.5f;
+	for(int line = 0; line < lineCount; ++line)
+	{
+		// even lines run along z, odd lines along x
+		float offset = (float) (line / 2);
+		float x0 = line % 2 == 0 ? offset - halfWidth : 0;
+		float x1 = line % 2 == 0 ? offset + halfWidth : size;
+		float z0 = line % 2 == 0 ? 0 : offset - halfWidth;
+		float z1 = line % 2 == 0 ? size : offset + halfWidth;
+		const float corners[4][2] = {{x0, z0}, {x0, z1}, {x1, z1}, {x1, z0}}; // counter clockwise seen from above
+		Color color = line / 2 == g_MapGridSize / 2 ? COLOR_RED : COLOR_BLACK;
+		for(int corner = 0; corner < 4; ++corner)
+		{
+			int v = line * 4 + corner;
+			mesh.vertices[v * 3] = corners[corner][0];
+			mesh.vertices[v * 3 + 1] = 0.01f;
+			mesh.vertices[v * 3 + 2] = corners[corner][1];
+			memcpy(&mesh.colors[v * 4], &color, 4);
+		}
+		const int quadIndices[6] = {0, 1, 2, 0, 2, 3};
+		for(int i = 0; i < 6; ++i)
+		{
+			mesh.indices[line * 6 + i] = (unsigned short) (line * 4 + quadIndices[i]);
+		}
+	}
 
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train From: %s", TileSectorToString(train.driveFromSector));
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	RenderMeshArraysUpload(&mesh, arrayMark);
+	g_game.mapGridLinesMesh = mesh;
+	g_game.mapGridLinesMeshSize = g_MapGridSize;
+}
 
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train Connection: %s", ConnectionDirectionToString(train.tileConnectionUsed));
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// ground plane with the tile grid, one draw call whatever the map size. The line mesh fallback adds a second one
+static void RenderGround(void)
+{
+	float width = (float) g_MapGridSize;
+	float center = width * 0.5f;
+	Matrix transform = MatrixMultiply(MatrixScale(width, 1.0f, width), MatrixTranslate(center, 0.0f, center));
+	Material material = g_game.assetGroundMaterial;
+	material.maps[MATERIAL_MAP_DIFFUSE].color = COLOR_GREEN;
+	if(g_renderGridShaderOn && RenderGridShaderIsSupported())
+	{
+		float axisPosition[2] = {center, center};
+		SetShaderValue(g_game.assetGridShader, g_game.assetGridShaderAxisLoc, axisPosition, SHADER_UNIFORM_VEC2);
+		material.shader = g_game.assetGridShader;
+		DrawMesh(g_game.assetGroundMesh, material, transform);
+		ProfileCountDraws(1, g_game.assetGroundMesh.triangleCount);
+		return;
+	}
 
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train Next Tile: %d %d", train.tileNext.x, train.tileNext.z);
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+	DrawMesh(g_game.assetGroundMesh, material, transform);
+	RenderUpdateGridLinesMesh();
+	material.maps[MATERIAL_MAP_DIFFUSE].color = WHITE; // vertex colors
+	DrawMesh(g_game.mapGridLinesMesh, material, MatrixIdentity());
+	ProfileCountDraws(2, g_game.assetGroundMesh.triangleCount + g_game.mapGridLinesMesh.triangleCount);
+}
 
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train Next Tile: %d %d", train.tileNext.x, train.tileNext.z);
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+// full detail chunks one of three ways, the rest as strips or impostors. Needs RenderPrepareRailTiles first
+static void RenderRailTiles(void)
+{
+	RenderRailTilesLowDetail();
+	if(g_renderMergedRailsOn)
+	{
+		RenderRailTilesMerged();
+	}
+	else if(g_renderInstancingOn && RenderInstancingIsSupported())
+	{
+		RenderRailTilesInstanced();
+	}
+	else
+	{
+		RenderRailTilesPerTile();
+	}
+}
 
-		rect.y += lineHeight;
-		sprintf(textBuffer, "Train Rotation: %f", train.modelRotationInDegree);
-		GuiDrawText(textBuffer, rect, TEXT_ALIGN_LEFT, COLOR_BLACK);
+//----------------------------------------------------------------------------------------------------------------------
+// Loop Topics
+//----------------------------------------------------------------------------------------------------------------------
+
+void TickToolbarUI(void)
+{
+	float screenBottomMargin = 20.0f;
+	float inBetweenButtonsPadding = 10.0f;
+	float buttonHeight = 30.0f;
+	float buttonWidth = 100.0f;
+	float buttonCount = 5.0f;
+	float xStartingPos = (float) g_ScreenWidth * .5f - buttonCount * (inBetweenButtonsPadding + buttonWidth) * 0.5f;
+	float yPos = (float) g_ScreenHeight - buttonHeight - screenBottomMargin;
+	Rectangle buttonRect = {xStartingPos, yPos, buttonWidth, buttonHeight };
+
+	InteractionMode previousActionMode = g_game.actionMode;
+	for(int actionModeId = 0; actionModeId < ACTION_MODE_COUNT; ++actionModeId)
+	{
+		bool toggleButtonActive = g_game.actionMode == actionModeId;
+		GuiToggle(buttonRect, g_actionModeButtonLabels[actionModeId], &toggleButtonActive);
+		if(toggleButtonActive || IsKeyPressed(g_interactionModeKeyboardShortcuts[actionModeId]))
+		{
+			g_game.actionMode = actionModeId;
+		}
+
+		buttonRect.x += buttonWidth + inBetweenButtonsPadding;
+	}
+	// TickPaintRails does not run in the other modes, so the stroke in progress gets committed now
+	if(previousActionMode == ACTION_MODE_BUILD_RAILS && g_game.actionMode != ACTION_MODE_BUILD_RAILS && g_game.brushSectorTrailLength > 0)
+	{
+		GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_BRUSH_RELEASE});
 	}
 }
 
-Vector3 Bezier3D(Vector3 start, Vector3 middle, Vector3 end, float t)
+// advances the simulation in fixed steps for the time that passed since the last frame. Pipelined frames only start
+// the ticks here, they run while the frame gets drawn
+static void TickSimulation(void)
 {
-	// Ensure t is clamped between 0 and 1
-	if (t < 0.0f) t = 0.0f;
-	if (t > 1.0f) t = 1.0f;
+	SimClock* clock = &g_game.simClock;
+	clock->ticksLastFrame = 0;
+	float tickDuration = 1.0f / clock->tickRate;
 
-	// Calculate tangents
-	Vector3 tangentStart = Vector3Add(start, Vector3Scale(Vector3Subtract(middle, start), 0.5f));
-	Vector3 tangentEnd = Vector3Add(end, Vector3Scale(Vector3Subtract(middle, end), 0.5f));
+	// a replay runs the ticks of the recorded frame, however long the frame really took
+	if(g_replay.state == REPLAY_STATE_PLAYING)
+	{
+		clock->ticksLastFrame = g_replay.frameTicks[g_replay.frame];
+		clock->accumulator = 0;
+		clock->interpolationAlpha = 1.0f;
+	}
+	else if(!g_debugSimPauseOn)
+	{
+		clock->accumulator += GetFrameTime();
+		while(clock->accumulator >= tickDuration && clock->ticksLastFrame < g_SimMaxTicksPerFrame)
+		{
+			clock->accumulator -= tickDuration;
+			clock->ticksLastFrame++;
+		}
 
-	// Calculate Bezier coefficients
-	float u = 1.0f - t;
-	float tt = t * t;
-	float uu = u * u;
-	float uuu = uu * u;
-	float ttt = tt * t;
+		// drop the time we couldn't catch up with
+		if(clock->accumulator >= tickDuration)
+		{
+			clock->accumulator = fmodf(clock->accumulator, tickDuration);
+		}
+		clock->interpolationAlpha = clock->accumulator / tickDuration;
+	}
+	clock->tickCount += clock->ticksLastFrame;
 
-	// Combine the weighted contributions of each control point
-	Vector3 p = Vector3Scale(start, uuu); // (1-t)^3 * start
-	p = Vector3Add(p, Vector3Scale(tangentStart, 3 * uu * t)); // 3(1-t)^2 * t * tangentStart
-	p = Vector3Add(p, Vector3Scale(tangentEnd, 3 * u * tt)); // 3(1-t) * t^2 * tangentEnd
-	p = Vector3Add(p, Vector3Scale(end, ttt)); // t^3 * end
+	#if defined(SIM_MULTITHREADED)
+		if(SimPipelineIsActive())
+		{
+			SimPipeline* pipeline = &g_simPipeline;
+			pthread_mutex_lock(&pipeline->mutex);
+			pipeline->tickCount = clock->ticksLastFrame;
+			pipeline->tickDuration = tickDuration;
+			pipeline->isTicking = true;
+			pthread_cond_signal(&pipeline->ticksStarted);
+			pthread_mutex_unlock(&pipeline->mutex);
+			pipeline->isPending = true;
+			return;
+		}
+	#endif
+	ProfileBegin(PROFILE_ZONE_TRAINS);
+	SimRunTicks(clock->ticksLastFrame, tickDuration);
+	ProfileEnd(PROFILE_ZONE_TRAINS);
+}
 
-	return p;
+static void SimRunTicks(int tickCount, float tickDuration)
+{
+	for(int tick = 0; tick < tickCount; ++tick)
+	{
+		TickTrains(tickDuration);
+	}
 }
 
-float CalculateLookAtAngle(Vector3 from, Vector3 to)
+//----------------------------------------------------------------------------------------------------------------------
+// Simulation pipeline
+//----------------------------------------------------------------------------------------------------------------------
+// Frame N's ticks run on the simulation thread from TickSimulation until the end of the frame, meanwhile the main
+// thread draws the trains snapshot the ticks of frame N-1 wrote. Everything else the ticks touch is off limits for the
+// main thread until SimPipelineWait, commands wait before they run so they still come after the frame's ticks.
+// Map chunks only change by commands, drawing reads them as they are
+#if defined(SIM_MULTITHREADED)
+static void* SimPipelineMain(void* userData)
 {
-	// Compute the direction vector from 'from' to 'to'
-	Vector3 direction = Vector3Subtract(to, from);
+	SimPipeline* pipeline = userData;
+	pthread_mutex_lock(&pipeline->mutex);
+	for(;;)
+	{
+		while(!pipeline->isTicking && !pipeline->isShuttingDown)
+		{
+			pthread_cond_wait(&pipeline->ticksStarted, &pipeline->mutex);
+		}
+		if(pipeline->isShuttingDown)
+		{
+			break;
+		}
+		int tickCount = pipeline->tickCount;
+		float tickDuration = pipeline->tickDuration;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		double startTime = GetTime();
+		SimRunTicks(tickCount, tickDuration);
+		double tickTime = GetTime() - startTime;
+		bool isSnapshotWritten = TrainRenderSnapshotWrite();
+
+		pthread_mutex_lock(&pipeline->mutex);
+		pipeline->tickStartTime = startTime;
+		pipeline->tickTime = tickTime;
+		pipeline->isSnapshotWritten = isSnapshotWritten;
+		pipeline->isTicking = false;
+		pthread_cond_signal(&pipeline->ticksFinished);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	return NULL;
+}
 
-	// Calculate the angle using atan2
-	// atan2(y, x) returns the angle in radians between the positive X-axis and the point (x, y)
-	// We use direction.x and direction.z since we are rotating around the Y-axis
-	float angle = atan2f(direction.x, direction.z) * RAD2DEG;
+static void SimPipelineStart(void)
+{
+	SimPipeline* pipeline = &g_simPipeline;
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->ticksStarted, NULL);
+	pthread_cond_init(&pipeline->ticksFinished, NULL);
+	pipeline->isShuttingDown = false;
+	pipeline->isTicking = false;
+	pipeline->isPending = false;
+	pipeline->isStarted = pthread_create(&pipeline->thread, NULL, SimPipelineMain, pipeline) == 0;
+	if(!pipeline->isStarted)
+	{
+		TraceLog(LOG_WARNING, "===> sim pipeline: no simulation thread, ticks stay on the main thread");
+	}
+}
 
-	// Ensure the angle is within the range [0, 360)
-	if (angle < 0.0f)
+static void SimPipelineStop(void)
+{
+	SimPipeline* pipeline = &g_simPipeline;
+	if(pipeline->isStarted)
+	{
+		SimPipelineFrameEnd();
+		pthread_mutex_lock(&pipeline->mutex);
+		pipeline->isShuttingDown = true;
+		pthread_cond_signal(&pipeline->ticksStarted);
+		pthread_mutex_unlock(&pipeline->mutex);
+		pthread_join(pipeline->thread, NULL);
+		pipeline->isStarted = false;
+	}
+	pthread_cond_destroy(&pipeline->ticksFinished);
+	pthread_cond_destroy(&pipeline->ticksStarted);
+	pthread_mutex_destroy(&pipeline->mutex);
+}
+
+// replays tick on the main thread, their recorded commands run right after the ticks of their frame
+static bool SimPipelineIsActive(void)
+{
+	return g_simPipelineOn && g_simPipeline.isStarted && g_replay.state != REPLAY_STATE_PLAYING;
+}
+#endif
+
+// the frame's ticks were handed to the simulation thread
+static bool SimPipelineIsPending(void)
+{
+	#if defined(SIM_MULTITHREADED)
+		return g_simPipeline.isPending;
+	#else
+		return false;
+	#endif
+}
+
+// main thread, before reading or changing anything the ticks touch while they may run
+static void SimPipelineWait(void)
+{
+	#if defined(SIM_MULTITHREADED)
+		SimPipeline* pipeline = &g_simPipeline;
+		if(pipeline->isPending)
+		{
+			pthread_mutex_lock(&pipeline->mutex);
+			while(pipeline->isTicking)
+			{
+				pthread_cond_wait(&pipeline->ticksFinished, &pipeline->mutex);
+			}
+			pthread_mutex_unlock(&pipeline->mutex);
+		}
+	#endif
+}
+
+// after the frame got drawn: the ticks are done and their snapshot is drawn next frame
+static void SimPipelineFrameEnd(void)
+{
+	#if defined(SIM_MULTITHREADED)
+		SimPipeline* pipeline = &g_simPipeline;
+		if(!pipeline->isPending)
+		{
+			return;
+		}
+		ProfileBegin(PROFILE_ZONE_SIM_WAIT);
+		SimPipelineWait();
+		ProfileEnd(PROFILE_ZONE_SIM_WAIT);
+		pipeline->isPending = false;
+		ProfileAddZoneTime(PROFILE_ZONE_TRAINS, pipeline->tickStartTime, pipeline->tickTime);
+		if(pipeline->isSnapshotWritten)
+		{
+			TrainRenderSnapshotSwap();
+		}
+		g_game.trainSnapshots.interpolationAlpha = g_game.simClock.interpolationAlpha;
+	#endif
+}
+
+// one fixed simulation step
+static void TickTrains(float deltaTime)
+{
+	TrainPool* pool = &g_game.trains;
+	if(deltaTime != pool->tickDuration)
+	{
+		TrainsRebase(deltaTime);
+	}
+	pool->tickCount++;
+	if(g_simEventSteppingOn)
+	{
+		TickTrainsEvents();
+	}
+	else
+	{
+		#if defined(SIM_MULTITHREADED)
+			JobParallelFor(TickTrainsRange, pool->count, g_JobTrainBatchSize, NULL);
+		#else
+			TickTrainsRange(0, pool->count, NULL);
+		#endif
+		TileOccupancyResolve();
+		BlockReservationsResolve();
+	}
+}
+
+// progress starts over at the current tick with the new duration, from the progress of the old one
+static void TrainsRebase(float tickDuration)
+{
+	TrainPool* pool = &g_game.trains;
+	for(int slot = 0; slot < pool->count; ++slot)
+	{
+		if(pool->states[slot] == TRAIN_STATE_DRIVING)
+		{
+			TrainMaterialize(slot);
+			TrainSetProgressStart(slot, pool->tickCount);
+		}
+	}
+	pool->tickDuration = tickDuration;
+	if(g_simEventSteppingOn)
 	{
-		angle += 360.0f;
+		TrainEventsRebuild();
 	}
-
-	return angle;
 }
 
-//----------------------------------------------------------------------------------------------------------------------
-// Loop Topics
-//----------------------------------------------------------------------------------------------------------------------
-
-void TickToolbarUI(void)
+static int TrainCompareSlots(const void* a, const void* b)
 {
-	float screenBottomMargin = 20.0f;
-	float inBetweenButtonsPadding = 10.0f;
-	float buttonHeight = 30.0f;
-	float buttonWidth = 100.0f;
-	float buttonCount = 5.0f;
-	float xStartingPos = (float) g_ScreenWidth * .5f - buttonCount * (inBetweenButtonsPadding + buttonWidth) * 0.5f;
-	float yPos = (float) g_ScreenHeight - buttonHeight - screenBottomMargin;
-	Rectangle buttonRect = {xStartingPos, yPos, buttonWidth, buttonHeight };
+	return *(const int*) a - *(const int*) b;
+}
 
-	for(int actionModeId = 0; actionModeId < ACTION_MODE_COUNT; ++actionModeId)
+// steps only the trains reaching their next tile this tick, the others drive on by the progress formula.
+// Due trains are handled in slot order like the full tick does, so both end in the same state
+static void TickTrainsEvents(void)
+{
+	TrainPool* pool = &g_game.trains;
+	int dueCount = 0;
+	while(pool->eventCount > 0 && pool->events[0].tick <= pool->tickCount)
 	{
-		bool toggleButtonActive = g_game.actionMode == actionModeId;
-		GuiToggle(buttonRect, g_actionModeButtonLabels[actionModeId], &toggleButtonActive);
-		if(toggleButtonActive || IsKeyPressed(g_interactionModeKeyboardShortcuts[actionModeId]))
+		TrainEvent event = TrainEventHeapPop();
+		if(pool->eventTickById[event.trainID] == event.tick)
 		{
-			g_game.actionMode = actionModeId;
+			pool->eventTickById[event.trainID] = g_TrainEventNone;
+			pool->dueSlots[dueCount++] = pool->slotById[event.trainID];
 		}
+	}
+	qsort(pool->dueSlots, dueCount, sizeof(int), TrainCompareSlots);
 
-		buttonRect.x += buttonWidth + inBetweenButtonsPadding;
+	#if defined(SIM_MULTITHREADED)
+		JobParallelFor(TickTrainsDueRange, dueCount, g_JobTrainBatchSize, NULL);
+	#else
+		TickTrainsDueRange(0, dueCount, NULL);
+	#endif
+	for(int i = 0; i < dueCount; ++i)
+	{
+		TileOccupancyUpdateTrain(pool->dueSlots[i]);
+	}
+	if(!BlockReservationsAreCurrent())
+	{
+		BlockReservationsRebuild();
+	}
+	for(int i = 0; i < dueCount; ++i)
+	{
+		BlockResolveTrain(pool->dueSlots[i]);
+	}
+	for(int i = 0; i < dueCount; ++i)
+	{
+		TrainEventSchedule(pool->dueSlots[i]);
+	}
+}
+
+// ticks the trains in slots [begin, end). A train only reads the map and writes its own slot,
+// so ranges can run on different threads in any order
+static void TickTrainsRange(int begin, int end, void* userData)
+{
+	(void) userData;
+	for(int slot = begin; slot < end; ++slot)
+	{
+		TrainStep(slot);
+	}
+}
+
+// ticks the due trains [begin, end) of TickTrainsEvents
+static void TickTrainsDueRange(int begin, int end, void* userData)
+{
+	(void) userData;
+	for(int i = begin; i < end; ++i)
+	{
+		TrainStep(g_game.trains.dueSlots[i]);
 	}
 }
 
-static void TickTrains(void)
+// one train to the current tick of the train clock
+static void TrainStep(int slot)
 {
-	if(g_debugSimPauseOn)
+	TrainPool* pool = &g_game.trains;
+	uint64_t tick = pool->tickCount;
+
+	// a waiting train stopped the tick it got blocked, its transforms are equal already
+	if(pool->states[slot] == TRAIN_STATE_WAITING)
 	{
 		return;
 	}
 
-	for(int i = 0; i < g_MaxTrains; ++i)
+	// keep the last tick's transform for render interpolation, event stepping didn't write it
+	TrainRenderInfo* renderInfo = &pool->renderInfos[slot];
+	if(g_simEventSteppingOn && pool->states[slot] == TRAIN_STATE_DRIVING)
+	{
+		TrainGetTransformAtTick(slot, tick - 1, &renderInfo->modelPosition, &renderInfo->modelRotationInDegree);
+	}
+	renderInfo->previousModelPosition = renderInfo->modelPosition;
+	renderInfo->previousModelRotationInDegree = renderInfo->modelRotationInDegree;
+
+	if(pool->states[slot] == TRAIN_STATE_DRIVING)
 	{
-		if(g_game.trains[i].state != TRAIN_STATE_DISABLED)
+		pool->pathProgressNormalized[slot] = TrainGetProgressAtTick(slot, tick);
+		bool hasStartedOver = false;
+		TrainRoute* route = &pool->routes[slot];
+
+		// a fast train can pass more than one tile per tick
+		while(pool->states[slot] == TRAIN_STATE_DRIVING && pool->pathProgressNormalized[slot] >= 1.0f)
 		{
-			if(g_game.trains[i].state == TRAIN_STATE_DRIVING)
-			{
-				float deltaTime = GetFrameTime(); // seconds?
-				g_game.trains[i].pathProgressNormalized += g_game.trains[i].speedDrive * deltaTime;
+			TileCoords tileCoords = route->tileNext;
+			int tileIndex = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
 
-				if(g_game.trains[i].pathProgressNormalized >= 1.0f)
-				{
-					TileCoords tileCoords = g_game.trains[i].tileNext;
-					int tileIndex = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
+			TileSector entrySectorNeeded = TileSectorGetNextEntryByExit(route->driveToSector);
+			bool hasConnectionToEntry = TileHasConnectionForEntry(tileCoords, entrySectorNeeded);
 
-					TileSector entrySectorNeeded = TileSectorGetNextEntryByExit(g_game.trains[i].driveToSector);
-					bool hasConnectionToEntry = TileHasConnectionForEntry(tileCoords, entrySectorNeeded);
+			// entering another block needs its reservation first, BlockReservationsResolve decides after the tick
+			int currentTileIndex = TileIndexByTileCoords(route->tileCurrent.x, route->tileCurrent.z);
+			int nextBlock = g_game.mapTileRailSegments[tileIndex];
+			bool needsNextBlock = nextBlock >= 0 && nextBlock != g_game.mapTileRailSegments[currentTileIndex] &&
+				nextBlock != pool->reservedBlockById[pool->idBySlot[slot]];
 
-					// check next tile if it has rails
-					if(g_game.mapTiles[tileIndex].type == TILE_TYPE_EMPTY)
-					{
-						g_game.trains[i].state = TRAIN_STATE_BLOCKED;
-					}
-					else if(hasConnectionToEntry == false)
+			// check next tile if it has rails
+			if(g_game.mapTiles[tileIndex].type == TILE_TYPE_EMPTY || hasConnectionToEntry == false)
+			{
+				pool->states[slot] = TRAIN_STATE_BLOCKED;
+				pool->requestedBlocks[slot] = -1;
+			}
+			else if(needsNextBlock)
+			{
+				pool->states[slot] = TRAIN_STATE_BLOCKED;
+				pool->requestedBlocks[slot] = nextBlock;
+			}
+			else
+			{
+				// let's drive the train onto it ...
+				// finished the path on the current tile, needs overflow into next tile including updating everything
+				float progressNormalized = pool->pathProgressNormalized[slot] - 1.0f;
+				TileCoords previousTileCoords = route->tileCurrent;
+				TileCoords currentTileCoords = route->tileNext;
+
+				TileSector entrySector = TileSectorGetNextEntryByExit(route->driveToSector);
+
+				ConnectionDirection activeConnection;
+				int activeConnectionCount = TileHConnectionsCount(g_game.mapTiles[tileIndex].connectionsActive);
+				if(activeConnectionCount == 1)
+				{
+					activeConnection = g_game.mapTiles[tileIndex].connectionsActive;
+				}
+				else
+				{
+					// find which one is serving the entry point needed
+					// hardcoded for now for the rail crosssection
+					if(entrySector == TILE_SECTOR_N || entrySector == TILE_SECTOR_S)
 					{
-						g_game.trains[i].state = TRAIN_STATE_BLOCKED;
+						activeConnection = CONNECTION_NS_SN;
 					}
 					else
 					{
-						// let's drive the train onto it ...
-						// finished the path on the current tile, needs overflow into next tile including updating everything
-						float progressNormalized = fmodf(g_game.trains[i].pathProgressNormalized, 1.0f);
-						TileCoords previousTileCoords = g_game.trains[i].tileCurrent;
-						TileCoords currentTileCoords =  g_game.trains[i].tileNext;
-
-						TileSector entrySector = TileSectorGetNextEntryByExit(g_game.trains[i].driveToSector);
-
-						ConnectionDirection activeConnection;
-						int activeConnectionCount = TileHConnectionsCount(g_game.mapTiles[tileIndex].connectionsActive);
-						if(activeConnectionCount == 1)
-						{
-							activeConnection = g_game.mapTiles[tileIndex].connectionsActive;
-						}
-						else
-						{
-							// find which one is serving the entry point needed
-							// hardcoded for now for the rail crosssection
-							if(entrySector == TILE_SECTOR_N || entrySector == TILE_SECTOR_S)
-							{
-								activeConnection = CONNECTION_NS_SN;
-							}
-							else
-							{
-								activeConnection = CONNECTION_EW_WE;
-							}
-						}
-
-						// while next tile has rails, let's check if it has a fitting entry point where we want to enter
-						TileSector exitSector = TileSectorGetExitFromEntryAndConnectionDirection(activeConnection, entrySector);
-						TileCoords nextTile = TileGetNextFromExitSector(tileCoords, exitSector);
-
-						// update train to next tile
-						g_game.trains[i].pathProgressNormalized = progressNormalized;
-						g_game.trains[i].tilePrevious = previousTileCoords;
-						g_game.trains[i].tileCurrent = currentTileCoords;
-
-						g_game.trains[i].tileNext = nextTile;
-						g_game.trains[i].driveFromSector = entrySector;
-						g_game.trains[i].driveToSector = exitSector;
-						g_game.trains[i].tileConnectionUsed = activeConnection;
+						activeConnection = CONNECTION_EW_WE;
 					}
 				}
 
-				if(g_game.trains[i].state == TRAIN_STATE_DRIVING)
-				{
-					// cure progress increase by delta time and train speed
-					Vector3 startPosition = TileSectorGetEdgePosition(g_game.trains[i].tileCurrent, g_game.trains[i].driveFromSector);
-					Vector3 endPosition = TileSectorGetEdgePosition(g_game.trains[i].tileCurrent, g_game.trains[i].driveToSector);
-					Vector3 middlePosition = TileGetCenterPosition(g_game.trains[i].tileCurrent);
-					g_game.trains[i].modelPosition = Bezier3D(startPosition, middlePosition, endPosition, g_game.trains[i].pathProgressNormalized);
-
-					// curve alignment by look at a point ahead of the curve
-					Vector3 lookAheadPosition = Bezier3D(startPosition, middlePosition, endPosition, g_game.trains[i].pathProgressNormalized + 0.1f);
-					g_game.trains[i].modelRotationInDegree = CalculateLookAtAngle(g_game.trains[i].modelPosition, lookAheadPosition);
-				}
+				// while next tile has rails, let's check if it has a fitting entry point where we want to enter
+				TileSector exitSector = TileSectorGetExitFromEntryAndConnectionDirection(activeConnection, entrySector);
+				TileCoords nextTile = TileGetNextFromExitSector(tileCoords, exitSector);
+
+				// update train to next tile
+				pool->pathProgressNormalized[slot] = progressNormalized;
+				route->tilePrevious = previousTileCoords;
+				route->tileCurrent = currentTileCoords;
+
+				route->tileNext = nextTile;
+				route->driveFromSector = entrySector;
+				route->driveToSector = exitSector;
+				route->tileConnectionUsed = activeConnection;
+				TrainRouteUpdateCurve(route);
+				hasStartedOver = true;
 			}
-			else if(g_game.trains[i].state == TRAIN_STATE_BLOCKED)
+		}
+
+		if(pool->states[slot] == TRAIN_STATE_DRIVING)
+		{
+			// position and heading come from the precomputed curve
+			TrainRouteSampleCurve(route, pool->pathProgressNormalized[slot], &renderInfo->modelPosition, &renderInfo->modelRotationInDegree);
+			if(hasStartedOver)
 			{
-				TileCoords tileCoords = g_game.trains[i].tileNext;
-				int tileIndex = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
-				if(g_game.mapTiles[tileIndex].type == TILE_TYPE_RAILS)
-				{
-					g_game.trains[i].state = TRAIN_STATE_DRIVING;
-				}
+				TrainSetProgressStart(slot, tick);
 			}
 		}
 	}
@@ -1532,12 +7435,11 @@ static void TickTrains(void)
 
 void TickPaintRails(void)
 {
-	RayCollision rayCollision = MapMouseRaycast();
-	if(rayCollision.hit)
+	if(g_game.hoveredTile.isHit)
 	{
-		TileCoords tileCoords = TileGetCoordsFromWorldPoint(rayCollision.point);
+		TileCoords tileCoords = g_game.hoveredTile.coords;
 		Vector3 tileCenterPoint = TileGetCenterPosition(tileCoords);
-		TileSector sector = TileSectorGetFromWorldPoint(rayCollision.point);
+		TileSector sector = g_game.hoveredTile.sector;
 		Vector3 sectorCenterPoint = TileSectorGetCenterPosition(tileCoords, sector);
 
 		// draw grid cursor
@@ -1552,17 +7454,14 @@ void TickPaintRails(void)
 		else if(IsMouseButtonDown(MOUSE_BUTTON_LEFT) ||IsKeyDown(KEY_SPACE) )
 		{
 
-			SectorTrailPaintAt(tileCoords, sector);
+			GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_BRUSH_PAINT, .params.brush = {tileCoords, sector}});
 			//TileAddRailConnection(tileCoords.x, tileCoords.z, TILE_TYPE_RAILS, true, false, true, false);
 		}
-		if(IsMouseButtonReleased(MOUSE_BUTTON_LEFT) || IsKeyReleased(KEY_SPACE))
-		{
-			if(g_game.brushSectorTrailLength > 0)
-			{
-				SectorTrailBakeConnection();
-			}
-			g_game.brushSectorTrailLength = 0;
-		}
+	}
+	// also when the cursor left the map while painting, or the trail stays until the next stroke
+	if(IsMouseButtonReleased(MOUSE_BUTTON_LEFT) || IsKeyReleased(KEY_SPACE))
+	{
+		GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_BRUSH_RELEASE});
 	}
 
 	// draw tile sector based paint brush cursor
@@ -1577,42 +7476,26 @@ void TickPaintRails(void)
 
 void TickBulldozer(void)
 {
-	RayCollision rayCollision = MapMouseRaycast();
-	if(rayCollision.hit)
+	if(g_game.hoveredTile.isHit)
 	{
-		TileCoords tileCoords = TileGetCoordsFromWorldPoint(rayCollision.point);
+		TileCoords tileCoords = g_game.hoveredTile.coords;
 		Vector3 tileCenterPoint = TileGetCenterPosition(tileCoords);
-		int tileIndex = TileIndexByTileCoords(tileCoords.x, tileCoords.z);
+		int tileIndex = g_game.hoveredTile.tileIndex;
 		if(g_game.mapTiles[tileIndex].type == TILE_TYPE_RAILS)
 		{
 			// can delete cursor
 
 			if(IsMouseButtonPressed(MOUSE_LEFT_BUTTON) || IsKeyPressed(KEY_SPACE))
 			{
-				bool veto = false;
 				// any train on that tile?
-				for(int trainIndex = 0; trainIndex < g_MaxTrains; ++trainIndex)
+				SimPipelineWait();
+				if(TileIsOccupied(tileIndex))
 				{
-					if(g_game.trains[trainIndex].state == TRAIN_STATE_DRIVING)
-					{
-						int trainX = g_game.trains[trainIndex].tileCurrent.x;
-						int trainZ = g_game.trains[trainIndex].tileCurrent.z;
-
-						if(tileCoords.x != trainX && tileCoords.z == trainZ)
-						{
-							veto = true;
-							DrawCube(tileCenterPoint, 1, 0.01f, 1, COLOR_RED);
-							break;
-						}
-					}
+					DrawCube(tileCenterPoint, 1, 0.01f, 1, COLOR_RED);
 				}
-
-				if(veto == false)
+				else
 				{
-					g_game.mapTiles[tileIndex].type = TILE_TYPE_EMPTY;
-					g_game.mapTiles[tileIndex].connectionOptions = 0; // none
-					g_game.mapTiles[tileIndex].connectionsActive = 0;
-					g_game.mapTiles[tileIndex].modelRotationInDegree = 0;
+					GameCommandSubmit((GameCommand) {.type = GAME_COMMAND_TILE_CLEAR, .params.tile = tileCoords});
 					DrawCube(tileCenterPoint, 1, 0.01f, 1, COLOR_GREEN);
 				}
 			}
@@ -1629,14 +7512,73 @@ void TickBulldozer(void)
 	}
 }
 
+// title screen while the assets load, one step per frame so the window (or the browser tab) stays responsive
+static void TickLoadingScreen(void)
+{
+	bool isLoaded = AssetsLoadStep();
+	const AssetLoadState* load = &g_game.assetLoad;
+	float progress = load->stepCount > 0 ? (float) load->nextStep / (float) load->stepCount : 0.0f;
+
+	BeginDrawing();
+	ClearBackground(COLOR_BLACK);
+	int centerX = GetScreenWidth() / 2;
+	int centerY = GetScreenHeight() / 2;
+	const char* title = "raylib gamejam game test";
+	DrawText(title, centerX - MeasureText(title, 40) / 2, centerY - 80, 40, COLOR_WHITE);
+	Rectangle bar = {centerX - 200, centerY, 400, 24};
+	GuiProgressBar(bar, NULL, NULL, &progress, 0.0f, 1.0f);
+	if(!isLoaded && load->currentName != NULL)
+	{
+		const char* text = TextFormat("loading %s", load->currentName);
+		DrawText(text, centerX - MeasureText(text, 20) / 2, centerY + 40, 20, COLOR_GREY);
+	}
+	EndDrawing();
+
+	if(isLoaded)
+	{
+		g_game.state = APP_STATE_GAMEPLAY;
+	}
+}
+
 // Update and draw frame
 void TickMainLoop(void)
 {
+	if(g_game.state == APP_STATE_TITLE)
+	{
+		TickLoadingScreen();
+		return;
+	}
+	ProfileBegin(PROFILE_ZONE_FRAME);
+	MemoryArenaReset(&g_memory.frameArena);
+
 	//----------------------------------------------------------------------------------
     // Update
 	//----------------------------------------------------------------------------------
-	TickCamera();
-	TickTrains();
+	ReplayFrameBegin();
+	bool isReplayPlaying = g_replay.state == REPLAY_STATE_PLAYING; // player input is ignored meanwhile
+	ProfileBegin(PROFILE_ZONE_CAMERA);
+	if(!isReplayPlaying)
+	{
+		TickCamera();
+	}
+	ProfileEnd(PROFILE_ZONE_CAMERA);
+	TickSimulation();
+	ProfileBegin(PROFILE_ZONE_ROUTING);
+	TickRouting();
+	ProfileEnd(PROFILE_ZONE_ROUTING);
+	ProfileBegin(PROFILE_ZONE_BRUSH);
+	ReplayPlayFrameCommands(); // after ticks and routing like the brush, but before drawing so the camera is current
+	ProfileEnd(PROFILE_ZONE_BRUSH);
+	MapUpdateHoveredTile();
+	if(!SimPipelineIsPending())
+	{
+		// ticked on the main thread, drawn right away
+		if(TrainRenderSnapshotWrite())
+		{
+			TrainRenderSnapshotSwap();
+		}
+		g_game.trainSnapshots.interpolationAlpha = g_game.simClock.interpolationAlpha;
+	}
 
 	//----------------------------------------------------------------------------------
     // Draw
@@ -1644,56 +7586,49 @@ void TickMainLoop(void)
 
 	BeginDrawing();
 		ClearBackground(BLACK);
+		ProfileBegin(PROFILE_ZONE_DRAW_TILES);
+		RenderPrepareRailTiles();
+		ProfileEnd(PROFILE_ZONE_DRAW_TILES);
 		// Render 3D scene
 		BeginMode3D(g_game.camera);
 
-			float width = (float) g_MapGridSize;
-			float center = width * 0.5f;
-			DrawPlane((Vector3){ center, 0.0f, center }, (Vector2){ width, width }, COLOR_GREEN); // ground plane
-			DrawGridAt(g_MapGridSize, 1.0f, center, 0.01f, center, COLOR_BLACK, COLOR_RED);
+			RenderGround();
 
 
-			if(g_game.actionMode == ACTION_MODE_BUILD_RAILS)
+			ProfileBegin(PROFILE_ZONE_BRUSH);
+			if(g_game.actionMode == ACTION_MODE_BUILD_RAILS && !isReplayPlaying)
 			{
 				TickPaintRails();
 			}
-			else if(g_game.actionMode == ACTION_MODE_BUILD_BULLDOZER)
+			else if(g_game.actionMode == ACTION_MODE_BUILD_BULLDOZER && !isReplayPlaying)
 			{
 				TickBulldozer();
 			}
-			// todo signals
+			ProfileEnd(PROFILE_ZONE_BRUSH);
+			if(g_game.actionMode == ACTION_MODE_CHANGE_SIGNALS)
+			{
+				RenderBlockReservations();
+			}
 			// todo economy
 
-			const Vector3 vectorUp = (Vector3) {0,1,0};
-
 			////////////////////////////////////////////////////////////////////////////////////////////////////////////
 			// draw rails on tiles
-			for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
-			{
-				TileInfo tile = g_game.mapTiles[tileIndex];
-				if(tile.type == TILE_TYPE_RAILS)
-				{
-					TileCoords tileCoords = TileCoordsByIndex(tileIndex);
-					Vector3 tileCenter = TileGetCenterPosition(tileCoords);
-					DrawModelEx(g_game.assetModels[tile.modelID], tileCenter, vectorUp, tile.modelRotationInDegree, Vector3One(), COLOR_WHITE);
-				}
-			}
+			ProfileBegin(PROFILE_ZONE_DRAW_TILES);
+			RenderRailTiles();
+			RenderDebugRoute();
+			ProfileEnd(PROFILE_ZONE_DRAW_TILES);
 
 			////////////////////////////////////////////////////////////////////////////////////////////////////////////
 			// draw trains
-			for(int i = 0; i < g_MaxTrains; ++i)
-			{
-				if(g_game.trains[i].state != TRAIN_STATE_DISABLED && g_game.trains[i].state != TRAIN_STATE_HIDDEN)
-				{
-					TrainInfo train = g_game.trains[i];
-					DrawModelEx(g_game.assetModels[train.modelID], train.modelPosition, vectorUp, train.modelRotationInDegree, Vector3One(), WHITE);
-				}
-			}
+			ProfileBegin(PROFILE_ZONE_DRAW_TRAINS);
+			RenderTrains();
+			ProfileEnd(PROFILE_ZONE_DRAW_TRAINS);
 
 		EndMode3D();
 
 		////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         // UI
+		ProfileBegin(PROFILE_ZONE_UI);
 		int frameThickness = 16;
 		DrawRectangle(0,frameThickness, g_ScreenWidth, 30, BLACK); // background
 		DrawText("Rayl Connections (pre-alpha)", 200, 15, 30, WHITE);
@@ -1702,7 +7637,386 @@ void TickMainLoop(void)
 		TickToolbarUI();
 		RenderDebugWindow();
 		DrawFPS(20, 20);
+		ProfileEnd(PROFILE_ZONE_UI);
 
+	ProfileBegin(PROFILE_ZONE_END_DRAWING);
     EndDrawing();
+	ProfileEnd(PROFILE_ZONE_END_DRAWING);
     //----------------------------------------------------------------------------------  
+
+	SimPipelineFrameEnd();
+	ReplayFrameEnd();
+	ProfileEnd(PROFILE_ZONE_FRAME);
+	ProfileFrameEnd();
+}
+
+#if defined(SIM_BENCHMARK)
+//----------------------------------------------------------------------------------------------------------------------
+// Headless simulation benchmark
+//----------------------------------------------------------------------------------------------------------------------
+// no window and no rendering: builds a synthetic network, spawns trains and times TickTrains
+typedef enum : uint8_t // c99
+{
+	BENCHMARK_NETWORK_GRID = 0,		// overlapping square loops, crossings everywhere
+	BENCHMARK_NETWORK_SPAGHETTI,	// random rails, junctions and dead ends
+	BENCHMARK_NETWORK_LOOPS,		// concentric loops spanning the map
+	BENCHMARK_NETWORK_COUNT
+} BenchmarkNetwork;
+
+const char* BenchmarkNetworkToString(BenchmarkNetwork network)
+{
+	switch (network)
+	{
+		case BENCHMARK_NETWORK_GRID:     	return "grid";
+		case BENCHMARK_NETWORK_SPAGHETTI:	return "spaghetti";
+		case BENCHMARK_NETWORK_LOOPS:     	return "loops";
+		default:                 			return "unknown";
+	}
+}
+
+typedef struct BenchmarkSettings
+{
+	int mapGridSize;
+	int trainCount;
+	int tickCount;
+	int warmupTickCount;
+	unsigned int seed;
+	bool isEventStepping;
+} BenchmarkSettings;
+
+static double BenchmarkGetTime(void)
+{
+	struct timespec time;
+	#if defined(_WIN32)
+		timespec_get(&time, TIME_UTC);
+	#else
+		clock_gettime(CLOCK_MONOTONIC, &time);
+	#endif
+	return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+// own generator so every platform builds the same networks for a seed
+static unsigned int BenchmarkRandom(unsigned int* state)
+{
+	*state = *state * 1103515245u + 12345u;
+	return *state >> 8;
+}
+
+// same layout as the starting loop, corners (x0,z0) and (x1,z1)
+static void BenchmarkAddLoop(int x0, int z0, int x1, int z1)
+{
+	for(int x = x0 + 1; x < x1; ++x)
+	{
+		TileAddConnectionAndUpdateRailsModel(x, z0, CONNECTION_EW_WE);
+		TileAddConnectionAndUpdateRailsModel(x, z1, CONNECTION_EW_WE);
+	}
+	for(int z = z0 + 1; z < z1; ++z)
+	{
+		TileAddConnectionAndUpdateRailsModel(x0, z, CONNECTION_NS_SN);
+		TileAddConnectionAndUpdateRailsModel(x1, z, CONNECTION_NS_SN);
+	}
+	TileAddConnectionAndUpdateRailsModel(x1, z0, CONNECTION_NE_EN);
+	TileAddConnectionAndUpdateRailsModel(x1, z1, CONNECTION_ES_SE);
+	TileAddConnectionAndUpdateRailsModel(x0, z1, CONNECTION_SW_WS);
+	TileAddConnectionAndUpdateRailsModel(x0, z0, CONNECTION_NW_WN);
+}
+
+static void BenchmarkBuildNetwork(BenchmarkNetwork network, unsigned int seed)
+{
+	int margin = 2;
+	int last = g_MapGridSize - 1 - margin;
+	if(network == BENCHMARK_NETWORK_GRID)
+	{
+		// checkerboard of 8x8 loops shifted by half a loop, so neighbours only meet in crossings
+		int half = 4;
+		for(int j = 0; margin + j * half + 2 * half - 1 <= last; ++j)
+		{
+			for(int i = j % 2; margin + i * half + 2 * half - 1 <= last; i += 2)
+			{
+				int x0 = margin + i * half;
+				int z0 = margin + j * half;
+				BenchmarkAddLoop(x0, z0, x0 + 2 * half - 1, z0 + 2 * half - 1);
+			}
+		}
+	}
+	else if(network == BENCHMARK_NETWORK_SPAGHETTI)
+	{
+		static const ConnectionDirection connections[] = {CONNECTION_NS_SN, CONNECTION_EW_WE, CONNECTION_ES_SE, CONNECTION_SW_WS, CONNECTION_NW_WN, CONNECTION_NE_EN};
+		unsigned int state = seed;
+		int span = last - margin + 1;
+		int paintCount = span * span;
+		for(int i = 0; i < paintCount; ++i)
+		{
+			int x = margin + (int) (BenchmarkRandom(&state) % (unsigned int) span);
+			int z = margin + (int) (BenchmarkRandom(&state) % (unsigned int) span);
+			TileAddConnectionAndUpdateRailsModel(x, z, connections[BenchmarkRandom(&state) % 6]);
+		}
+	}
+	else
+	{
+		for(int inset = 0; margin + inset * 2 + 3 <= last - inset * 2; ++inset)
+		{
+			BenchmarkAddLoop(margin + inset * 2, margin + inset * 2, last - inset * 2, last - inset * 2);
+		}
+	}
+}
+
+// trains start mid tile on north-south straights, like the starting train. Spread over the map with a stride
+static int BenchmarkSpawnTrains(int trainCount)
+{
+	int candidateCount = 0;
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		candidateCount += g_game.mapTiles[tileIndex].connectionOptions == CONNECTION_NS_SN ? 1 : 0;
+	}
+	if(candidateCount == 0)
+	{
+		return 0;
+	}
+
+	int* candidates = MemAlloc(candidateCount * sizeof(int));
+	int candidate = 0;
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		if(g_game.mapTiles[tileIndex].connectionOptions == CONNECTION_NS_SN)
+		{
+			candidates[candidate++] = tileIndex;
+		}
+	}
+
+	int stride = 7919; // prime, walks all candidates before repeating unless it divides the count
+	for(int i = 0; i < trainCount; ++i)
+	{
+		int pass = i / candidateCount;
+		TileCoords tileCoords = TileCoordsByIndex(candidates[(int) (((int64_t) i * stride) % candidateCount)]);
+		TrainSpawn((TrainInfo)
+		{
+			.state = TRAIN_STATE_DRIVING,
+			.modelID = MODEL_TRAIN_LOCOMOTIVE_A,
+			.tilePrevious = (TileCoords) {tileCoords.x, tileCoords.z - 1},
+			.tileNext = (TileCoords) {tileCoords.x, tileCoords.z + 1},
+			.tileCurrent = tileCoords,
+			.modelPosition = TileGetCenterPosition(tileCoords),
+			.speedDrive = 0.5f,
+			.speedLoad = 3,
+			.speedUnload = 3,
+			.pathProgressNormalized = 0.5f / (float) (pass + 1), // trains sharing a tile start apart
+			.tileConnectionUsed = CONNECTION_NS_SN,
+			.driveFromSector = TILE_SECTOR_S,
+			.driveToSector = TILE_SECTOR_N,
+		});
+	}
+	MemFree(candidates);
+	return candidateCount;
+}
+
+// waits for a train that waits for another one and so on, back to a waiting train. Trains queued behind a driving
+// train only wait longer, these never drive again
+static bool BenchmarkTrainIsDeadlocked(int slot)
+{
+	const TrainPool* pool = &g_game.trains;
+	for(int step = 0; step < pool->count; ++step)
+	{
+		if(pool->states[slot] != TRAIN_STATE_WAITING || pool->waitingBlockById[pool->idBySlot[slot]] < 0)
+		{
+			return false;
+		}
+		TrainID holder = g_game.railGraph.segments[pool->waitingBlockById[pool->idBySlot[slot]]].reservedBy;
+		if(holder == g_TrainIDNone)
+		{
+			return false;
+		}
+		slot = pool->slotById[holder];
+	}
+	return true; // more waits than trains, the chain runs in a circle
+}
+
+// a clone spawned into the block its train holds waits where it spawned. The slot it gets still has the progress start
+// of a despawned train, which must not leak into the clone
+static bool BenchmarkCheckSpawnIntoHeldBlock(void)
+{
+	TrainPool* pool = &g_game.trains;
+	BlockReservationsResolve();
+	int sourceSlot = -1;
+	for(int slot = 0; slot < pool->count - 1 && sourceSlot < 0; ++slot)
+	{
+		TileCoords tileCoords = pool->routes[slot].tileCurrent;
+		int segmentIndex = g_game.mapTileRailSegments[TileIndexByTileCoords(tileCoords.x, tileCoords.z)];
+		if(pool->states[slot] == TRAIN_STATE_DRIVING && segmentIndex >= 0 && pool->reservedBlockById[pool->idBySlot[slot]] == segmentIndex)
+		{
+			sourceSlot = slot;
+		}
+	}
+	if(sourceSlot < 0)
+	{
+		return true; // no train to clone
+	}
+
+	TrainInfo clone = TrainGetInfoBySlot(sourceSlot);
+	TrainDespawn(pool->idBySlot[pool->count - 1]);
+	int cloneSlot = pool->slotById[TrainSpawn(clone)];
+	TrainMaterialize(cloneSlot);
+	if(pool->states[cloneSlot] != TRAIN_STATE_WAITING || pool->pathProgressNormalized[cloneSlot] != clone.pathProgressNormalized)
+	{
+		fprintf(stderr, "spawn into a held block: clone state %d progress %f, expected waiting at %f\n", pool->states[cloneSlot],
+			pool->pathProgressNormalized[cloneSlot], clone.pathProgressNormalized);
+		return false;
+	}
+	return true;
+}
+
+// false if trains got stuck on the grid network or a spawn into a held block went wrong
+static bool BenchmarkRun(BenchmarkNetwork network, BenchmarkSettings settings)
+{
+	double setupStartTime = BenchmarkGetTime();
+	g_benchmarkAllocations = (BenchmarkAllocationCounts) {0};
+	GameplayClearState(settings.mapGridSize);
+	SimSetEventStepping(settings.isEventStepping);
+	BenchmarkBuildNetwork(network, settings.seed);
+	BenchmarkSpawnTrains(settings.trainCount);
+	double setupTime = BenchmarkGetTime() - setupStartTime;
+	int64_t setupAllocations = g_benchmarkAllocations.allocs + g_benchmarkAllocations.reallocs;
+
+	int railsTileCount = 0;
+	for(int tileIndex = 0; tileIndex < g_TileCount; ++tileIndex)
+	{
+		railsTileCount += g_game.mapTiles[tileIndex].type == TILE_TYPE_RAILS ? 1 : 0;
+	}
+
+	float tickDuration = 1.0f / g_game.simClock.tickRate;
+	for(int tick = 0; tick < settings.warmupTickCount; ++tick)
+	{
+		TickTrains(tickDuration);
+	}
+	int startWaitingCount = g_game.trains.waitingCount;
+
+	g_benchmarkAllocations = (BenchmarkAllocationCounts) {0};
+	double startTime = BenchmarkGetTime();
+	for(int tick = 0; tick < settings.tickCount; ++tick)
+	{
+		TickTrains(tickDuration);
+	}
+	double runTime = BenchmarkGetTime() - startTime;
+
+	int driving = 0;
+	int stuck = 0;
+	for(int slot = 0; slot < g_game.trains.count; ++slot)
+	{
+		driving += g_game.trains.states[slot] == TRAIN_STATE_DRIVING ? 1 : 0;
+		stuck += BenchmarkTrainIsDeadlocked(slot) ? 1 : 0;
+	}
+
+	double trainTicks = (double) settings.tickCount * (double) g_game.trains.count;
+	printf("network=%s map=%d stepping=%s rails_tiles=%d nodes=%d segments=%d trains=%d driving=%d waiting=%d stuck=%d ticks=%d "
+		"setup_ms=%.2f setup_allocs=%lld ticks_per_sec=%.1f ns_per_train_tick=%.2f tick_allocs=%lld tick_reallocs=%lld tick_frees=%lld "
+		"state_checksum=%08x\n",
+		BenchmarkNetworkToString(network), g_MapGridSize, settings.isEventStepping ? "events" : "ticks", railsTileCount,
+		g_game.railGraph.nodeCount - g_game.railGraph.freeNodeCount, g_game.railGraph.segmentCount - g_game.railGraph.freeSegmentCount,
+		g_game.trains.count, driving, g_game.trains.waitingCount, stuck, settings.tickCount, setupTime * 1000.0, (long long) setupAllocations,
+		runTime > 0 ? (double) settings.tickCount / runTime : 0.0, trainTicks > 0 ? runTime * 1e9 / trainTicks : 0.0,
+		(long long) g_benchmarkAllocations.allocs, (long long) g_benchmarkAllocations.reallocs, (long long) g_benchmarkAllocations.frees,
+		ReplayGetStateChecksum());
+
+	// the grid has no track ends, the trains spawned into held blocks only leave their queues there
+	if(network == BENCHMARK_NETWORK_GRID && (stuck > 0 || g_game.trains.waitingCount > startWaitingCount))
+	{
+		fprintf(stderr, "grid: %d trains wait in a circle, %d waiting after the warmup and %d after %d ticks\n",
+			stuck, startWaitingCount, g_game.trains.waitingCount, settings.tickCount);
+		return false;
+	}
+	return BenchmarkCheckSpawnIntoHeldBlock();
+}
+
+// "-network grid|spaghetti|loops|all", "-map <tiles per side>", "-trains <count>", "-ticks <count>",
+// "-warmup <ticks>", "-simrate <ticks per second>", "-simthreads <count>", "-seed <number>" and "-stepping ticks|events"
+int main(int argc, char* argv[])
+{
+	const char* networkName = "all";
+	GameSettings gameSettings = (GameSettings)
+	{
+		.mapGridSize = 256,
+		.simTickRate = g_SimTickRateDefault,
+		.simWorkerCount = -1
+	};
+	BenchmarkSettings settings = (BenchmarkSettings)
+	{
+		.trainCount = 1000,
+		.tickCount = 2000,
+		.warmupTickCount = 100,
+		.seed = 1
+	};
+	for (int argIndex = 1; argIndex < argc - 1; argIndex++)
+	{
+		if (strcmp(argv[argIndex], "-network") == 0)
+		{
+			networkName = argv[argIndex + 1];
+		}
+		else if (strcmp(argv[argIndex], "-map") == 0)
+		{
+			gameSettings.mapGridSize = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-trains") == 0)
+		{
+			settings.trainCount = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-ticks") == 0)
+		{
+			settings.tickCount = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-warmup") == 0)
+		{
+			settings.warmupTickCount = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-simrate") == 0)
+		{
+			gameSettings.simTickRate = (float) atof(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-simthreads") == 0)
+		{
+			gameSettings.simWorkerCount = atoi(argv[argIndex + 1]);
+		}
+		else if (strcmp(argv[argIndex], "-seed") == 0)
+		{
+			settings.seed = (unsigned int) strtoul(argv[argIndex + 1], NULL, 10);
+		}
+		else if (strcmp(argv[argIndex], "-stepping") == 0)
+		{
+			settings.isEventStepping = strcmp(argv[argIndex + 1], "events") == 0;
+		}
+	}
+
+	SetTraceLogLevel(LOG_WARNING);
+	g_game.settings = gameSettings;
+	settings.mapGridSize = gameSettings.mapGridSize;
+	TrackCurvesBuild();
+	#if defined(SIM_MULTITHREADED)
+		JobSystemStart(gameSettings.simWorkerCount);
+	#endif
+
+	bool runAllNetworks = strcmp(networkName, "all") == 0;
+	bool isKnownNetwork = runAllNetworks;
+	bool isPassed = true;
+	for(int network = 0; network < BENCHMARK_NETWORK_COUNT; ++network)
+	{
+		if(runAllNetworks || strcmp(networkName, BenchmarkNetworkToString(network)) == 0)
+		{
+			isPassed = BenchmarkRun(network, settings) && isPassed;
+			isKnownNetwork = true;
+		}
+	}
+	if(!isKnownNetwork)
+	{
+		fprintf(stderr, "unknown network '%s', use grid, spaghetti, loops or all\n", networkName);
+	}
+
+	#if defined(SIM_MULTITHREADED)
+		JobSystemStop();
+	#endif
+	MapFree();
+	RailGraphFree();
+	TrainPoolFree();
+	RoutePlannerFree();
+	MemoryFree();
+	return isKnownNetwork && isPassed ? 0 : 1;
 }
+#endif
@@ -0,0 +1,453 @@
+/*******************************************************************************************
+*
+*   Mesh baker: converts a Wavefront .obj (+ its .mtl) into the .mesh format of baked_mesh.h
+*
+*   Runs on the build host, offline, so the game doesn't text-parse models at startup.
+*   Meshes are split per material and welded on the obj index triples, texcoords are flipped
+*   the same way raylib's LoadOBJ() does it. Like there, faces using a material the .mtl doesn't
+*   define get the first material, and an obj without .mtl gets a plain white one.
+*
+*   Usage: mesh_baker <input.obj> <output.mesh>
+*
+********************************************************************************************/
+
+#include "baked_mesh.h"
+
+#include <stdio.h>                          // Required for: fopen(), fprintf()
+#include <stdlib.h>                         // Required for: calloc(), realloc(), free(), strtof(), strtol()
+#include <string.h>                         // Required for: strncmp(), strcspn()
+
+//----------------------------------------------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------------------------------------------
+typedef struct FloatArray
+{
+	float* values;
+	int count;
+	int capacity;
+} FloatArray;
+
+typedef struct ObjCorner
+{
+	int position;	// 0 based, -1 if missing
+	int texcoord;
+	int normal;
+} ObjCorner;
+
+typedef struct ObjGroup
+{
+	char materialName[BAKED_MESH_TEXTURE_NAME_SIZE];
+	ObjCorner* corners;		// 3 per triangle
+	int cornerCount;
+	int cornerCapacity;
+} ObjGroup;
+
+typedef struct MtlMaterial
+{
+	char name[BAKED_MESH_TEXTURE_NAME_SIZE];
+	BakedMaterial baked;
+} MtlMaterial;
+
+#define GROUP_MAX 16			// materials used by one obj
+#define MATERIAL_MAX 16			// materials defined by one mtl
+#define FACE_CORNER_MAX 32
+
+static FloatArray g_positions;
+static FloatArray g_texcoords;
+static FloatArray g_normals;
+static ObjGroup g_groups[GROUP_MAX];
+static int g_groupCount;
+static MtlMaterial g_materials[MATERIAL_MAX];
+static int g_materialCount;
+
+//----------------------------------------------------------------------------------------------------------------------
+// Parsing
+//----------------------------------------------------------------------------------------------------------------------
+static void FloatArrayPush(FloatArray* array, float value)
+{
+	if(array->count == array->capacity)
+	{
+		array->capacity = array->capacity == 0 ? 1024 : array->capacity * 2;
+		array->values = realloc(array->values, array->capacity * sizeof(float));
+	}
+	array->values[array->count++] = value;
+}
+
+static void ReadFloats(FloatArray* array, const char* text, int count)
+{
+	char* end = NULL;
+	for(int i = 0; i < count; ++i)
+	{
+		FloatArrayPush(array, strtof(text, &end));
+		text = end;
+	}
+}
+
+// copies the rest of the line without surrounding whitespace
+static void ReadName(char* name, const char* text)
+{
+	while(*text == ' ' || *text == '\t')
+	{
+		++text;
+	}
+	size_t length = strcspn(text, "\r\n");
+	while(length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t'))
+	{
+		--length;
+	}
+	length = length < BAKED_MESH_TEXTURE_NAME_SIZE - 1 ? length : BAKED_MESH_TEXTURE_NAME_SIZE - 1;
+	memcpy(name, text, length);
+	name[length] = '\0';
+}
+
+static ObjGroup* GetGroup(const char* materialName)
+{
+	for(int i = 0; i < g_groupCount; ++i)
+	{
+		if(strcmp(g_groups[i].materialName, materialName) == 0)
+		{
+			return &g_groups[i];
+		}
+	}
+	if(g_groupCount == GROUP_MAX)
+	{
+		fprintf(stderr, "mesh_baker: more than %d materials\n", GROUP_MAX);
+		exit(1);
+	}
+	ObjGroup* group = &g_groups[g_groupCount++];
+	strcpy(group->materialName, materialName);
+	return group;
+}
+
+static void GroupPushCorner(ObjGroup* group, ObjCorner corner)
+{
+	if(group->cornerCount == group->cornerCapacity)
+	{
+		group->cornerCapacity = group->cornerCapacity == 0 ? 1024 : group->cornerCapacity * 2;
+		group->corners = realloc(group->corners, group->cornerCapacity * sizeof(ObjCorner));
+	}
+	group->corners[group->cornerCount++] = corner;
+}
+
+// obj indices are 1 based, negative ones count back from the end, 0 when the corner has none. Indices past the
+// vertex data read before the face would be read out of bounds
+static int ResolveIndex(long index, int count, const char* name)
+{
+	long resolved = index > 0 ? index - 1 : index < 0 ? count + index : -1;
+	if(index != 0 && (resolved < 0 || resolved >= count))
+	{
+		fprintf(stderr, "mesh_baker: face %s index %ld outside of the %d read so far\n", name, index, count);
+		exit(1);
+	}
+	return (int) resolved;
+}
+
+// "f v/vt/vn ..." with optional vt and vn, polygons get fanned into triangles
+static void ReadFace(ObjGroup* group, const char* text)
+{
+	ObjCorner corners[FACE_CORNER_MAX];
+	int cornerCount = 0;
+	char* end = NULL;
+	while(cornerCount < FACE_CORNER_MAX)
+	{
+		long position = strtol(text, &end, 10);
+		if(end == text)
+		{
+			break;
+		}
+		text = end;
+		long texcoord = 0;
+		long normal = 0;
+		if(*text == '/')
+		{
+			++text;
+			texcoord = strtol(text, &end, 10);
+			text = end;
+			if(*text == '/')
+			{
+				++text;
+				normal = strtol(text, &end, 10);
+				text = end;
+			}
+		}
+		corners[cornerCount++] = (ObjCorner)
+		{
+			ResolveIndex(position, g_positions.count / 3, "position"),
+			ResolveIndex(texcoord, g_texcoords.count / 2, "texcoord"),
+			ResolveIndex(normal, g_normals.count / 3, "normal")
+		};
+	}
+	for(int i = 2; i < cornerCount; ++i)
+	{
+		GroupPushCorner(group, corners[0]);
+		GroupPushCorner(group, corners[i - 1]);
+		GroupPushCorner(group, corners[i]);
+	}
+}
+
+static void ParseMtl(const char* filePath)
+{
+	FILE* file = fopen(filePath, "rb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "mesh_baker: can't open %s, using default materials\n", filePath);
+		return;
+	}
+	char line[512];
+	MtlMaterial* material = NULL;
+	while(fgets(line, sizeof(line), file))
+	{
+		if(strncmp(line, "newmtl ", 7) == 0 && g_materialCount < MATERIAL_MAX)
+		{
+			material = &g_materials[g_materialCount++];
+			ReadName(material->name, line + 7);
+			material->baked = (BakedMaterial) {.diffuseColor = {255, 255, 255, 255}};
+		}
+		else if(material != NULL && strncmp(line, "Kd ", 3) == 0)
+		{
+			char* end = NULL;
+			const char* text = line + 3;
+			for(int i = 0; i < 3; ++i)
+			{
+				float value = strtof(text, &end);
+				text = end;
+				material->baked.diffuseColor[i] = (uint8_t) (value < 0 ? 0 : value > 1 ? 255 : value * 255.0f);
+			}
+		}
+		else if(material != NULL && strncmp(line, "map_Kd ", 7) == 0)
+		{
+			ReadName(material->baked.diffuseTexture, line + 7);
+		}
+	}
+	fclose(file);
+}
+
+static int ParseObj(const char* filePath)
+{
+	FILE* file = fopen(filePath, "rb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "mesh_baker: can't open %s\n", filePath);
+		return 0;
+	}
+	char line[1024];
+	ObjGroup* group = GetGroup("");
+	while(fgets(line, sizeof(line), file))
+	{
+		if(strncmp(line, "v ", 2) == 0)
+		{
+			ReadFloats(&g_positions, line + 2, 3);
+		}
+		else if(strncmp(line, "vt ", 3) == 0)
+		{
+			ReadFloats(&g_texcoords, line + 3, 2);
+		}
+		else if(strncmp(line, "vn ", 3) == 0)
+		{
+			ReadFloats(&g_normals, line + 3, 3);
+		}
+		else if(strncmp(line, "f ", 2) == 0)
+		{
+			ReadFace(group, line + 2);
+		}
+		else if(strncmp(line, "usemtl ", 7) == 0)
+		{
+			char name[BAKED_MESH_TEXTURE_NAME_SIZE];
+			ReadName(name, line + 7);
+			group = GetGroup(name);
+		}
+		else if(strncmp(line, "mtllib ", 7) == 0)
+		{
+			// the library sits next to the obj
+			char name[BAKED_MESH_TEXTURE_NAME_SIZE];
+			ReadName(name, line + 7);
+			char mtlPath[1024];
+			const char* separator = strrchr(filePath, '/');
+			int directoryLength = separator != NULL ? (int) (separator - filePath + 1) : 0;
+			snprintf(mtlPath, sizeof(mtlPath), "%.*s%s", directoryLength, filePath, name);
+			ParseMtl(mtlPath);
+		}
+	}
+	fclose(file);
+	return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Baking
+//----------------------------------------------------------------------------------------------------------------------
+static uint32_t Align4(uint32_t offset)
+{
+	return (offset + 3u) & ~3u;
+}
+
+// index of the material in the baked material table, the first one if the mtl doesn't know it
+static int FindMaterial(const char* name)
+{
+	for(int i = 0; i < g_materialCount; ++i)
+	{
+		if(strcmp(g_materials[i].name, name) == 0)
+		{
+			return i;
+		}
+	}
+	return 0;
+}
+
+static uint32_t HashCorner(ObjCorner corner)
+{
+	uint32_t hash = (uint32_t) corner.position * 73856093u;
+	hash ^= (uint32_t) corner.texcoord * 19349663u;
+	hash ^= (uint32_t) corner.normal * 83492791u;
+	return hash;
+}
+
+// writes one welded mesh of a group, returns the size of its data block
+static uint32_t BakeGroup(const ObjGroup* group, unsigned char* data, BakedMeshHeader* header)
+{
+	// open addressing map from corner to vertex, twice the corners so it never fills up
+	int slotCount = 1;
+	while(slotCount < group->cornerCount * 2)
+	{
+		slotCount *= 2;
+	}
+	int* slots = malloc(slotCount * sizeof(int));
+	memset(slots, -1, slotCount * sizeof(int));
+	int* cornerVertex = malloc(group->cornerCount * sizeof(int));
+	ObjCorner* vertexCorners = malloc(group->cornerCount * sizeof(ObjCorner));
+	int vertexCount = 0;
+	for(int i = 0; i < group->cornerCount; ++i)
+	{
+		ObjCorner corner = group->corners[i];
+		uint32_t slot = HashCorner(corner) & (uint32_t) (slotCount - 1);
+		while(slots[slot] >= 0)
+		{
+			ObjCorner other = vertexCorners[slots[slot]];
+			if(other.position == corner.position && other.texcoord == corner.texcoord && other.normal == corner.normal)
+			{
+				break;
+			}
+			slot = (slot + 1) & (uint32_t) (slotCount - 1);
+		}
+		if(slots[slot] < 0)
+		{
+			slots[slot] = vertexCount;
+			vertexCorners[vertexCount++] = corner;
+		}
+		cornerVertex[i] = slots[slot];
+	}
+
+	if(vertexCount > UINT16_MAX)
+	{
+		fprintf(stderr, "mesh_baker: %d vertices don't fit 16 bit indices\n", vertexCount);
+		exit(1);
+	}
+
+	header->vertexCount = vertexCount;
+	header->indexCount = group->cornerCount;
+	if(data != NULL)
+	{
+		float* vertices = (float*) (data + header->dataOffset);
+		float* normals = vertices + vertexCount * 3;
+		float* texcoords = normals + vertexCount * 3;
+		uint16_t* indices = (uint16_t*) (texcoords + vertexCount * 2);
+		for(int i = 0; i < vertexCount; ++i)
+		{
+			ObjCorner corner = vertexCorners[i];
+			for(int c = 0; c < 3; ++c)
+			{
+				vertices[i * 3 + c] = corner.position >= 0 ? g_positions.values[corner.position * 3 + c] : 0.0f;
+				normals[i * 3 + c] = corner.normal >= 0 ? g_normals.values[corner.normal * 3 + c] : 0.0f;
+			}
+			texcoords[i * 2 + 0] = corner.texcoord >= 0 ? g_texcoords.values[corner.texcoord * 2 + 0] : 0.0f;
+			texcoords[i * 2 + 1] = corner.texcoord >= 0 ? 1.0f - g_texcoords.values[corner.texcoord * 2 + 1] : 0.0f;
+		}
+		for(int i = 0; i < group->cornerCount; ++i)
+		{
+			indices[i] = (uint16_t) cornerVertex[i];
+		}
+	}
+
+	free(slots);
+	free(cornerVertex);
+	free(vertexCorners);
+	return Align4(vertexCount * 8 * sizeof(float) + group->cornerCount * sizeof(uint16_t));
+}
+
+static int WriteMesh(const char* filePath)
+{
+	int meshCount = 0;
+	for(int i = 0; i < g_groupCount; ++i)
+	{
+		meshCount += g_groups[i].cornerCount > 0 ? 1 : 0;
+	}
+
+	BakedMeshFileHeader fileHeader = {.magic = {'R', 'M', 'S', 'H'}, .version = BAKED_MESH_VERSION, .materialCount = g_materialCount > 0 ? g_materialCount : 1, .meshCount = meshCount};
+	BakedMeshHeader meshHeaders[GROUP_MAX] = {0};
+	uint32_t offset = sizeof(BakedMeshFileHeader) + fileHeader.materialCount * sizeof(BakedMaterial) + meshCount * sizeof(BakedMeshHeader);
+
+	// first pass sizes the blocks, second one fills them
+	int meshIndex = 0;
+	for(int i = 0; i < g_groupCount; ++i)
+	{
+		if(g_groups[i].cornerCount > 0)
+		{
+			meshHeaders[meshIndex].materialIndex = FindMaterial(g_groups[i].materialName);
+			meshHeaders[meshIndex].dataOffset = offset;
+			offset += BakeGroup(&g_groups[i], NULL, &meshHeaders[meshIndex]);
+			++meshIndex;
+		}
+	}
+
+	unsigned char* data = calloc(1, offset);
+	memcpy(data, &fileHeader, sizeof(fileHeader));
+	BakedMaterial* materials = (BakedMaterial*) (data + sizeof(BakedMeshFileHeader));
+	materials[0] = (BakedMaterial) {.diffuseColor = {255, 255, 255, 255}};
+	for(int i = 0; i < g_materialCount; ++i)
+	{
+		materials[i] = g_materials[i].baked;
+	}
+	meshIndex = 0;
+	for(int i = 0; i < g_groupCount; ++i)
+	{
+		if(g_groups[i].cornerCount > 0)
+		{
+			BakeGroup(&g_groups[i], data, &meshHeaders[meshIndex]);
+			++meshIndex;
+		}
+	}
+	memcpy(materials + fileHeader.materialCount, meshHeaders, meshCount * sizeof(BakedMeshHeader));
+
+	FILE* file = fopen(filePath, "wb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "mesh_baker: can't write %s\n", filePath);
+		free(data);
+		return 0;
+	}
+	int isWritten = fwrite(data, 1, offset, file) == offset;
+	fclose(file);
+	free(data);
+
+	for(int i = 0; i < meshCount; ++i)
+	{
+		printf("mesh_baker: %s mesh %d: %d vertices, %d triangles, material %d\n", filePath, i, meshHeaders[i].vertexCount, meshHeaders[i].indexCount / 3, meshHeaders[i].materialIndex);
+	}
+	return isWritten;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Main entry point
+//----------------------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "usage: mesh_baker <input.obj> <output.mesh>\n");
+		return 1;
+	}
+	if(!ParseObj(argv[1]) || !WriteMesh(argv[2]))
+	{
+		return 1;
+	}
+	return 0;
+}